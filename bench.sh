@@ -0,0 +1,104 @@
+#!/bin/sh
+
+# Exports a generated repository with an optimised svnescape into a throwaway
+# git fast-import, and reports how fast it went.  Results are appended to
+# $BENCH_RESULTS (bench-results.tsv) so that runs can be compared.
+#
+#   bench.sh [name] [repo-generator arguments...]
+#
+# BENCH_SOURCE=dump reads the dump directly rather than loading it into a
+# file:// repository, BENCH_LAYOUT=0 exports trunk alone rather than every
+# branch and tag, and BENCH_CONFIG is extra =option lines for svnescape.
+# Needs svnadmin (unless reading the dump) and git; peak RSS needs GNU time.
+
+name=${1:-default}
+[ $# -gt 0 ] && shift
+
+source=${BENCH_SOURCE:-repo}
+layout=${BENCH_LAYOUT:-1}
+results=${BENCH_RESULTS:-bench-results.tsv}
+work=$(mktemp -d "${TMPDIR:-/tmp}/svnescape-bench.XXXXXX") || exit 1
+trap 'rm -rf "$work"' EXIT
+
+now() {
+	date +%s.%N
+}
+
+# Seconds since $1, to the millisecond
+since() {
+	echo "$(now) $1" | awk '{printf "%.3f", $1 - $2}'
+}
+
+echo "Building"
+make -s OPT=-O2 OBJDIR=obj/bench BINDIR=bin/bench svnescape repo-generator || exit 1
+
+echo "Generating $name: $*"
+start=$(now)
+bin/bench/repo-generator "$@" > "$work/repo.dump" || exit 1
+generate=$(since $start)
+
+load=0
+if [ "$source" = "dump" ]; then
+	url="dump://$work/repo.dump"
+else
+	start=$(now)
+	svnadmin create "$work/repo" && svnadmin load -q "$work/repo" < "$work/repo.dump" || exit 1
+	load=$(since $start)
+	url="file://$work/repo"
+fi
+revisions=$(grep -ac '^Revision-number: ' "$work/repo.dump")
+
+git init -q --bare "$work/git" || exit 1
+
+# GNU time gives the peak RSS; without it there is only the elapsed time
+timer=
+if /usr/bin/time -f '%e' true > /dev/null 2>&1; then
+	timer="/usr/bin/time -o $work/time -f %M"
+fi
+
+echo "Exporting from $url"
+start=$(now)
+(
+	if [ "$layout" != "0" ]; then
+		echo "=repo-url $url"
+		echo "=trunk-path trunk"
+		echo "=branches-path branches"
+		echo "=tags-path tags"
+	else
+		echo "=repo-url $url/trunk"
+	fi
+	echo "=repo-name bench"
+	echo "=start-rev 0"
+	echo "=git-ref refs/heads/bench"
+	[ ! -z "$BENCH_CONFIG" ] && echo "$BENCH_CONFIG"
+) | $timer bin/bench/svnescape 2> "$work/svnescape.log" | git --git-dir="$work/git" fast-import --quiet || {
+	tail -20 "$work/svnescape.log"
+	exit 1
+}
+exporting=$(since $start)
+
+rss=-
+[ -f "$work/time" ] && rss=$(tail -1 "$work/time")
+
+blobs=$(git --git-dir="$work/git" cat-file --batch-all-objects --batch-check='%(objecttype) %(objectsize)' | awk '$1 == "blob" {n += $2} END {printf "%.1f", n / 1048576}')
+rate=$(echo "$revisions $blobs $exporting" | awk '{t = $3 > 0? $3 : 0.001; printf "%.1f %.1f", $1 / t, $2 / t}')
+revrate=${rate% *}
+mbrate=${rate#* }
+
+echo "$revisions revisions, $blobs MB of blobs"
+echo "generate ${generate}s, load ${load}s, export ${exporting}s"
+echo "$revrate revisions/s, $mbrate MB/s, peak RSS ${rss}KB"
+
+commit=$(git rev-parse --short HEAD 2> /dev/null)
+previous=
+if [ -f "$results" ]; then
+	previous=$(awk -F '\t' -v name="$name" -v source="$source" '$3 == name && $5 == source' "$results" | tail -1)
+else
+	printf 'date\tcommit\tname\targs\tsource\trevisions\tblobMB\tgenerate\tload\texport\trevs/s\tMB/s\tpeakRSSKB\n' > "$results"
+fi
+printf '%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n' "$(date +%Y-%m-%dT%H:%M:%S)" "$commit" "$name" "$*" "$source" \
+	"$revisions" "$blobs" "$generate" "$load" "$exporting" "$revrate" "$mbrate" "$rss" >> "$results"
+
+if [ ! -z "$previous" ]; then
+	echo "$previous" | awk -F '\t' '{printf "Last run (%s at %s): export %ss, %s revisions/s, %s MB/s, peak RSS %sKB\n", $1, $2, $10, $11, $12, $13}'
+fi
@@ -0,0 +1,90 @@
+#ifndef BASETEXTSTORE_H__
+#define BASETEXTSTORE_H__
+
+#include "Thread.h"
+
+#include <string>
+#include <map>
+#include <set>
+#include <list>
+
+extern "C" {
+#include <svn_types.h>
+}
+
+struct apr_pool_t;
+struct svn_stream_t;
+
+class FileContents;
+
+/**
+ * An on-disk store holding the latest known text of files, keyed by their
+ * path relative to the session URL.  It provides the base texts that
+ * replayed text deltas are applied against.
+ *
+ * Texts are identified by their MD5 so a stale base is never used; a caller
+ * which cannot get a matching base falls back to fetching the full text.
+ * Base files are named by both path and MD5, so an index left behind by a
+ * run which didn't finish can't refer to a file since overwritten with
+ * other contents.
+ * New texts are written to spool files which are hard linked into the store,
+ * so the spool file can be handed to the exporter and deleted once written
+ * without disturbing the base.  The least recently used bases are dropped
+ * once the store grows over its size limit.
+ */
+class BaseTextStore
+{
+public:
+	BaseTextStore(std::string const& directory, unsigned long long sizeLimit);
+	~BaseTextStore();
+
+	// Open the base text of path if the store holds the text with the given
+	// MD5 (as a hex string).  Returns false if it does not.
+	bool OpenBase(std::string const& path, char const* md5, svn_stream_t** stream, apr_pool_t* pool);
+	// Hard link the base text of path with the given MD5 to a new spool file.
+	bool LinkBase(std::string const& path, char const* md5, std::string& spoolFile);
+
+	// Create a new, empty spool file for writing a full text into.
+	void CreateSpool(std::string& spoolFile, svn_stream_t** stream, apr_pool_t* pool);
+	// Make a finished spool file the base text of path at revision.
+	void Save(std::string const& path, svn_revnum_t revision, std::string const& spoolFile, char const* md5);
+	// Store a full text fetched by other means as the base of path.
+	void Save(std::string const& path, svn_revnum_t revision, FileContents const& contents);
+
+	// Whether there are no bases at all, so replayed deltas would all be
+	// dropped.
+	bool Empty();
+
+	// Where fetched texts too large for memory should be spooled, so that
+	// they can be linked into the store.
+	std::string SpoolDirectory() const { return m_directory + "/spool"; }
+
+protected:
+	struct Entry
+	{
+		std::string m_md5;
+		unsigned long long m_size;
+		svn_revnum_t m_revision;
+		std::list<std::string>::iterator m_lru;
+	};
+	typedef std::map<std::string, Entry> Entries;
+
+	std::string BaseFile(std::string const& path, std::string const& md5) const;
+	void Touch(Entry& entry);
+	void Insert(std::string const& path, svn_revnum_t revision, std::string const& file, char const* md5);
+	void Evict();
+	void ReadIndex();
+	void RemoveStrays();
+	void WriteIndex();
+
+	std::string m_directory;
+	unsigned long long m_sizeLimit;
+	unsigned long long m_size;
+	unsigned long m_nextSpool;
+
+	Mutex m_mutex;
+	Entries m_entries;
+	std::list<std::string> m_lru;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef BLOBCACHE_H__
+#define BLOBCACHE_H__
+
+#include "Path.h"
+#include "Thread.h"
+
+#include <stdio.h>
+#include <map>
+#include <string>
+
+extern "C" {
+#include <svn_types.h>
+}
+
+class FileContents;
+
+/**
+ * An on-disk cache of fetched file contents, so that re-running an export
+ * (after it died, or with different ignore patterns or authors) does not
+ * fetch every file from the server again.
+ *
+ * Contents are stored once per git blob id under objects/.  The index maps
+ * each path (relative to the repo-url) and revision fetched to its blob id,
+ * and is appended to as files are fetched so that it survives a crash.  A
+ * cache belongs to the repo-url it was created for.
+ */
+class BlobCache
+{
+public:
+	BlobCache(std::string const& directory, std::string const& url);
+	~BlobCache();
+
+	// Maps the cached contents of relPath at revision into contents, and
+	// sets blobId to their raw git blob id.  Returns false on a miss.
+	bool Find(Path const& relPath, svn_revnum_t revision, FileContents& contents, std::string& blobId);
+	void Save(Path const& relPath, svn_revnum_t revision, FileContents const& contents, std::string const& blobId);
+
+	unsigned long GetHits() const { return m_hits; }
+	unsigned long GetMisses() const { return m_misses; }
+
+protected:
+	typedef std::map<std::pair<Path, svn_revnum_t>, std::string> Index;
+
+	std::string ObjectFile(std::string const& blobId) const;
+	// Returns whether the index ends with a complete line.
+	bool ReadIndex(std::string const& url);
+
+	std::string m_directory;
+
+	Mutex m_mutex;
+	Index m_index;
+	FILE* m_indexFile;
+	unsigned long m_nextTemp;
+	unsigned long m_hits;
+	unsigned long m_misses;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef BLOBMARKS_H__
+#define BLOBMARKS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Raw git object ids are SHA-1s.
+#define BLOB_ID_SIZE (20)
+
+/**
+ * The fast-import mark of every blob written or imported, by raw git blob
+ * id.  A long history has millions, so rather than a map of strings they
+ * are kept in one open addressed table of fixed size entries, at most half
+ * full.  Blob ids are hashes already, so their first bytes pick the slot.
+ */
+class BlobMarks
+{
+public:
+	BlobMarks();
+
+	// The mark of the blob with id, or 0 if it has none.
+	unsigned long Find(std::string const& id) const;
+	void Set(std::string const& id, unsigned long mark);
+
+	size_t Size() const { return m_count; }
+
+private:
+	struct Entry
+	{
+		unsigned char m_id[BLOB_ID_SIZE];
+		// 0 when the slot is empty; marks start at 1.
+		uint32_t m_mark;
+	};
+
+	static size_t Slot(std::vector<Entry> const& entries, char const* id);
+	void Grow();
+
+	std::vector<Entry> m_entries;
+	size_t m_count;
+};
+
+#endif
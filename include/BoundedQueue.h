@@ -0,0 +1,101 @@
+#ifndef BOUNDEDQUEUE_H__
+#define BOUNDEDQUEUE_H__
+
+#include "Thread.h"
+
+#include <algorithm>
+#include <deque>
+#include <stddef.h>
+
+/**
+ * A fixed capacity queue for handing work between pipeline stages.  Items
+ * are swapped in and out rather than copied, so T must be default
+ * constructible and have a cheap swap (e.g. a container).
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity) :
+		m_notEmpty(m_mutex),
+		m_notFull(m_mutex),
+		m_capacity(capacity? capacity : 1),
+		m_closed(false)
+	{
+	}
+
+	// Blocks while the queue is full.  Returns false, leaving item
+	// untouched, if the queue has been closed.
+	bool Push(T& item)
+	{
+		ScopedLock lock(m_mutex);
+		while(!m_closed && m_items.size() >= m_capacity) {
+			m_notFull.Wait();
+		}
+		if(m_closed) {
+			return false;
+		}
+
+		using std::swap;
+		m_items.push_back(T());
+		swap(m_items.back(), item);
+		m_notEmpty.Signal();
+		return true;
+	}
+
+	// Blocks while the queue is empty.  Returns false once the queue has
+	// been closed and drained.
+	bool Pop(T& item)
+	{
+		ScopedLock lock(m_mutex);
+		while(!m_closed && m_items.empty()) {
+			m_notEmpty.Wait();
+		}
+		if(m_items.empty()) {
+			return false;
+		}
+
+		using std::swap;
+		swap(item, m_items.front());
+		m_items.pop_front();
+		m_notFull.Signal();
+		return true;
+	}
+
+	// Like Pop() but returns false rather than waiting if the queue is empty.
+	bool TryPop(T& item)
+	{
+		ScopedLock lock(m_mutex);
+		if(m_items.empty()) {
+			return false;
+		}
+
+		using std::swap;
+		swap(item, m_items.front());
+		m_items.pop_front();
+		m_notFull.Signal();
+		return true;
+	}
+
+	// Wakes up both ends; nothing more can be pushed.
+	void Close()
+	{
+		ScopedLock lock(m_mutex);
+		m_closed = true;
+		m_notEmpty.Broadcast();
+		m_notFull.Broadcast();
+	}
+
+private:
+	BoundedQueue(BoundedQueue const&);
+	BoundedQueue& operator=(BoundedQueue const&);
+
+	Mutex m_mutex;
+	Condition m_notEmpty;
+	Condition m_notFull;
+	std::deque<T> m_items;
+	size_t m_capacity;
+	bool m_closed;
+};
+
+#endif
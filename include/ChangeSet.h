@@ -0,0 +1,113 @@
+#ifndef CHANGESET_H__
+#define CHANGESET_H__
+
+#include "Path.h"
+
+#include <algorithm>
+#include <vector>
+#include <stddef.h>
+
+/**
+ * The changes in one revision, in the order they were added, with a hash
+ * index on the Path Entry::m_relPath.  A path may be added more than once
+ * (e.g. a delete followed by an add); find() returns the first.
+ *
+ * Entries can be modified through iterators, but not their paths.
+ */
+template<typename Entry>
+class ChangeSet
+{
+public:
+	typedef typename std::vector<Entry>::iterator iterator;
+	typedef typename std::vector<Entry>::const_iterator const_iterator;
+
+	ChangeSet() : m_mask(0) { }
+
+	iterator begin() { return m_entries.begin(); }
+	iterator end() { return m_entries.end(); }
+	const_iterator begin() const { return m_entries.begin(); }
+	const_iterator end() const { return m_entries.end(); }
+	size_t size() const { return m_entries.size(); }
+	bool empty() const { return m_entries.empty(); }
+	Entry& operator[](size_t i) { return m_entries[i]; }
+	Entry const& operator[](size_t i) const { return m_entries[i]; }
+	Entry& back() { return m_entries.back(); }
+
+	void push_back(Entry const& entry)
+	{
+		// Keep the table at most half full.
+		if((m_entries.size() + 1) * 2 > m_slots.size()) {
+			Rehash(m_slots.size()? m_slots.size() * 2 : 16);
+		}
+
+		m_entries.push_back(entry);
+		size_t slot = Probe(entry.m_relPath);
+		if(m_slots[slot] == 0) {
+			m_slots[slot] = m_entries.size();
+		}
+	}
+
+	iterator find(Path const& relPath)
+	{
+		if(m_slots.empty()) {
+			return end();
+		}
+		size_t index = m_slots[Probe(relPath)];
+		return index? m_entries.begin() + (index - 1) : end();
+	}
+
+	const_iterator find(Path const& relPath) const
+	{
+		return const_cast<ChangeSet*>(this)->find(relPath);
+	}
+
+	void clear()
+	{
+		m_entries.clear();
+		m_slots.clear();
+		m_mask = 0;
+	}
+
+	void swap(ChangeSet& other)
+	{
+		m_entries.swap(other.m_entries);
+		m_slots.swap(other.m_slots);
+		std::swap(m_mask, other.m_mask);
+	}
+
+protected:
+	// The slot holding relPath, or the empty slot it would go in.
+	size_t Probe(Path const& relPath) const
+	{
+		size_t slot = relPath.Hash() & m_mask;
+		while(m_slots[slot] && m_entries[m_slots[slot] - 1].m_relPath != relPath) {
+			slot = (slot + 1) & m_mask;
+		}
+		return slot;
+	}
+
+	void Rehash(size_t slots)
+	{
+		m_slots.assign(slots, 0);
+		m_mask = slots - 1;
+		for(size_t i = 0; i < m_entries.size(); ++i) {
+			size_t slot = Probe(m_entries[i].m_relPath);
+			if(m_slots[slot] == 0) {
+				m_slots[slot] = i + 1;
+			}
+		}
+	}
+
+	std::vector<Entry> m_entries;
+	// 1 + the position of the first entry for each path, or 0 for none.
+	std::vector<unsigned int> m_slots;
+	size_t m_mask;
+};
+
+template<typename Entry>
+inline void swap(ChangeSet<Entry>& a, ChangeSet<Entry>& b)
+{
+	a.swap(b);
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef CHECKPOINT_H__
+#define CHECKPOINT_H__
+
+#include <string>
+
+extern "C" {
+#include <svn_types.h>
+}
+
+/**
+ * How far an export has got, saved after git fast-import has been told to
+ * checkpoint so that an export which dies can carry on from there.
+ *
+ * The file is only written once everything it describes has been written
+ * to fast-import, but fast-import may still die before acting on it.  So a
+ * checkpoint is only trusted when the git ref agrees with it; see Matches().
+ */
+struct Checkpoint
+{
+	Checkpoint();
+
+	// Returns false if there is no checkpoint file.
+	bool Load(std::string const& fileName);
+	// Replaces the file atomically, and syncs it to disk.
+	void Save(std::string const& fileName) const;
+
+	// Whether this is a checkpoint of the same export, with the git ref
+	// still at the last revision committed.  startRev is the revision after
+	// the one the ref was made from.
+	bool Matches(std::string const& url, std::string const& ref, svn_revnum_t startRev) const;
+
+	std::string m_url;
+	std::string m_ref;
+	// Every revision up to here has been written out, whether or not it
+	// needed a commit.
+	svn_revnum_t m_revision;
+	// The revision the last commit was made from.
+	svn_revnum_t m_committed;
+	// The next mark fast-import has not seen.
+	unsigned long m_nextMark;
+};
+
+#endif
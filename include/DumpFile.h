@@ -0,0 +1,169 @@
+#ifndef DUMPFILE_H__
+#define DUMPFILE_H__
+
+#include "Path.h"
+#include "Thread.h"
+
+#include <stddef.h>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <svn_types.h>
+}
+
+struct apr_pool_t;
+struct svn_stream_t;
+
+/**
+ * An svnadmin dump file, memory mapped and indexed so that it can stand in
+ * for the repository it was dumped from.  Opening it reads every record's
+ * headers once, skipping over the contents, and keeps where each revision's
+ * records are and every version of every path.  Contents are only read when
+ * they are asked for, straight out of the mapping.
+ *
+ * Dumps with text deltas (--deltas) are supported, as are incremental dumps
+ * concatenated onto the dumps they follow on from.  Asking about anything
+ * from before the first revision of a dump which doesn't start at r0 is an
+ * error, as there is no way to know what it was.
+ *
+ * Open files are shared by every session reading them, and only read once
+ * they are indexed, so they may be read from any thread.
+ */
+class DumpFile
+{
+public:
+	struct Text
+	{
+		char const* m_data;
+		size_t m_length;
+		// m_data is an svndiff against m_base, or against nothing if that
+		// is NULL.
+		bool m_delta;
+		Text const* m_base;
+	};
+
+	struct Node
+	{
+		svn_revnum_t m_revision;
+		// 'F', 'D', or 'X' once deleted.
+		char m_kind;
+		// Added, replaced or deleted rather than changed, so anything under
+		// it is as it was copied, or gone.
+		bool m_reset;
+		// Where a directory was copied from.
+		Path m_copyFromPath;
+		svn_revnum_t m_copyFromRev;
+		// A file's full text, as of this version.
+		Text const* m_text;
+	};
+
+	// One record as it is in the dump, pointing into the mapping.
+	struct Record
+	{
+		enum Type { Type_Revision, Type_Node, Type_Other };
+
+		Type m_type;
+		svn_revnum_t m_revision;
+		std::string m_path;
+		// 'F', 'D', or 'U' if not given.
+		char m_kind;
+		// 'A', 'M', 'D' or 'R'.
+		char m_action;
+		Path m_copyFromPath;
+		svn_revnum_t m_copyFromRev;
+		char const* m_props;
+		size_t m_propsLength;
+		bool m_hasText;
+		bool m_delta;
+		char const* m_text;
+		size_t m_textLength;
+		std::string m_textMD5;
+		std::string m_baseMD5;
+	};
+
+	// Must be called once, before any other thread is started.
+	static void Init();
+	static void Shutdown();
+
+	// Opens or shares the dump in fileName.  Every file opened must be
+	// released.
+	static DumpFile* Open(std::string const& fileName);
+	static void Release(DumpFile* file);
+
+	std::string const& GetFileName() const { return m_fileName; }
+	svn_revnum_t GetFirstRevision() const { return m_revisions.empty()? SVN_INVALID_REVNUM : m_revisions.front().m_revision; }
+	svn_revnum_t GetLatestRevision() const { return m_revisions.empty()? SVN_INVALID_REVNUM : m_revisions.back().m_revision; }
+
+	// The revision's own record, and the span of its node records.  Throws
+	// if the revision is not in the dump.
+	void FindRevision(svn_revnum_t revision, Record& record, char const*& nodes, char const*& end) const;
+	// Parses the record at pos, moving pos past it.  Returns false at end.
+	bool ReadRecord(char const*& pos, char const* end, Record& record) const;
+
+	// What path (relative to the repository root) is at revision, or NULL
+	// if there is nothing there.
+	Node const* Find(std::string const& path, svn_revnum_t revision) const;
+	// Adds the immediate children of the directory path at revision to
+	// entries, with true for directories.
+	void List(std::string const& path, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries) const;
+	// Writes out a full text, applying deltas if need be.
+	void WriteText(Text const* text, svn_stream_t* stream, apr_pool_t* pool) const;
+
+private:
+	explicit DumpFile(std::string const& fileName);
+	~DumpFile();
+	DumpFile(DumpFile const&);
+	DumpFile& operator=(DumpFile const&);
+
+	struct Revision
+	{
+		svn_revnum_t m_revision;
+		// The start of the revision's record, and the end of its last node.
+		char const* m_start;
+		char const* m_end;
+	};
+
+	void Index();
+	void AddNode(Record const& record, svn_revnum_t revision);
+	// As Find(), but known is set false rather than throwing when there is
+	// no telling.
+	Node const* Resolve(Path const& path, svn_revnum_t revision, bool& known) const;
+	// The last version of path itself at or before revision.
+	Node const* Latest(Path const& path, svn_revnum_t revision) const;
+	// The newest version deciding what path is at revision: its own, or
+	// one which reset a parent since.  decider is the path it belongs to.
+	// Without ownChanges only resets of path itself count.
+	Node const* Decide(Path const& path, svn_revnum_t revision, bool ownChanges, Path& decider) const;
+	void Collect(Path const& path, svn_revnum_t revision, std::set<std::string>& names) const;
+
+	static Mutex* s_lock;
+	static std::map<std::string, DumpFile*> s_open;
+
+	std::string m_fileName;
+	unsigned int m_refs;
+	void* m_map;
+	size_t m_mapSize;
+
+	std::vector<Revision> m_revisions;
+	// Every version of every path, in the order they were dumped.
+	typedef std::map<Path, std::vector<Node> > Nodes;
+	Nodes m_nodes;
+	// Every path ever added to each directory.
+	typedef std::map<Path, std::set<Path> > Children;
+	Children m_children;
+	std::deque<Text> m_texts;
+
+	// The last text rebuilt from deltas for each file, so that rebuilding
+	// the next only applies its own delta.
+	typedef std::map<Text const*, std::string> Rebuilt;
+	mutable Mutex m_rebuiltLock;
+	mutable Rebuilt m_rebuilt;
+	mutable size_t m_rebuiltSize;
+};
+
+#endif
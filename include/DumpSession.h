@@ -0,0 +1,42 @@
+#ifndef DUMPSESSION_H__
+#define DUMPSESSION_H__
+
+#include "Session.h"
+
+class DumpFile;
+
+/**
+ * A session reading an svnadmin dump file rather than a repository, for
+ * dump:// URLs; e.g. dump:///srv/dumps/project.dump/trunk.  The dump is
+ * shared between every session reading it (see DumpFile), and full texts
+ * are handed over in place rather than copied.
+ */
+class DumpSession : public Session
+{
+public:
+	// Whether url can be opened as a DumpSession.
+	static bool Handles(std::string const& url);
+
+	DumpSession(std::string const& url, apr_pool_t* pool);
+	~DumpSession();
+
+	std::string GetSubtree() { return m_subtree.empty()? m_subtree : "/" + m_subtree; }
+	svn_revnum_t GetLatestRevision();
+	svn_node_kind_t CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool);
+	void GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool);
+	void GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool);
+	bool BorrowFile(char const* relPath, svn_revnum_t revision, char const** data, size_t* length);
+	void GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool);
+	void Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool);
+
+protected:
+	// relPath relative to the repository root, as the dump has it.
+	std::string DumpPath(char const* relPath) const;
+
+	apr_pool_t* m_pool;
+	DumpFile* m_dump;
+	// Without a leading '/'.
+	std::string m_subtree;
+};
+
+#endif
@@ -2,9 +2,16 @@
 #define FASTEXPORT_H__
 
 #include "SVNSimple.h"
+#include "FetchPool.h"
+#include "Output.h"
+#include "RevisionIndex.h"
+#include "Layout.h"
+#include "BlobMarks.h"
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <map>
 
 class FastExport
 {
@@ -12,16 +19,63 @@ public:
 	FastExport(std::string const& commitRef, std::string const& parentSHA);
 	~FastExport();
 
-	void DumpRevisions(SVNSimple& connection, std::vector<SVNSimple::Revision>& revisions);
+	void DumpRevisions(FetchPool& fetcher, std::vector<SVNSimple::Revision>& revisions);
 
 	svn_revnum_t GetLastRevisionCommitted() const { return m_lastRevisionCommitted; }
 
+	// Has fast-import write out everything so far and update the ref.
+	void Checkpoint(svn_revnum_t revision);
+
+	unsigned long GetNextMark() const { return m_nextMark; }
+	// For carrying on from where another run left off.
+	void SetNextMark(unsigned long mark) { m_nextMark = mark; }
+	void SetParent(std::string const& parentSHA) { m_parentSHA = parentSHA; }
+
+	// Reads the marks file fast-import was started with (--import-marks),
+	// so that it isn't sent blobs it already has and new marks follow on.
+	// The marks in commits are those of commits.
+	void ImportMarks(std::string const& fileName, RevisionIndex const* commits);
+	// The id fast-import gave an imported commit mark, as hex.
+	bool GetMarkId(unsigned long mark, std::string& id) const;
+
+	// Every commit made is added to index.
+	void SetRevisionIndex(RevisionIndex* index) { m_revisionIndex = index; }
+
+	// Commit each branch and tag in layout to its own ref rather than
+	// everything to the commit ref.  With a parent SHA, branches not yet
+	// written carry on from their refs as the last run left them; without
+	// one, they start unparented.
+	void SetLayout(Layout const* layout) { m_layout = layout; }
+	Layout const* GetLayout() const { return m_layout; }
+
 protected:
-	void MakeCommit(SVNSimple::Revision const& rev);
+	static bool HasContents(SVNSimple::Revision::File const& file);
+	void WriteRevisions(FetchPool& fetcher, std::vector<SVNSimple::Revision> const& revisions, std::deque<FetchPool::Request*>& requests);
+	void WriteBlob(Output::Transaction& out, FetchPool::Request const& request);
+	void MakeCommits(SVNSimple::Revision const& rev, std::vector<unsigned long> const& fileMarks);
+	unsigned long MakeCommit(SVNSimple::Revision const& rev, std::vector<unsigned long> const& fileMarks, std::string const& ref, std::string const& root, std::string const& from, bool deleteAll);
+	bool BranchPath(Path const& relPath, std::string const& root, std::string& path) const;
 
 	std::string m_commitRef;
 	std::string m_parentSHA;
 	svn_revnum_t m_lastRevisionCommitted;
+
+	// Commits and blobs share one sequence of marks, so any blob mark can
+	// be referred to again by later commits.
+	unsigned long m_nextMark;
+	// Every blob written so far or imported.
+	BlobMarks m_blobMarks;
+	// Mark => raw id of every imported commit.
+	typedef std::map<unsigned long, std::string> CommitMarks;
+	CommitMarks m_commitMarks;
+
+	RevisionIndex* m_revisionIndex;
+
+	Layout const* m_layout;
+	// The root of every branch and tag written to => what it now points at,
+	// as a mark (or another ref).
+	typedef std::map<std::string, std::string> BranchTips;
+	BranchTips m_branchTips;
 };
 
 #endif
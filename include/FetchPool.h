@@ -0,0 +1,116 @@
+#ifndef FETCHPOOL_H__
+#define FETCHPOOL_H__
+
+#include "SVNSimple.h"
+#include "Thread.h"
+#include "BaseTextStore.h"
+#include "BlobCache.h"
+#include "FileContents.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+
+class Recorder;
+class Stats;
+
+/**
+ * Fetches file contents in parallel using a number of worker threads, each
+ * with its own RA session.  Requests are queued in the order their contents
+ * will be written out and workers always take the oldest queued request, so
+ * the caller can Wait() on requests in order without risk of deadlock.
+ *
+ * With no workers every request is fetched synchronously in Wait() on the
+ * connection passed to the constructor.
+ */
+class FetchPool
+{
+public:
+	struct Request
+	{
+		Request(Path const& relPath, svn_revnum_t revision, std::string const& contentFile) :
+			m_relPath(relPath), m_revision(revision), m_contentFile(contentFile), m_state(Queued) { }
+
+		Path m_relPath;
+		svn_revnum_t m_revision;
+		// If set the contents are taken from (and then delete) this file
+		// rather than being fetched.
+		std::string m_contentFile;
+		FileContents m_contents;
+		// Raw git blob id (SHA-1) of the contents.  Hashed by the fetching
+		// thread so that it runs in parallel too.
+		std::string m_blobId;
+
+	private:
+		friend class FetchPool;
+
+		enum State { Queued, Fetching, Done };
+		State m_state;
+		std::string m_error;
+	};
+
+	FetchPool(SVNSimple& connection, std::string const& url, std::string const& username, std::string const& password, unsigned int numWorkers);
+	~FetchPool();
+
+	// Queue a request to be fetched.  The request must stay alive until it
+	// has been passed to Release().
+	void Queue(Request* request);
+	// Block until the request has been fetched.  Throws if the fetch failed.
+	void Wait(Request* request);
+	// Free the fetched contents, allowing another request to be fetched.
+	void Release(Request* request);
+	// Forget every queued request, deleting its content file, and wait for
+	// those being fetched to finish.
+	void Drain();
+
+	unsigned int GetNumWorkers() const { return m_workers.size(); }
+
+	// Fetched full texts are saved to store as bases for later deltas.
+	void SetBaseTextStore(BaseTextStore* store) { m_baseTexts = store; }
+	// Files are looked for in cache before being fetched, and saved to it
+	// after.
+	void SetBlobCache(BlobCache* cache) { m_blobCache = cache; }
+	// The workers record what they fetch; see SVNSimple::SetRecorder().
+	// Call before any requests are queued.
+	void SetRecorder(Recorder* recorder);
+
+protected:
+	class Worker : public Thread
+	{
+	public:
+		Worker(FetchPool& pool, std::string const& url, std::string const& username, std::string const& password);
+		~Worker();
+
+		void SetRecorder(Recorder* recorder) { m_connection.SetRecorder(recorder); }
+
+	protected:
+		void Run();
+
+		FetchPool& m_pool;
+		SVNSimple m_connection;
+		Stats* m_stats;
+	};
+
+	friend class Worker;
+
+	// Stops and deletes the workers.
+	void Stop();
+	Request* NextRequest();
+	void Fetch(SVNSimple& connection, Request* request);
+
+	SVNSimple& m_connection;
+	BaseTextStore* m_baseTexts;
+	BlobCache* m_blobCache;
+	std::vector<Worker*> m_workers;
+
+	Mutex m_mutex;
+	Condition m_queued;
+	Condition m_fetched;
+	std::deque<Request*> m_queue;
+	unsigned int m_fetching;
+	unsigned int m_buffered;
+	unsigned int m_maxBuffered;
+	bool m_stopping;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef FILECONTENTS_H__
+#define FILECONTENTS_H__
+
+#include "Output.h"
+
+#include <stdio.h>
+#include <string>
+#include <stddef.h>
+
+struct apr_pool_t;
+struct svn_stream_t;
+struct svn_checksum_ctx_t;
+
+/**
+ * The contents of one file, built up as they arrive.  Small files are held
+ * in memory; once the contents grow past the spool limit they are moved to
+ * a temporary file.  Either way the size is known before anything is
+ * written out, without asking the server for it.
+ *
+ * Contents own their memory, spool file or mapping, so can't be copied.
+ */
+class FileContents
+{
+public:
+	FileContents();
+	~FileContents();
+
+	// Where spooled contents go; $TMPDIR or /tmp by default.  Set before any
+	// contents are built.
+	static void SetSpoolDirectory(std::string const& directory);
+
+	void Append(char const* data, size_t length);
+	// A stream which appends to these contents.
+	svn_stream_t* Stream(apr_pool_t* pool);
+	// Take over a file which already holds the contents, as a spool file.
+	void Adopt(std::string const& fileName);
+	// Map a file which must not change and is not to be deleted.
+	void Map(std::string const& fileName);
+	// Refer to memory which outlives the contents, rather than copying it.
+	void Borrow(char const* data, size_t length);
+	// Frees the memory or deletes the spool file.
+	void Clear();
+
+	unsigned long long Size() const { return m_size; }
+
+	void UpdateChecksum(svn_checksum_ctx_t* ctx) const;
+	// The raw id git gives a blob with these contents.
+	std::string BlobId() const;
+	void WriteTo(Output::Transaction& out) const;
+	void WriteTo(FILE* file) const;
+	// Hard links the spool or mapped file if possible, otherwise copies.
+	void WriteToFile(std::string const& fileName) const;
+
+private:
+	FileContents(FileContents const&);
+	FileContents& operator=(FileContents const&);
+
+	void Spool();
+	void ReadAll(void (*consume)(void* baton, char const* data, size_t length), void* baton) const;
+
+	static std::string s_directory;
+
+	std::string m_data;
+	// The spool, adopted or mapped file.
+	std::string m_fileName;
+	int m_fd;
+	void* m_map;
+	char const* m_borrowed;
+	unsigned long long m_size;
+};
+
+#endif
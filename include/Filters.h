@@ -0,0 +1,25 @@
+#ifndef FILTERS_H__
+#define FILTERS_H__
+
+#include "SVNSimple.h"
+
+#include <map>
+#include <string>
+
+class IgnoreRules;
+
+// svn username => git "Name <email>".
+typedef std::map<std::string, std::string> UserMap;
+
+// The passes each revision goes through between being replayed and being
+// written out.
+
+// Marks the files matching an ignore rule with action 'I'.
+void FilterIgnoredFiles(SVNSimple::Revision& rev, IgnoreRules const& ignoreRules);
+// Adds "svn-source: repoName@revision" to the end of the log message.
+void AddSVNSourceTag(SVNSimple::Revision& rev, std::string const& repoName);
+// Replaces the svn username with its git committer from users, after
+// removing prefix; "user <user@localhost>" for those not in users.
+void RewriteCommitters(SVNSimple::Revision& rev, UserMap const& users, std::string const& prefix);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef HEX_H__
+#define HEX_H__
+
+#include <string>
+
+// Raw object ids (e.g. SHA-1s) to lower case hex and back.
+
+inline std::string ToHex(std::string const& raw)
+{
+	static char const digits[] = "0123456789abcdef";
+	std::string hex;
+	hex.reserve(raw.size() * 2);
+	for(std::string::const_iterator it = raw.begin(); it != raw.end(); ++it) {
+		unsigned char c = *it;
+		hex.push_back(digits[c >> 4]);
+		hex.push_back(digits[c & 0xf]);
+	}
+	return hex;
+}
+
+// Returns false unless hex is an even number of hex digits.
+inline bool FromHex(char const* hex, std::string& raw)
+{
+	raw.clear();
+	for(; hex[0] && hex[1]; hex += 2) {
+		int value = 0;
+		for(int i = 0; i < 2; ++i) {
+			char c = hex[i];
+			value <<= 4;
+			if(c >= '0' && c <= '9') {
+				value |= c - '0';
+			} else if(c >= 'a' && c <= 'f') {
+				value |= c - 'a' + 10;
+			} else {
+				return false;
+			}
+		}
+		raw.push_back(static_cast<char>(value));
+	}
+	return hex[0] == '\0';
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef IGNORERULES_H__
+#define IGNORERULES_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * The ignore-path patterns from the config.  Patterns are fnmatch'd against
+ * whole paths relative to the repo-url with no flags, so a '*' also matches
+ * '/'.
+ *
+ * Patterns are compiled as they are added, and found through a trie of
+ * their literal prefixes, or for those starting with a wildcard a trie of
+ * their reversed literal suffixes.  Only those whose literal part the path
+ * has are matched against it ("*suffix" patterns not even that), so the
+ * number of patterns hardly matters.
+ */
+class IgnoreRules
+{
+public:
+	IgnoreRules();
+
+	void Add(std::string const& pattern);
+	bool Empty() const { return m_patterns.empty(); }
+
+	// Returns the first pattern matching path, or NULL.
+	char const* Match(std::string const& path) const;
+
+	// Could any pattern match dir, or something under it, differently from
+	// the same relative path under another directory?  This is
+	// conservative: false means the subtree is definitely unaffected.
+	bool MayAffect(std::string const& dir) const;
+
+	// Is everything under dir matched, so that it needn't be listed or
+	// expanded at all?  This is conservative: it only looks for patterns
+	// ending in '*' matching dir and the '/' after it, and only at those
+	// whose literal prefix dir has.
+	bool IgnoresAllUnder(std::string const& dir) const;
+
+protected:
+	// One character of a path matched by a compiled pattern.
+	struct Element
+	{
+		// 'c' for m_char, '?' for any, '*' for any run and '[' for the
+		// bracket expression in m_bracket.
+		char m_kind;
+		char m_char;
+		std::string m_bracket;
+	};
+
+	struct Pattern
+	{
+		std::string m_pattern;
+		// Everything before the first wildcard.
+		std::string m_prefix;
+		// Of the form "*suffix" with no wildcards or '/' in the suffix, so
+		// it only depends on the end of the path.
+		bool m_suffixOnly;
+		// The whole pattern, the first m_prefix.size() of which are the
+		// prefix's characters.
+		std::vector<Element> m_elements;
+		// For patterns ending in '*', everything before it.
+		std::vector<Element> m_head;
+	};
+
+	struct TrieNode
+	{
+		std::map<char, size_t> m_children;
+		// The patterns whose string ends here, in the order they were added.
+		std::vector<size_t> m_patterns;
+	};
+
+	static void Compile(std::string const& pattern, std::vector<Element>& elements);
+	static bool Glob(std::vector<Element> const& elements, size_t first, char const* s, char const* end);
+	static void Insert(std::vector<TrieNode>& trie, std::string const& key, size_t pattern);
+
+	std::vector<Pattern> m_patterns;
+	// Literal prefixes, and reversed literal suffixes of the patterns with
+	// no prefix.  The root of each is the first node.
+	std::vector<TrieNode> m_prefixes;
+	std::vector<TrieNode> m_suffixes;
+	// Literal prefixes of the patterns ending in '*', for IgnoresAllUnder().
+	std::vector<TrieNode> m_heads;
+};
+
+#endif
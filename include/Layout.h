@@ -0,0 +1,38 @@
+#ifndef LAYOUT_H__
+#define LAYOUT_H__
+
+#include <string>
+
+/**
+ * Where trunk, branches and tags are, relative to the repo-url, so that a
+ * single replay of the whole project can be split up into a ref for each.
+ * Every directory directly under the branches and tags directories is a
+ * branch or tag.  Paths are identified by their root, e.g. "trunk" or
+ * "branches/foo".
+ */
+class Layout
+{
+public:
+	// Any of the paths may be empty if the project doesn't have one.
+	Layout(std::string const& trunk, std::string const& branches, std::string const& tags, std::string const& refPrefix);
+
+	// Splits relPath into the root of the branch or tag it is in, and the
+	// path within that.  Returns false for paths in none of them.
+	bool Split(std::string const& relPath, std::string& root, std::string& path) const;
+	bool IsRoot(std::string const& relPath) const;
+	bool IsTag(std::string const& root) const;
+
+	// Trunk and branches are refPrefix/trunk and refPrefix/name; tags are
+	// lightweight tags, refs/tags/name.
+	std::string Ref(std::string const& root) const;
+
+protected:
+	static bool SplitUnder(std::string const& dir, std::string const& relPath, std::string& root, std::string& path);
+
+	std::string m_trunk;
+	std::string m_branches;
+	std::string m_tags;
+	std::string m_refPrefix;
+};
+
+#endif
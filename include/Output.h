@@ -0,0 +1,122 @@
+#ifndef OUTPUT_H__
+#define OUTPUT_H__
+
+#include "Thread.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct svn_stream_t;
+struct apr_threadkey_t;
+
+/**
+ * A fast-import stream.  Writers append to large buffers which a writer
+ * thread drains with writev(), so replaying and fetching only wait for git
+ * once every buffer is full.
+ *
+ * Each thread writes to the stream given to the innermost Scope it is in;
+ * there is one per repository being exported.  Everything written to a
+ * stream must go through here.  Use a Transaction to keep a blob or commit
+ * in one piece; Output::Printf() only keeps a single call together.
+ */
+class Output : private Thread
+{
+public:
+	// Must be called once, before any other thread is started.
+	static void Init();
+
+	// Buffers of bufferSize bytes, at most maxBuffers of which may be
+	// waiting to be written.
+	static Output* Open(int fd, size_t bufferSize, unsigned int maxBuffers);
+	// Writes out everything buffered, stops the writer thread and frees
+	// output.  The fd is left open.
+	static void Close(Output* output);
+	// Like Close() but drops whatever has not been written yet, which may
+	// end part way through a command.
+	static void Abandon(Output* output);
+
+	// The calling thread's stream, or NULL.
+	static Output* Current();
+
+	// Makes output the calling thread's stream until it goes out of scope.
+	class Scope
+	{
+	public:
+		explicit Scope(Output* output);
+		~Scope();
+
+	private:
+		Scope(Scope const&);
+		Scope& operator=(Scope const&);
+
+		Output* m_previous;
+	};
+
+	static void Printf(char const* fmt, ...);
+	// Hands everything written so far to the writer thread, without waiting
+	// for it to be written, so that git sees it promptly.
+	static void Push();
+	// Waits until everything written so far has been written to the fd.
+	static void Flush();
+
+	class Transaction
+	{
+	public:
+		Transaction();
+		~Transaction();
+
+		void Printf(char const* fmt, ...);
+		void Write(char const* data, size_t length);
+		// A stream which writes into this transaction.  Only usable while
+		// the transaction is open.
+		svn_stream_t* Stream(apr_pool_t* pool);
+
+	private:
+		Transaction(Transaction const&);
+		Transaction& operator=(Transaction const&);
+
+		Output& m_output;
+	};
+
+private:
+	Output(int fd, size_t bufferSize, unsigned int maxBuffers);
+	~Output();
+
+	static Output& Get();
+	static void Stop(Output* output, bool discard);
+
+	void Run();
+	// The caller must hold m_writeLock for these.
+	void Append(char const* data, size_t length);
+	void VPrintf(char const* fmt, va_list args);
+	void QueueFill();
+	void FlushLocked();
+
+	static apr_pool_t* s_pool;
+	static apr_threadkey_t* s_current;
+
+	int m_fd;
+	size_t m_bufferSize;
+	unsigned int m_maxBuffers;
+
+	// Held by writers for as long as their output must stay together.
+	Mutex m_writeLock;
+	std::string m_fill;
+
+	// Protects everything below.
+	Mutex m_queueLock;
+	// Signalled when buffers are queued, or on stopping.
+	Condition m_queued;
+	// Signalled when buffers have been written.
+	Condition m_written;
+	std::deque<std::string> m_queue;
+	std::vector<std::string> m_spare;
+	bool m_writing;
+	bool m_stopping;
+	std::string m_error;
+};
+
+#endif
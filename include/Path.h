@@ -0,0 +1,56 @@
+#ifndef PATH_H__
+#define PATH_H__
+
+#include <string>
+#include <stddef.h>
+
+/**
+ * A path relative to the repo-url, interned in a process wide table so that
+ * it is the size of an int.  Each distinct component name is stored once,
+ * and a path only adds a (parent, name) pair to the table.  Interned paths
+ * live until the process exits, so the table grows with every repository
+ * the process exports, whether one after another or at once; Stats reports
+ * its size.  Paths are passed between every thread of an export, so a
+ * table per repository would have to be found through each of them.
+ *
+ * The default Path is the empty path, which is the repo-url itself.
+ * Everything may be called from any thread, but only after
+ * SVNSimple::Init().  Only interning a path not seen before takes a lock,
+ * so looking paths up and turning them back into strings doesn't serialise
+ * the threads doing it.
+ */
+class Path
+{
+public:
+	Path() : m_id(0) { }
+	// Empty components (leading, trailing or doubled '/') are dropped.
+	explicit Path(std::string const& relPath);
+	explicit Path(char const* relPath);
+
+	// relPath may have more than one component.
+	Path Child(std::string const& relPath) const;
+	Path Parent() const;
+	unsigned int Depth() const;
+
+	std::string str() const;
+	// The last component, or "" for the empty path.
+	std::string Name() const;
+	bool empty() const { return m_id == 0; }
+	size_t Hash() const { return m_id * 2654435761UL; }
+
+	bool operator==(Path const& other) const { return m_id == other.m_id; }
+	bool operator!=(Path const& other) const { return m_id != other.m_id; }
+	// Orders by when paths were first interned, not by name.
+	bool operator<(Path const& other) const { return m_id < other.m_id; }
+
+	// Distinct paths and bytes used by the table, for statistics.
+	static void TableSize(size_t& paths, size_t& bytes);
+
+private:
+	class Table;
+	static Table& GetTable();
+
+	unsigned int m_id;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef PLAYBACKSESSION_H__
+#define PLAYBACKSESSION_H__
+
+#include "Session.h"
+
+extern "C" {
+#include <apr_time.h>
+}
+
+class Recording;
+
+/**
+ * Answers requests from a recording made by RecordingSession, for
+ * recording:///path/to/file URLs, so that an export can be repeated without
+ * the repository it was recorded from.  Anything not recorded is an error.
+ *
+ * Each request, and opening the session, can be made to take a given time
+ * first, to stand in for a distant server.
+ */
+class PlaybackSession : public Session
+{
+public:
+	// Whether url can be opened as a PlaybackSession.
+	static bool Handles(std::string const& url);
+	// How long every request waits before being answered.  Call before any
+	// sessions are opened.
+	static void SetLatency(apr_interval_time_t latency) { s_latency = latency; }
+
+	PlaybackSession(std::string const& url, apr_pool_t* pool);
+	~PlaybackSession();
+
+	std::string GetSubtree() { return m_subtree; }
+	svn_revnum_t GetLatestRevision();
+	svn_node_kind_t CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool);
+	void GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool);
+	void GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool);
+	bool BorrowFile(char const* relPath, svn_revnum_t revision, char const** data, size_t* length);
+	void GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool);
+	void Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool);
+
+protected:
+	// Waits out the latency, then finds the answer recorded under key.
+	void Answer(std::string const& key, char const** data, size_t* length);
+
+	static apr_interval_time_t s_latency;
+
+	apr_pool_t* m_pool;
+	Recording* m_recording;
+	std::string m_subtree;
+};
+
+#endif
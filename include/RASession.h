@@ -0,0 +1,28 @@
+#ifndef RASESSION_H__
+#define RASESSION_H__
+
+#include "Session.h"
+
+/**
+ * A session over the RA layer, for any URL svn understands.
+ */
+class RASession : public Session
+{
+public:
+	// The session lives in pool, and uses callbacks and config.
+	RASession(std::string const& url, svn_ra_callbacks2_t* callbacks, apr_hash_t* config, apr_pool_t* pool);
+
+	std::string GetSubtree();
+	svn_revnum_t GetLatestRevision();
+	svn_node_kind_t CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool);
+	void GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool);
+	void GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool);
+	void GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool);
+	void Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool);
+
+protected:
+	apr_pool_t* m_pool;
+	svn_ra_session_t* m_session;
+};
+
+#endif
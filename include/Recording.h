@@ -0,0 +1,137 @@
+#ifndef RECORDING_H__
+#define RECORDING_H__
+
+#include "Thread.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <map>
+#include <set>
+#include <string>
+
+struct apr_array_header_t;
+class FileContents;
+
+/**
+ * A file of the answers a repository gave to the requests SVNSimple made
+ * of it, so that an export can be run again without the repository; see
+ * RecordingSession and PlaybackSession.
+ *
+ * Each answer is stored under a key describing the request, so they can be
+ * played back in any order, from any number of sessions at once.  The file
+ * is a header line and then records of "<key length> <value length>\n",
+ * the key, the value and a "\n".  Keys and values are built with Encoder.
+ * A key recorded again replaces the earlier answer.
+ */
+class Recording
+{
+public:
+	// Appends "<number> " or "<length>:<data>", or "-" for a NULL string.
+	class Encoder
+	{
+	public:
+		explicit Encoder(std::string& out) : m_out(out) { }
+
+		void Char(char c) { m_out.push_back(c); }
+		void Int(long value);
+		void String(char const* data, size_t length);
+		void String(std::string const& value) { String(value.data(), value.size()); }
+		void String(char const* value);
+
+	private:
+		std::string& m_out;
+	};
+
+	// Reads back what an Encoder wrote, throwing if it doesn't match.
+	class Decoder
+	{
+	public:
+		Decoder(char const* data, size_t length) : m_pos(data), m_end(data + length) { }
+
+		bool AtEnd() const { return m_pos == m_end; }
+		char Char();
+		long Int();
+		// NULL for a NULL string.
+		char const* String(size_t& length);
+		std::string String();
+
+	private:
+		char const* m_pos;
+		char const* m_end;
+	};
+
+	// The key a request is recorded under.  revision is -1 for none.
+	static std::string Key(char const* request, long revision, char const* path = NULL);
+	static std::string LogKey(apr_array_header_t const* paths, long from, long to);
+
+	// Must be called once, before any other thread is started.
+	static void Init();
+	static void Shutdown();
+
+	// Opens or shares the recording in fileName.  Every recording opened
+	// must be released.
+	static Recording* Open(std::string const& fileName);
+	static void Release(Recording* recording);
+
+	std::string const& GetFileName() const { return m_fileName; }
+	// Points data at the answer recorded under key, which lasts as long as
+	// the recording is open.  Returns false if there is none.
+	bool Find(std::string const& key, char const** data, size_t* length) const;
+	// Adds the key of every answer recorded to keys.
+	void Keys(std::set<std::string>& keys) const;
+	// How much of the file is whole records, leaving out any cut short.
+	size_t GetCompleteSize() const { return m_completeSize; }
+
+private:
+	explicit Recording(std::string const& fileName);
+	~Recording();
+	Recording(Recording const&);
+	Recording& operator=(Recording const&);
+
+	void Index();
+
+	static Mutex* s_lock;
+	static std::map<std::string, Recording*> s_open;
+
+	std::string m_fileName;
+	unsigned int m_refs;
+	void* m_map;
+	size_t m_mapSize;
+	size_t m_completeSize;
+
+	typedef std::map<std::string, std::pair<char const*, size_t> > Answers;
+	Answers m_answers;
+};
+
+/**
+ * Writes a Recording, for any number of sessions on any threads.  Records
+ * are appended, so recording a later run of the same export adds to it;
+ * answers already in the file count as written, and a record left cut
+ * short is dropped first.
+ */
+class Recorder
+{
+public:
+	explicit Recorder(std::string const& fileName);
+	~Recorder();
+
+	// Records an answer.  Answers which can't change are only written the
+	// first time; replace writes value whether or not key has been before.
+	void Write(std::string const& key, char const* value, size_t length, bool replace = false);
+	void Write(std::string const& key, std::string const& value, bool replace = false) { Write(key, value.data(), value.size(), replace); }
+	void Write(std::string const& key, FileContents const& value);
+	// Whether key has already been written, so needn't be again.
+	bool Written(std::string const& key);
+
+private:
+	Recorder(Recorder const&);
+	Recorder& operator=(Recorder const&);
+
+	std::string m_fileName;
+	FILE* m_file;
+
+	Mutex m_mutex;
+	std::set<std::string> m_written;
+};
+
+#endif
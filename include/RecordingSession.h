@@ -0,0 +1,36 @@
+#ifndef RECORDINGSESSION_H__
+#define RECORDINGSESSION_H__
+
+#include "Session.h"
+
+class Recorder;
+
+/**
+ * Passes every request on to another session, and records its answers so
+ * that a PlaybackSession can give them again.  Replays are recorded one
+ * revision at a time as each is finished, as everything the editor was
+ * driven with.
+ */
+class RecordingSession : public Session
+{
+public:
+	// Takes ownership of session.
+	RecordingSession(Session* session, Recorder* recorder);
+	~RecordingSession();
+
+	std::string GetSubtree() { return m_subtree; }
+	svn_revnum_t GetLatestRevision();
+	svn_node_kind_t CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool);
+	void GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool);
+	void GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool);
+	bool BorrowFile(char const* relPath, svn_revnum_t revision, char const** data, size_t* length);
+	void GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool);
+	void Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool);
+
+protected:
+	Session* m_session;
+	Recorder* m_recorder;
+	std::string m_subtree;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef REPOTREE_H__
+#define REPOTREE_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+extern "C" {
+#include <svn_types.h>
+}
+
+/**
+ * A model of the exported subtree as of the last revision applied to it, so
+ * that directory expansion and copy checks don't need to list the
+ * repository over the network.
+ *
+ * Directories whose contents are not yet known (the tree as it was before
+ * the first revision replayed, and copies of things the model can't
+ * reproduce) are listed through the Lister the first time they are needed,
+ * at the path and revision they are known to match.  Copies of unchanged
+ * subtrees share nodes with their source, which are copied on write.
+ *
+ * Every node remembers the revision it was created in and the last revision
+ * anything at or below it changed in.
+ */
+class RepoTree
+{
+public:
+	class Lister
+	{
+	public:
+		virtual ~Lister() { }
+		// Add the immediate children of relPath at revision to entries, with
+		// true for directories.  A missing path has no children.
+		virtual void List(std::string const& relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries) = 0;
+		// Whether none of the files under the directory relPath are wanted
+		// from ListFiles(), so it needn't be listed.
+		virtual bool Prune(std::string const& relPath) { return false; }
+	};
+
+	// An invalid baseRevision starts with an empty tree.
+	RepoTree(Lister& lister, svn_revnum_t baseRevision);
+	~RepoTree();
+
+	// Called before applying each revision's changes.  Copies made while
+	// applying them take their source from the tree as it was at this point.
+	void StartRevision();
+
+	void AddFile(std::string const& relPath, svn_revnum_t revision);
+	void AddDirectory(std::string const& relPath, svn_revnum_t revision);
+	void Modify(std::string const& relPath, svn_revnum_t revision);
+	void Delete(std::string const& relPath, svn_revnum_t revision);
+	// Copy fromPath as it was at fromRevision.  An empty fromPath means the
+	// source is outside the tree.
+	void Copy(std::string const& fromPath, svn_revnum_t fromRevision, std::string const& relPath, bool isDirectory, svn_revnum_t revision);
+	// Forget what is known about the directory relPath and list it again as
+	// it was at revision, for changes whose node kind isn't known.
+	void Reload(std::string const& relPath, svn_revnum_t revision);
+
+	// Is relPath missing, or has it (or anything under or above it) changed
+	// after revision?
+	bool ChangedSince(std::string const& relPath, svn_revnum_t revision);
+	// Is there at least one file at or under relPath?
+	bool HasFiles(std::string const& relPath);
+	// Every file under the directory relPath, relative to it, but for those
+	// in directories the lister prunes.
+	void ListFiles(std::string const& relPath, std::vector<std::string>& files);
+
+protected:
+	struct Node
+	{
+		Node(bool isDirectory, svn_revnum_t revision) :
+			m_refs(1), m_isDirectory(isDirectory), m_loaded(true),
+			m_created(revision), m_changed(revision), m_loadRevision(SVN_INVALID_REVNUM) { }
+
+		typedef std::map<std::string, Node*> Children;
+
+		unsigned int m_refs;
+		bool m_isDirectory;
+		bool m_loaded;
+		svn_revnum_t m_created;
+		svn_revnum_t m_changed;
+		// Where to list an unloaded directory from.
+		std::string m_loadPath;
+		svn_revnum_t m_loadRevision;
+		Children m_children;
+	};
+
+	static Node* Unloaded(std::string const& path, svn_revnum_t loadRevision, svn_revnum_t revision);
+	static void Release(Node* node);
+	static void Unshare(Node*& node);
+	void Load(Node* node);
+	Node* Find(Node* root, std::string const& relPath, bool checkCreated, svn_revnum_t revision);
+	Node* MutableParent(std::string const& relPath, svn_revnum_t revision, std::string& name);
+	void Insert(std::string const& relPath, svn_revnum_t revision, Node* node);
+	void ListFiles(Node* node, std::string const& relPath, std::string const& prefix, std::vector<std::string>& files);
+
+	Lister& m_lister;
+	Node* m_root;
+	// The tree as of the last StartRevision(), or NULL.
+	Node* m_previous;
+};
+
+#endif
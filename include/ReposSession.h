@@ -0,0 +1,40 @@
+#ifndef REPOSSESSION_H__
+#define REPOSSESSION_H__
+
+#include "Session.h"
+
+struct svn_repos_t;
+struct svn_fs_t;
+
+/**
+ * A session reading a repository on local disk through svn_repos and
+ * svn_fs, for file:// URLs.  This skips the RA layer's per request
+ * overhead, which dominates when fetching many small files.
+ */
+class ReposSession : public Session
+{
+public:
+	// Whether url can be opened as a ReposSession.
+	static bool Handles(std::string const& url);
+
+	ReposSession(std::string const& url, apr_pool_t* pool);
+
+	std::string GetSubtree() { return m_subtree; }
+	svn_revnum_t GetLatestRevision();
+	svn_node_kind_t CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool);
+	void GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool);
+	void GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool);
+	void GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool);
+	void Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool);
+
+protected:
+	// relPath as a path in the filesystem, which starts with a '/'.
+	std::string FsPath(char const* relPath) const;
+
+	apr_pool_t* m_pool;
+	svn_repos_t* m_repos;
+	svn_fs_t* m_fs;
+	std::string m_subtree;
+};
+
+#endif
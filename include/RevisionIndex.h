@@ -0,0 +1,64 @@
+#ifndef REVISIONINDEX_H__
+#define REVISIONINDEX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <svn_types.h>
+}
+
+/**
+ * The fast-import mark of each commit made from a revision, kept on disk as
+ * fixed size records in revision order.  Marks are handed out in order, so
+ * they are in order too.  The file is memory mapped and
+ * searched in place, so opening the index of a long history costs nothing
+ * until it is used; new commits are appended to it as they are written.
+ *
+ * Marks only mean something alongside the marks file fast-import exports,
+ * which maps them to commit ids.
+ */
+class RevisionIndex
+{
+public:
+	struct Entry
+	{
+		uint32_t m_revision;
+		uint32_t m_mark;
+	};
+
+	explicit RevisionIndex(std::string const& fileName);
+	~RevisionIndex();
+
+	size_t Size() const { return m_mappedCount + m_appended.size(); }
+	Entry const& operator[](size_t i) const;
+
+	// The last commit made from revision or one before it, or NULL if there
+	// is none.
+	Entry const* Find(svn_revnum_t revision) const;
+	// Is mark one of the commits?
+	bool HasMark(unsigned long mark) const;
+
+	// Revisions must be appended in order, marks in increasing order.
+	void Append(svn_revnum_t revision, unsigned long mark);
+	// Drop everything after the first count entries.
+	void Truncate(size_t count);
+	// Waits until the appended entries are on disk.
+	void Sync();
+
+private:
+	RevisionIndex(RevisionIndex const&);
+	RevisionIndex& operator=(RevisionIndex const&);
+
+	std::string m_fileName;
+	int m_fd;
+	void* m_map;
+	size_t m_mapSize;
+	Entry const* m_mapped;
+	size_t m_mappedCount;
+	std::vector<Entry> m_appended;
+};
+
+#endif
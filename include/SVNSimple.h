@@ -4,29 +4,51 @@
 #include <vector>
 #include <string>
 
+#include "ChangeSet.h"
+#include "Path.h"
+#include "RepoTree.h"
+
 extern "C" {
 #include <time.h>
 #include <svn_types.h>
 }
 
 struct svn_error_t;
-struct svn_ra_session_t;
 struct svn_ra_callbacks2_t;
 struct svn_log_entry_t;
 struct apr_pool_t;
+struct apr_hash_t;
+
+class BaseTextStore;
+class FileContents;
+class IgnoreRules;
+class Layout;
+class Recorder;
+class Session;
 
-class SVNSimple
+class SVNSimple : private RepoTree::Lister
 {
 public:
 	struct Revision
 	{
 		struct File
 		{
-			File() : m_action('X'), m_type('U'), m_expand(false) { }
+			File() : m_action('X'), m_type('U'), m_expand(false), m_copyTree(false), m_copyBranch(false), m_copyFromRev(SVN_INVALID_REVNUM) { }
 			char m_action;
 			char m_type;
 			bool m_expand;
-			std::string m_relPath;
+			// A directory copy which git can copy from its own tree, in
+			// place of expanding it.
+			bool m_copyTree;
+			// A branch or tag copied whole from another, which git can start
+			// from the source's commit.
+			bool m_copyBranch;
+			Path m_relPath;
+			// The copy source, if it is within the subtree.
+			Path m_copyFromPath;
+			svn_revnum_t m_copyFromRev;
+			// Full text spooled to disk during the replay, if there is one.
+			std::string m_contentFile;
 		};
 
 		svn_revnum_t m_revision;
@@ -34,34 +56,124 @@ public:
 		std::string m_log;
 		time_t m_date;
 
-		std::vector<File> m_files;
+		typedef ChangeSet<File> Files;
+		Files m_files;
+
+		// With a layout, the roots of the branches and tags changed which
+		// had no files before this revision.
+		std::vector<std::string> m_newBranches;
+
+		// Revisions hold a lot of files; move them around with swap rather
+		// than copying them.
+		void swap(Revision& other)
+		{
+			std::swap(m_revision, other.m_revision);
+			m_user.swap(other.m_user);
+			m_log.swap(other.m_log);
+			std::swap(m_date, other.m_date);
+			m_files.swap(other.m_files);
+			m_newBranches.swap(other.m_newBranches);
+		}
+
+		friend void swap(Revision& a, Revision& b) { a.swap(b); }
+	};
+
+	// Receives revisions one at a time, in order, as they are replayed.
+	class RevisionSink
+	{
+	public:
+		virtual ~RevisionSink() { }
+		// rev may be swapped out.  Exceptions abort the replay.
+		virtual void Consume(Revision& rev) = 0;
 	};
 
 	static void Init();
 	static void Shutdown();
+	// Limits how many file and directory requests are made at once, over
+	// every session; 0 for no limit.  Replays and logs stream for as long
+	// as they are consumed, so they are not counted.  Call before any
+	// sessions are in use.
+	static void SetRequestLimit(unsigned int limit);
 
 	SVNSimple(std::string url, std::string username, std::string password);
 	~SVNSimple();
 
+	// Replay text deltas against the base texts in store; the resulting full
+	// texts are left in Revision::File::m_contentFile.
+	void SetBaseTextStore(BaseTextStore* store) { m_baseTexts = store; }
+
+	// Directory copies whose source could be affected by these rules are
+	// always expanded.
+	void SetIgnoreRules(IgnoreRules const* rules) { m_ignoreRules = rules; }
+
+	// Whether the first commit has a parent holding the subtree as of the
+	// revision before the first one replayed.  Without one git starts out
+	// empty, so directory copies are always expanded unless the history
+	// starts at revision 0.
+	void SetParented(bool parented) { m_parented = parented; }
+
+	// Branches and tags copied whole from another are not expanded, and
+	// tree copies don't cross between them.
+	void SetLayout(Layout const* layout) { m_layout = layout; }
+
+	// Records every answer the repository gives from now on; see
+	// RecordingSession.  May only be called once.
+	void SetRecorder(Recorder* recorder);
+	Recorder* GetRecorder() const { return m_recorder; }
+
 	svn_revnum_t GetLatestRevision();
+	// Hands each revision with changes in the subtree to sink as soon as it
+	// has been replayed.
+	void Replay(RevisionSink& sink, svn_revnum_t from, svn_revnum_t to, bool expandDirectories = true);
 	void Replay(std::vector<Revision>& log, svn_revnum_t from, svn_revnum_t to, bool expandDirectories = true);
 	void GetLog(std::vector<Revision>& log, svn_revnum_t from, svn_revnum_t to, bool expandDirectories = true);
 
 	void CatFile(std::string const& relPath, svn_revnum_t revision);
 	void CatFile(char const* relPath, svn_revnum_t revision);
+	// Fetch the contents of a file rather than writing it out, in a single
+	// request.
+	void GetFile(char const* relPath, svn_revnum_t revision, FileContents& contents);
+
+	// Expands the directories added or copied in rev into the files under
+	// them.  Revisions must be expanded in order, with none skipped.
+	void ExpandRevision(Revision& rev);
 
 protected:
 	static svn_error_t* RevisionThunk(void* batonv, svn_log_entry_t* entry, apr_pool_t* basePool);
 	void ProcessRevision(Revision& rev, svn_log_entry_t* entry, apr_pool_t* basePool);
+	void StartHistory(svn_revnum_t from);
+	bool GitHasHistory() const;
+	virtual void List(std::string const& relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries);
+	virtual bool Prune(std::string const& relPath);
+	Session* OpenSession();
 	void ExpandDirectories(std::vector<Revision>& log);
-	void ExpandDirectory(Revision const& rev, Revision::File& file, std::vector<Revision::File>& extras);
-	void AddDirectoryFile(Revision const& rev, Revision::File& file, std::vector<Revision::File>& extras, char const* name);
+	void ApplyToTree(Revision const& rev);
+	void ExpandDirectory(Revision const& rev, Revision::File& file, Revision::Files& extras);
+	void AddDirectoryFile(Revision const& rev, Revision::File& file, Revision::Files& extras, std::string const& name);
+	bool CanCopyTree(Revision::File const& dir);
+	bool CanCopyBranch(Revision::File const& dir);
+	void FindNewBranches(Revision& rev);
 
 	apr_pool_t* m_pool;
+	// Only for RA sessions.
 	svn_ra_callbacks2_t* m_callbacks;
-	svn_ra_session_t* m_session;
+	Session* m_session;
+	// For listing directories while m_session is busy replaying.
+	Session* m_listSession;
+	Recorder* m_recorder;
+	std::string m_url;
+	apr_hash_t* m_config;
+	BaseTextStore* m_baseTexts;
+	IgnoreRules const* m_ignoreRules;
+	Layout const* m_layout;
+	bool m_parented;
 
 	std::string m_subtree;
+
+	// The first revision fetched.
+	svn_revnum_t m_historyStart;
+	// The subtree as of the last revision expanded.
+	RepoTree* m_tree;
 };
 
 #endif
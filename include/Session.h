@@ -0,0 +1,47 @@
+#ifndef SESSION_H__
+#define SESSION_H__
+
+#include <string>
+#include <vector>
+#include <utility>
+
+extern "C" {
+#include <svn_types.h>
+#include <svn_ra.h>
+}
+
+/**
+ * The requests SVNSimple makes of a repository, so that it can be read
+ * over the RA layer or straight from a repository on local disk.  Paths are
+ * relative to the URL the session was opened at, as they are for an RA
+ * session, and errors are thrown.
+ */
+class Session
+{
+public:
+	virtual ~Session() { }
+
+	// Where the session's URL is below the repository root: empty, or
+	// starting with a '/'.
+	virtual std::string GetSubtree() = 0;
+
+	virtual svn_revnum_t GetLatestRevision() = 0;
+	virtual svn_node_kind_t CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool) = 0;
+	// Adds the immediate children of the directory relPath to entries, with
+	// true for directories.
+	virtual void GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool) = 0;
+	// Writes the contents of a file to stream, without closing it.
+	virtual void GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool) = 0;
+	// Where the session already holds the contents of a file in memory,
+	// which lasts as long as it does, points data at them rather than
+	// copying them.  Returns false otherwise.
+	virtual bool BorrowFile(char const* relPath, svn_revnum_t revision, char const** data, size_t* length) { return false; }
+
+	// Logs with changed paths, as svn_ra_get_log2().
+	virtual void GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool) = 0;
+	// As svn_ra_replay_range(), with no low water mark.  Editors are driven
+	// with paths relative to the repository root.
+	virtual void Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool) = 0;
+};
+
+#endif
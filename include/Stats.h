@@ -0,0 +1,148 @@
+#ifndef STATS_H__
+#define STATS_H__
+
+#include "Thread.h"
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <apr_time.h>
+#include <svn_types.h>
+}
+
+struct apr_threadkey_t;
+
+// Histogram buckets are powers of two microseconds, the last holding
+// everything from 2^(STATS_BUCKETS - 2)us (about four and a half minutes) up.
+#define STATS_BUCKETS (30)
+
+/**
+ * Counters and latency histograms for one repository's export, so that a
+ * slow export shows where its time goes.  Reported as progress lines in
+ * the fast-import stream, and as a JSON file at the end.
+ *
+ * Like Output, each thread records into the Stats given to the innermost
+ * Scope it is in; with none, nothing is recorded.
+ */
+class Stats
+{
+public:
+	enum Phase
+	{
+		// Replaying a window, less listing and waiting for the exporter.
+		Phase_Replay,
+		// Listing a directory to expand a copy.
+		Phase_List,
+		// Fetching a file's contents.
+		Phase_Fetch,
+		// Waiting for git to read the fast-import stream.
+		Phase_Write,
+
+		Phase_NUM
+	};
+
+	enum Counter
+	{
+		Counter_Revisions,
+		Counter_Changes,
+		Counter_Blobs,
+		Counter_BlobBytes,
+		Counter_FetchedBytes,
+		// Text deltas replayed with no base to apply them to, whose full
+		// texts are then fetched as well.
+		Counter_DroppedDeltas,
+
+		Counter_NUM
+	};
+
+	// Must be called once, before any other thread is started.
+	static void Init();
+
+	// The calling thread's stats, or NULL.
+	static Stats* Current();
+
+	// Makes stats the calling thread's until it goes out of scope.
+	class Scope
+	{
+	public:
+		explicit Scope(Stats* stats);
+		~Scope();
+
+	private:
+		Scope(Scope const&);
+		Scope& operator=(Scope const&);
+
+		Stats* m_previous;
+	};
+
+	// Records the time from construction to destruction against phase.
+	class Timer
+	{
+	public:
+		explicit Timer(Phase phase);
+		~Timer();
+
+	private:
+		Timer(Timer const&);
+		Timer& operator=(Timer const&);
+
+		Stats* m_stats;
+		Phase m_phase;
+		apr_time_t m_start;
+	};
+
+	// Adds to the calling thread's counter, if it has stats.
+	static void Count(Counter counter, unsigned long long amount = 1);
+
+	Stats();
+
+	void Record(Phase phase, apr_time_t elapsed);
+	void Add(Counter counter, unsigned long long amount);
+	// Total time recorded against phase so far.
+	apr_time_t GetTotal(Phase phase);
+	// Notes a finished replay window and the process's peak RSS after it.
+	void EndWindow(svn_revnum_t first, svn_revnum_t last, unsigned long changes, apr_time_t elapsed);
+
+	// Writes a progress line with the rates and phase times so far.
+	void PrintProgress();
+	// Replaces fileName with everything recorded, and where it came from.
+	// error is empty if the export succeeded.
+	void Save(std::string const& fileName, std::string const& name, std::string const& url, std::string const& error);
+
+private:
+	struct Histogram
+	{
+		unsigned long m_count;
+		apr_time_t m_total;
+		apr_time_t m_max;
+		unsigned long m_buckets[STATS_BUCKETS];
+	};
+
+	struct Window
+	{
+		svn_revnum_t m_first;
+		svn_revnum_t m_last;
+		unsigned long m_changes;
+		apr_time_t m_elapsed;
+		long m_peakRSS;
+	};
+
+	Stats(Stats const&);
+	Stats& operator=(Stats const&);
+
+	// The caller must hold m_mutex.
+	apr_time_t Percentile(Histogram const& histogram, double fraction) const;
+
+	static apr_pool_t* s_pool;
+	static apr_threadkey_t* s_current;
+
+	apr_time_t m_start;
+
+	Mutex m_mutex;
+	Histogram m_phases[Phase_NUM];
+	unsigned long long m_counters[Counter_NUM];
+	std::vector<Window> m_windows;
+};
+
+#endif
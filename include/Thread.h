@@ -0,0 +1,107 @@
+#ifndef THREAD_H__
+#define THREAD_H__
+
+/**
+ * Thin wrappers around the APR threading primitives.  Every object owns its
+ * own root pool so that they can be created and destroyed from any thread.
+ */
+
+struct apr_pool_t;
+struct apr_thread_t;
+struct apr_thread_mutex_t;
+struct apr_thread_cond_t;
+
+class Mutex
+{
+public:
+	Mutex();
+	~Mutex();
+
+	void Lock();
+	void Unlock();
+
+private:
+	Mutex(Mutex const&);
+	Mutex& operator=(Mutex const&);
+
+	friend class Condition;
+
+	apr_pool_t* m_pool;
+	apr_thread_mutex_t* m_mutex;
+};
+
+class ScopedLock
+{
+public:
+	ScopedLock(Mutex& mutex) : m_mutex(mutex) { m_mutex.Lock(); }
+	~ScopedLock() { m_mutex.Unlock(); }
+
+private:
+	ScopedLock(ScopedLock const&);
+	ScopedLock& operator=(ScopedLock const&);
+
+	Mutex& m_mutex;
+};
+
+class Condition
+{
+public:
+	Condition(Mutex& mutex);
+	~Condition();
+
+	// The associated mutex must be held by the caller.
+	void Wait();
+	void Signal();
+	void Broadcast();
+
+private:
+	Condition(Condition const&);
+	Condition& operator=(Condition const&);
+
+	Mutex& m_mutex;
+	apr_pool_t* m_pool;
+	apr_thread_cond_t* m_cond;
+};
+
+class Semaphore
+{
+public:
+	Semaphore(unsigned int count);
+	~Semaphore();
+
+	// Waits until the count is above zero, then takes one from it.
+	void Acquire();
+	void Release();
+
+private:
+	Semaphore(Semaphore const&);
+	Semaphore& operator=(Semaphore const&);
+
+	Mutex m_mutex;
+	Condition m_available;
+	unsigned int m_count;
+};
+
+class Thread
+{
+public:
+	Thread();
+	virtual ~Thread();
+
+	void Start();
+	void Join();
+
+protected:
+	virtual void Run() = 0;
+
+private:
+	Thread(Thread const&);
+	Thread& operator=(Thread const&);
+
+	static void* Thunk(apr_thread_t* thread, void* data);
+
+	apr_pool_t* m_pool;
+	apr_thread_t* m_thread;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef TRACE_H__
+#define TRACE_H__
+
+#include "Path.h"
+
+#include <stdio.h>
+#include <string>
+
+extern "C" {
+#include <apr_time.h>
+}
+
+struct apr_threadkey_t;
+class Mutex;
+
+/**
+ * A timeline of the export in Chrome's trace event format, which can be
+ * opened in chrome://tracing or Perfetto to see where it stalls.  Each Span
+ * is written as a complete event when it ends, on the thread it ran on.
+ *
+ * Tracing is off unless Open() is called.  A Span then costs a test of a
+ * static pointer, and its arguments aren't formatted.
+ */
+class Trace
+{
+public:
+	// Must be called once, before any other thread is started.
+	static void Init();
+	// Starts tracing to fileName.  Call before any other thread is started.
+	static void Open(std::string const& fileName);
+	// Finishes the file off.  Spans still open are not written.
+	static void Close();
+
+	static bool Enabled() { return s_file != NULL; }
+	// Labels the calling thread's row.
+	static void NameThread(std::string const& name);
+
+	class Span
+	{
+	public:
+		// name must outlive the span.
+		explicit Span(char const* name) : m_name(name), m_start(s_file? apr_time_now() : 0) { }
+		~Span() { if(m_start) End(); }
+
+		void Arg(char const* key, long value) { if(m_start) AddArg(key, value); }
+		void Arg(char const* key, char const* value) { if(m_start) AddArg(key, value); }
+		void Arg(char const* key, std::string const& value) { if(m_start) AddArg(key, value.c_str()); }
+		void Arg(char const* key, Path const& value) { if(m_start) AddArg(key, value.str().c_str()); }
+
+	private:
+		Span(Span const&);
+		Span& operator=(Span const&);
+
+		void AddArg(char const* key, long value);
+		void AddArg(char const* key, char const* value);
+		void End();
+
+		char const* m_name;
+		apr_time_t m_start;
+		// Formatted JSON members.
+		std::string m_args;
+	};
+
+private:
+	// The caller must hold s_lock.
+	static unsigned long ThreadId();
+	static void WriteEvent(std::string const& event);
+
+	static FILE* s_file;
+	static Mutex* s_lock;
+	static apr_pool_t* s_pool;
+	static apr_threadkey_t* s_threadId;
+	static unsigned long s_nextThreadId;
+	static apr_time_t s_start;
+	static bool s_first;
+};
+
+#endif
@@ -0,0 +1,365 @@
+#include "BaseTextStore.h"
+#include "FileContents.h"
+#include "Exception.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+extern "C" {
+#include <svn_pools.h>
+#include <svn_io.h>
+#include <svn_checksum.h>
+}
+
+static void MakeDirectory(std::string const& path)
+{
+	if(mkdir(path.c_str(), 0777) && errno != EEXIST) {
+		throw EXCEPTION(("Could not create directory %s: %s", path.c_str(), strerror(errno)));
+	}
+}
+
+static void RemoveFiles(std::string const& directory)
+{
+	DIR* dir = opendir(directory.c_str());
+	if(dir == NULL) {
+		return;
+	}
+
+	struct dirent* ent;
+	while((ent = readdir(dir))) {
+		if(ent->d_name[0] != '.') {
+			unlink((directory + "/" + ent->d_name).c_str());
+		}
+	}
+	closedir(dir);
+}
+
+static std::string Checksum(svn_checksum_kind_t kind, char const* data, size_t len)
+{
+	apr_pool_t* pool = svn_pool_create(NULL);
+	svn_checksum_t* checksum;
+	svn_error_t* err;
+	if((err = svn_checksum(&checksum, kind, data, len, pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	std::string result(svn_checksum_to_cstring(checksum, pool));
+	svn_pool_destroy(pool);
+	return result;
+}
+
+BaseTextStore::BaseTextStore(std::string const& directory, unsigned long long sizeLimit) :
+	m_directory(directory),
+	m_sizeLimit(sizeLimit),
+	m_size(0),
+	m_nextSpool(0)
+{
+	MakeDirectory(m_directory);
+	MakeDirectory(m_directory + "/base");
+	MakeDirectory(m_directory + "/spool");
+
+	// Anything left in the spool belongs to a run which did not finish.
+	RemoveFiles(m_directory + "/spool");
+
+	ReadIndex();
+	RemoveStrays();
+	Evict();
+}
+
+BaseTextStore::~BaseTextStore()
+{
+	WriteIndex();
+}
+
+std::string BaseTextStore::BaseFile(std::string const& path, std::string const& md5) const
+{
+	return m_directory + "/base/" + Checksum(svn_checksum_sha1, path.data(), path.size()) + "-" + md5;
+}
+
+void BaseTextStore::Touch(Entry& entry)
+{
+	m_lru.splice(m_lru.end(), m_lru, entry.m_lru);
+}
+
+bool BaseTextStore::Empty()
+{
+	ScopedLock lock(m_mutex);
+	return m_entries.empty();
+}
+
+bool BaseTextStore::OpenBase(std::string const& path, char const* md5, svn_stream_t** stream, apr_pool_t* pool)
+{
+	ScopedLock lock(m_mutex);
+
+	Entries::iterator it = m_entries.find(path);
+	if(it == m_entries.end() || it->second.m_md5 != md5) {
+		return false;
+	}
+
+	svn_error_t* err;
+	if((err = svn_stream_open_readonly(stream, BaseFile(path, it->second.m_md5).c_str(), pool, pool))) {
+		svn_error_clear(err);
+		return false;
+	}
+
+	Touch(it->second);
+	return true;
+}
+
+bool BaseTextStore::LinkBase(std::string const& path, char const* md5, std::string& spoolFile)
+{
+	ScopedLock lock(m_mutex);
+
+	Entries::iterator it = m_entries.find(path);
+	if(it == m_entries.end() || it->second.m_md5 != md5) {
+		return false;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "/spool/%lu", m_nextSpool++);
+	spoolFile = m_directory + name;
+
+	if(link(BaseFile(path, it->second.m_md5).c_str(), spoolFile.c_str())) {
+		return false;
+	}
+
+	struct stat st;
+	if(stat(spoolFile.c_str(), &st) || static_cast<unsigned long long>(st.st_size) != it->second.m_size) {
+		unlink(spoolFile.c_str());
+		return false;
+	}
+
+	Touch(it->second);
+	return true;
+}
+
+void BaseTextStore::CreateSpool(std::string& spoolFile, svn_stream_t** stream, apr_pool_t* pool)
+{
+	{
+		ScopedLock lock(m_mutex);
+		char name[32];
+		snprintf(name, sizeof(name), "/spool/%lu", m_nextSpool++);
+		spoolFile = m_directory + name;
+	}
+
+	svn_error_t* err;
+	if((err = svn_stream_open_writable(stream, spoolFile.c_str(), pool, pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+}
+
+void BaseTextStore::Insert(std::string const& path, svn_revnum_t revision, std::string const& file, char const* md5)
+{
+	Entries::iterator it = m_entries.find(path);
+	if(it != m_entries.end() && it->second.m_revision > revision) {
+		// A fetch finishing late must not replace a newer base.
+		return;
+	}
+
+	struct stat st;
+	if(stat(file.c_str(), &st)) {
+		throw EXCEPTION(("Could not stat %s: %s", file.c_str(), strerror(errno)));
+	}
+
+	std::string base(BaseFile(path, md5));
+	std::string temp(base + ".tmp");
+	unlink(temp.c_str());
+	if(link(file.c_str(), temp.c_str()) || rename(temp.c_str(), base.c_str())) {
+		throw EXCEPTION(("Could not store base text %s: %s", base.c_str(), strerror(errno)));
+	}
+
+	if(it == m_entries.end()) {
+		it = m_entries.insert(Entries::value_type(path, Entry())).first;
+		it->second.m_lru = m_lru.insert(m_lru.end(), path);
+	} else {
+		if(it->second.m_md5 != md5) {
+			unlink(BaseFile(path, it->second.m_md5).c_str());
+		}
+		m_size -= it->second.m_size;
+		Touch(it->second);
+	}
+
+	it->second.m_md5 = md5;
+	it->second.m_size = st.st_size;
+	it->second.m_revision = revision;
+	m_size += st.st_size;
+
+	Evict();
+}
+
+void BaseTextStore::Save(std::string const& path, svn_revnum_t revision, std::string const& spoolFile, char const* md5)
+{
+	ScopedLock lock(m_mutex);
+	Insert(path, revision, spoolFile, md5);
+}
+
+void BaseTextStore::Save(std::string const& path, svn_revnum_t revision, FileContents const& contents)
+{
+	if(contents.Size() > m_sizeLimit) {
+		return;
+	}
+
+	apr_pool_t* pool = svn_pool_create(NULL);
+	svn_checksum_ctx_t* ctx = svn_checksum_ctx_create(svn_checksum_md5, pool);
+	svn_checksum_t* checksum;
+	svn_error_t* err;
+	contents.UpdateChecksum(ctx);
+	if((err = svn_checksum_final(&checksum, ctx, pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	std::string md5(svn_checksum_to_cstring(checksum, pool));
+	svn_pool_destroy(pool);
+
+	std::string spoolFile;
+	{
+		ScopedLock lock(m_mutex);
+		char name[32];
+		snprintf(name, sizeof(name), "/spool/%lu", m_nextSpool++);
+		spoolFile = m_directory + name;
+	}
+
+	// Contents spooled in SpoolDirectory() are linked rather than copied.
+	contents.WriteToFile(spoolFile);
+	try {
+		ScopedLock lock(m_mutex);
+		Insert(path, revision, spoolFile, md5.c_str());
+	} catch(...) {
+		unlink(spoolFile.c_str());
+		throw;
+	}
+	unlink(spoolFile.c_str());
+}
+
+void BaseTextStore::Evict()
+{
+	while(m_size > m_sizeLimit && !m_lru.empty()) {
+		Entries::iterator it = m_entries.find(m_lru.front());
+		unlink(BaseFile(it->first, it->second.m_md5).c_str());
+		m_size -= it->second.m_size;
+		m_entries.erase(it);
+		m_lru.pop_front();
+	}
+}
+
+// Index lines end at a newline, which paths may have in them.
+static std::string EscapePath(std::string const& path)
+{
+	std::string escaped;
+	for(std::string::const_iterator it = path.begin(); it != path.end(); ++it) {
+		if(*it == '\\') {
+			escaped += "\\\\";
+		} else if(*it == '\n') {
+			escaped += "\\n";
+		} else {
+			escaped.push_back(*it);
+		}
+	}
+	return escaped;
+}
+
+static std::string UnescapePath(std::string const& escaped)
+{
+	std::string path;
+	for(std::string::size_type i = 0; i < escaped.size(); ++i) {
+		if(escaped[i] == '\\' && i + 1 < escaped.size()) {
+			++i;
+			path.push_back(escaped[i] == 'n'? '\n' : escaped[i]);
+		} else {
+			path.push_back(escaped[i]);
+		}
+	}
+	return path;
+}
+
+void BaseTextStore::ReadIndex()
+{
+	FILE* f = fopen((m_directory + "/index").c_str(), "r");
+	if(f == NULL) {
+		return;
+	}
+
+	std::string line;
+	int c = 0;
+	while(c != EOF) {
+		line.clear();
+		while((c = fgetc(f)) != EOF && c != '\n') {
+			line.push_back(c);
+		}
+
+		// The path is everything after the one space following the size.
+		long revision;
+		char md5[64];
+		unsigned long long size;
+		int pathStart = 0;
+		if(sscanf(line.c_str(), "%ld %63s %llu%n", &revision, md5, &size, &pathStart) != 3
+			|| static_cast<std::string::size_type>(pathStart) >= line.size() || line[pathStart] != ' ') {
+			continue;
+		}
+		std::string path(UnescapePath(line.substr(pathStart + 1)));
+
+		// Bases lost since the index was written are forgotten.
+		struct stat st;
+		if(stat(BaseFile(path, md5).c_str(), &st) || static_cast<unsigned long long>(st.st_size) != size) {
+			continue;
+		}
+
+		Entries::iterator it = m_entries.insert(Entries::value_type(path, Entry())).first;
+		it->second.m_md5 = md5;
+		it->second.m_size = size;
+		it->second.m_revision = revision;
+		it->second.m_lru = m_lru.insert(m_lru.end(), path);
+		m_size += size;
+	}
+
+	fclose(f);
+}
+
+// Removes base files the index doesn't know of, such as those stored by a
+// run which didn't finish.
+void BaseTextStore::RemoveStrays()
+{
+	std::set<std::string> known;
+	for(Entries::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+		std::string base(BaseFile(it->first, it->second.m_md5));
+		known.insert(base.substr(base.rfind('/') + 1));
+	}
+
+	std::string directory(m_directory + "/base");
+	DIR* dir = opendir(directory.c_str());
+	if(dir == NULL) {
+		return;
+	}
+
+	struct dirent* ent;
+	while((ent = readdir(dir))) {
+		if(ent->d_name[0] != '.' && known.find(ent->d_name) == known.end()) {
+			unlink((directory + "/" + ent->d_name).c_str());
+		}
+	}
+	closedir(dir);
+}
+
+void BaseTextStore::WriteIndex()
+{
+	std::string index(m_directory + "/index");
+	std::string temp(index + ".tmp");
+
+	FILE* f = fopen(temp.c_str(), "w");
+	if(f == NULL) {
+		ERROR(("Could not write base text index %s: %s", temp.c_str(), strerror(errno)));
+		return;
+	}
+
+	// Written least recently used first so the order survives a reload.
+	for(std::list<std::string>::const_iterator it = m_lru.begin(); it != m_lru.end(); ++it) {
+		Entry const& entry = m_entries.find(*it)->second;
+		fprintf(f, "%ld %s %llu %s\n", entry.m_revision, entry.m_md5.c_str(), entry.m_size, EscapePath(*it).c_str());
+	}
+
+	fclose(f);
+	rename(temp.c_str(), index.c_str());
+}
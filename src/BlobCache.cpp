@@ -0,0 +1,173 @@
+#include "BlobCache.h"
+#include "FileContents.h"
+#include "Hex.h"
+#include "Exception.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static void MakeDirectory(std::string const& path)
+{
+	if(mkdir(path.c_str(), 0777) && errno != EEXIST) {
+		throw EXCEPTION(("Could not create directory %s: %s", path.c_str(), strerror(errno)));
+	}
+}
+
+static void SyncFile(std::string const& fileName)
+{
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if(fd < 0 || fsync(fd)) {
+		int error = errno;
+		if(fd >= 0) {
+			close(fd);
+		}
+		unlink(fileName.c_str());
+		throw EXCEPTION(("Could not sync %s: %s", fileName.c_str(), strerror(error)));
+	}
+	close(fd);
+}
+
+BlobCache::BlobCache(std::string const& directory, std::string const& url) :
+	m_directory(directory),
+	m_indexFile(NULL),
+	m_nextTemp(0),
+	m_hits(0),
+	m_misses(0)
+{
+	MakeDirectory(m_directory);
+	MakeDirectory(m_directory + "/objects");
+
+	m_indexFile = fopen((m_directory + "/index").c_str(), "a");
+	if(m_indexFile == NULL) {
+		throw EXCEPTION(("Could not open blob cache index %s/index: %s", m_directory.c_str(), strerror(errno)));
+	}
+	if(ftell(m_indexFile) == 0) {
+		fprintf(m_indexFile, "url %s\n", url.c_str());
+	} else if(!ReadIndex(url)) {
+		// Don't append to a line cut short by a crash.
+		fputc('\n', m_indexFile);
+	}
+	fflush(m_indexFile);
+}
+
+BlobCache::~BlobCache()
+{
+	if(m_indexFile) {
+		fclose(m_indexFile);
+	}
+}
+
+std::string BlobCache::ObjectFile(std::string const& blobId) const
+{
+	// Split like git's objects so no one directory gets too large.
+	std::string hex(ToHex(blobId));
+	return m_directory + "/objects/" + hex.substr(0, 2) + "/" + hex.substr(2);
+}
+
+bool BlobCache::ReadIndex(std::string const& url)
+{
+	FILE* f = fopen((m_directory + "/index").c_str(), "r");
+	if(f == NULL) {
+		throw EXCEPTION(("Could not read blob cache index %s/index: %s", m_directory.c_str(), strerror(errno)));
+	}
+
+	std::string line;
+	int c = 0;
+	while((c = fgetc(f)) != EOF && c != '\n') {
+		line.push_back(c);
+	}
+	if(line != "url " + url) {
+		fclose(f);
+		throw EXCEPTION(("Blob cache %s is for another repository (%s)", m_directory.c_str(), line.c_str()));
+	}
+
+	std::string blobId;
+	while(c != EOF) {
+		line.clear();
+		while((c = fgetc(f)) != EOF && c != '\n') {
+			line.push_back(c);
+		}
+
+		// A line cut short by a crash is dropped.
+		long revision;
+		char hex[64];
+		int pathStart;
+		if(c == '\n' && sscanf(line.c_str(), "%ld %63s %n", &revision, hex, &pathStart) == 2 && FromHex(hex, blobId)) {
+			m_index[std::make_pair(Path(line.substr(pathStart)), static_cast<svn_revnum_t>(revision))] = blobId;
+		}
+	}
+
+	// Whether the file ends with a complete line.
+	bool complete = fseek(f, -1, SEEK_END) == 0 && fgetc(f) == '\n';
+	fclose(f);
+	return complete;
+}
+
+bool BlobCache::Find(Path const& relPath, svn_revnum_t revision, FileContents& contents, std::string& blobId)
+{
+	{
+		ScopedLock lock(m_mutex);
+		Index::const_iterator it = m_index.find(std::make_pair(relPath, revision));
+		if(it == m_index.end()) {
+			m_misses += 1;
+			return false;
+		}
+		blobId = it->second;
+	}
+
+	std::string object(ObjectFile(blobId));
+	try {
+		contents.Map(object);
+		// Hashing costs a read of what is about to be written out anyway,
+		// and is far cheaper than writing a damaged blob.
+		if(contents.BlobId() != blobId) {
+			throw EXCEPTION(("%s does not hold what it should", object.c_str()));
+		}
+	} catch(std::exception const& e) {
+		// The object has gone or been damaged; fetch it again, and store it
+		// afresh.
+		WARN(("Blob cache: %s", e.what()));
+		contents.Clear();
+		unlink(object.c_str());
+		ScopedLock lock(m_mutex);
+		m_misses += 1;
+		return false;
+	}
+
+	ScopedLock lock(m_mutex);
+	m_hits += 1;
+	return true;
+}
+
+void BlobCache::Save(Path const& relPath, svn_revnum_t revision, FileContents const& contents, std::string const& blobId)
+{
+	std::string object(ObjectFile(blobId));
+	if(access(object.c_str(), F_OK) != 0) {
+		char suffix[32];
+		{
+			ScopedLock lock(m_mutex);
+			snprintf(suffix, sizeof(suffix), ".tmp%lu", m_nextTemp++);
+		}
+		std::string temp(object + suffix);
+
+		MakeDirectory(object.substr(0, object.rfind('/')));
+		contents.WriteToFile(temp);
+		// Otherwise a crash could leave the object named but not written.
+		SyncFile(temp);
+		if(rename(temp.c_str(), object.c_str())) {
+			unlink(temp.c_str());
+			throw EXCEPTION(("Could not store %s: %s", object.c_str(), strerror(errno)));
+		}
+	}
+
+	ScopedLock lock(m_mutex);
+	m_index[std::make_pair(relPath, revision)] = blobId;
+	fprintf(m_indexFile, "%ld %s %s\n", revision, ToHex(blobId).c_str(), relPath.str().c_str());
+	if(fflush(m_indexFile)) {
+		throw EXCEPTION(("Could not write blob cache index: %s", strerror(errno)));
+	}
+}
@@ -0,0 +1,72 @@
+#include "BlobMarks.h"
+#include "Exception.h"
+
+#include <string.h>
+
+#define INITIAL_SLOTS (1024)
+
+BlobMarks::BlobMarks() :
+	m_count(0)
+{
+	Entry empty;
+	memset(&empty, 0, sizeof(empty));
+	m_entries.assign(INITIAL_SLOTS, empty);
+}
+
+// The slot holding id, or the empty one it would go in.
+size_t BlobMarks::Slot(std::vector<Entry> const& entries, char const* id)
+{
+	size_t mask = entries.size() - 1;
+	size_t hash = 0;
+	for(size_t i = 0; i < sizeof(size_t) && i < BLOB_ID_SIZE; ++i) {
+		hash = (hash << 8) | static_cast<unsigned char>(id[i]);
+	}
+
+	size_t slot = hash & mask;
+	while(entries[slot].m_mark && memcmp(entries[slot].m_id, id, BLOB_ID_SIZE)) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+unsigned long BlobMarks::Find(std::string const& id) const
+{
+	if(id.size() != BLOB_ID_SIZE) {
+		return 0;
+	}
+	return m_entries[Slot(m_entries, id.data())].m_mark;
+}
+
+void BlobMarks::Set(std::string const& id, unsigned long mark)
+{
+	if(id.size() != BLOB_ID_SIZE) {
+		throw EXCEPTION(("Blob id is %lu bytes, not %d", static_cast<unsigned long>(id.size()), BLOB_ID_SIZE));
+	}
+	if(mark == 0 || mark > 0xFFFFFFFFUL) {
+		throw EXCEPTION(("Blob mark %lu out of range", mark));
+	}
+
+	Entry& entry = m_entries[Slot(m_entries, id.data())];
+	if(entry.m_mark == 0) {
+		memcpy(entry.m_id, id.data(), BLOB_ID_SIZE);
+		m_count += 1;
+	}
+	entry.m_mark = mark;
+
+	if(m_count * 2 > m_entries.size()) {
+		Grow();
+	}
+}
+
+void BlobMarks::Grow()
+{
+	Entry empty;
+	memset(&empty, 0, sizeof(empty));
+	std::vector<Entry> entries(m_entries.size() * 2, empty);
+	for(std::vector<Entry>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+		if(it->m_mark) {
+			entries[Slot(entries, reinterpret_cast<char const*>(it->m_id))] = *it;
+		}
+	}
+	m_entries.swap(entries);
+}
@@ -0,0 +1,148 @@
+// Times the duplicate checks made while expanding a directory copy, with
+// the ChangeSet index and with the linear scans it replaced.
+//
+// Each run builds a revision holding n changes, then expands a copy of n
+// files into it, the first half of which are already in the revision.
+
+#include "SVNSimple.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+extern "C" {
+#include <apr_general.h>
+}
+
+typedef SVNSimple::Revision::File File;
+typedef SVNSimple::Revision::Files Files;
+
+// Files as they were before, with the path held in a string.
+struct StringFile
+{
+	char m_action;
+	char m_type;
+	std::string m_relPath;
+};
+
+// Linear expansion is quadratic; don't bother beyond this.
+#define MAX_LINEAR (10000)
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static std::string MakePath(unsigned long i)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "branches/b%lu/src/module%lu/file%lu.c", i % 7, i % 97, i);
+	return path;
+}
+
+static void MakeRevision(unsigned long n, std::vector<StringFile>& files)
+{
+	for(unsigned long i = 0; i < n; ++i) {
+		StringFile file;
+		file.m_action = 'A';
+		file.m_type = 'F';
+		file.m_relPath = MakePath(i * 2);
+		files.push_back(file);
+	}
+}
+
+static unsigned long ExpandIndexed(std::vector<StringFile> const& changes, unsigned long n)
+{
+	Files rev;
+	for(std::vector<StringFile>::const_iterator it = changes.begin(); it != changes.end(); ++it) {
+		File file;
+		file.m_action = it->m_action;
+		file.m_type = it->m_type;
+		file.m_relPath = Path(it->m_relPath);
+		rev.push_back(file);
+	}
+
+	Files extras;
+	unsigned long added = 0;
+	for(unsigned long i = 0; i < n; ++i) {
+		File file;
+		file.m_relPath = Path(MakePath(i));
+		if(rev.find(file.m_relPath) == rev.end() && extras.find(file.m_relPath) == extras.end()) {
+			extras.push_back(file);
+			added += 1;
+		}
+	}
+	return added;
+}
+
+static unsigned long ExpandLinear(std::vector<StringFile> const& rev, unsigned long n)
+{
+	std::vector<StringFile> extras;
+	unsigned long added = 0;
+	for(unsigned long i = 0; i < n; ++i) {
+		StringFile file;
+		file.m_relPath = MakePath(i);
+
+		bool found = false;
+		for(std::vector<StringFile>::const_iterator it = rev.begin(); it != rev.end() && !found; ++it) {
+			found = it->m_relPath == file.m_relPath;
+		}
+		for(std::vector<StringFile>::const_iterator it = extras.begin(); it != extras.end() && !found; ++it) {
+			found = it->m_relPath == file.m_relPath;
+		}
+		if(!found) {
+			extras.push_back(file);
+			added += 1;
+		}
+	}
+	return added;
+}
+
+int main(int argc, char** argv)
+{
+	if(apr_initialize() != APR_SUCCESS) {
+		fprintf(stderr, "APR Initialisation failed\n");
+		return 1;
+	}
+
+	static unsigned long const defaultSizes[] = { 10000, 100000, 1000000 };
+	std::vector<unsigned long> sizes;
+	if(argc > 1) {
+		for(int i = 1; i < argc; ++i) {
+			sizes.push_back(strtoul(argv[i], NULL, 10));
+		}
+	} else {
+		sizes.assign(defaultSizes, defaultSizes + sizeof(defaultSizes) / sizeof(defaultSizes[0]));
+	}
+
+	printf("%10s %12s %12s %12s\n", "entries", "indexed (s)", "linear (s)", "speedup");
+	for(std::vector<unsigned long>::const_iterator it = sizes.begin(); it != sizes.end(); ++it) {
+		unsigned long n = *it;
+		std::vector<StringFile> rev;
+		MakeRevision(n, rev);
+
+		double start = Now();
+		unsigned long indexedAdded = ExpandIndexed(rev, n);
+		double indexed = Now() - start;
+
+		if(n > MAX_LINEAR) {
+			printf("%10lu %12.3f %12s %12s\n", n, indexed, "-", "-");
+			continue;
+		}
+
+		start = Now();
+		unsigned long linearAdded = ExpandLinear(rev, n);
+		double linear = Now() - start;
+
+		if(linearAdded != indexedAdded) {
+			fprintf(stderr, "Mismatch at %lu entries: %lu != %lu\n", n, indexedAdded, linearAdded);
+			return 1;
+		}
+
+		printf("%10lu %12.3f %12.3f %11.0fx\n", n, indexed, linear, linear / indexed);
+	}
+
+	return 0;
+}
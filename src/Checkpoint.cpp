@@ -0,0 +1,94 @@
+#include "Checkpoint.h"
+#include "Exception.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+Checkpoint::Checkpoint() :
+	m_revision(SVN_INVALID_REVNUM),
+	m_committed(SVN_INVALID_REVNUM),
+	m_nextMark(1)
+{
+}
+
+bool Checkpoint::Load(std::string const& fileName)
+{
+	FILE* f = fopen(fileName.c_str(), "r");
+	if(f == NULL) {
+		if(errno == ENOENT) {
+			return false;
+		}
+		throw EXCEPTION(("Could not read checkpoint %s: %s", fileName.c_str(), strerror(errno)));
+	}
+
+	*this = Checkpoint();
+	char line[4096];
+	while(fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		char* value = strchr(line, ' ');
+		if(value == NULL) {
+			continue;
+		}
+		*value++ = '\0';
+
+		if(strcmp(line, "url") == 0) {
+			m_url = value;
+		} else if(strcmp(line, "ref") == 0) {
+			m_ref = value;
+		} else if(strcmp(line, "revision") == 0) {
+			m_revision = strtol(value, NULL, 10);
+		} else if(strcmp(line, "committed") == 0) {
+			m_committed = strtol(value, NULL, 10);
+		} else if(strcmp(line, "next-mark") == 0) {
+			m_nextMark = strtoul(value, NULL, 10);
+		}
+	}
+
+	fclose(f);
+	return true;
+}
+
+void Checkpoint::Save(std::string const& fileName) const
+{
+	std::string temp(fileName + ".tmp");
+	FILE* f = fopen(temp.c_str(), "w");
+	if(f == NULL) {
+		throw EXCEPTION(("Could not write checkpoint %s: %s", temp.c_str(), strerror(errno)));
+	}
+
+	fprintf(f, "url %s\n", m_url.c_str());
+	fprintf(f, "ref %s\n", m_ref.c_str());
+	fprintf(f, "revision %ld\n", m_revision);
+	fprintf(f, "committed %ld\n", m_committed);
+	fprintf(f, "next-mark %lu\n", m_nextMark);
+
+	bool failed = fflush(f) || fsync(fileno(f));
+	failed = fclose(f) || failed;
+	if(failed || rename(temp.c_str(), fileName.c_str())) {
+		int error = errno;
+		unlink(temp.c_str());
+		throw EXCEPTION(("Could not write checkpoint %s: %s", fileName.c_str(), strerror(error)));
+	}
+
+	// The rename isn't durable until the directory is synced too.
+	std::string::size_type slash = fileName.rfind('/');
+	std::string directory(slash == std::string::npos? "." : slash == 0? "/" : fileName.substr(0, slash));
+	int fd = open(directory.c_str(), O_RDONLY);
+	if(fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+}
+
+bool Checkpoint::Matches(std::string const& url, std::string const& ref, svn_revnum_t startRev) const
+{
+	return m_url == url
+		&& m_ref == ref
+		&& SVN_IS_VALID_REVNUM(m_committed)
+		&& m_committed + 1 == startRev
+		&& m_revision >= m_committed;
+}
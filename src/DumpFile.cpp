@@ -0,0 +1,592 @@
+#include "DumpFile.h"
+#include "Thread.h"
+#include "Exception.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern "C" {
+#include <svn_delta.h>
+#include <svn_io.h>
+#include <svn_pools.h>
+#include <svn_string.h>
+}
+
+// Texts rebuilt from deltas are kept, up to this much, for the deltas
+// after them to apply to.
+#define REBUILT_TEXTS_SIZE (64 * 1024 * 1024)
+
+Mutex* DumpFile::s_lock = NULL;
+std::map<std::string, DumpFile*> DumpFile::s_open;
+
+// A file added with no text.
+static DumpFile::Text const s_emptyText = { "", 0, false, NULL };
+// Anything from before the dump starts.
+static DumpFile::Text const s_unknownText = { NULL, 0, false, NULL };
+
+static DumpFile::Node MakeRoot()
+{
+	DumpFile::Node root;
+	root.m_revision = 0;
+	root.m_kind = 'D';
+	root.m_reset = true;
+	root.m_copyFromRev = SVN_INVALID_REVNUM;
+	root.m_text = NULL;
+	return root;
+}
+
+// The repository root is never in a dump, but is always there.
+static DumpFile::Node const s_root = MakeRoot();
+
+// path, which is parent or under it, moved to be under newParent instead.
+static Path Rebase(Path const& path, Path const& parent, Path const& newParent)
+{
+	std::vector<Path> below;
+	for(Path p = path; p != parent; p = p.Parent()) {
+		below.push_back(p);
+	}
+	Path rebased(newParent);
+	for(size_t i = below.size(); i-- > 0;) {
+		rebased = rebased.Child(below[i].Name());
+	}
+	return rebased;
+}
+
+static bool HeaderIs(char const* name, size_t length, char const* header)
+{
+	return strlen(header) == length && memcmp(name, header, length) == 0;
+}
+
+void DumpFile::Init()
+{
+	s_lock = new Mutex;
+}
+
+void DumpFile::Shutdown()
+{
+	delete s_lock;
+	s_lock = NULL;
+}
+
+DumpFile* DumpFile::Open(std::string const& fileName)
+{
+	ScopedLock lock(*s_lock);
+	std::map<std::string, DumpFile*>::iterator it = s_open.find(fileName);
+	if(it != s_open.end()) {
+		it->second->m_refs += 1;
+		return it->second;
+	}
+
+	// Other sessions opening the same file wait for it to be indexed.
+	DumpFile* file = new DumpFile(fileName);
+	s_open[fileName] = file;
+	return file;
+}
+
+void DumpFile::Release(DumpFile* file)
+{
+	ScopedLock lock(*s_lock);
+	file->m_refs -= 1;
+	if(file->m_refs == 0) {
+		s_open.erase(file->m_fileName);
+		delete file;
+	}
+}
+
+DumpFile::DumpFile(std::string const& fileName) :
+	m_fileName(fileName),
+	m_refs(1),
+	m_map(NULL),
+	m_mapSize(0),
+	m_rebuiltSize(0)
+{
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if(fd < 0) {
+		throw EXCEPTION(("Could not open %s: %s", fileName.c_str(), strerror(errno)));
+	}
+
+	struct stat st;
+	if(fstat(fd, &st)) {
+		close(fd);
+		throw EXCEPTION(("Could not stat %s: %s", fileName.c_str(), strerror(errno)));
+	}
+	if(st.st_size == 0) {
+		close(fd);
+		throw EXCEPTION(("%s is empty", fileName.c_str()));
+	}
+
+	m_mapSize = st.st_size;
+	m_map = mmap(NULL, m_mapSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(m_map == MAP_FAILED) {
+		throw EXCEPTION(("Could not map %s: %s", fileName.c_str(), strerror(errno)));
+	}
+
+	try {
+		// Indexing reads the headers front to back; contents are read
+		// wherever they are needed after that.
+		posix_madvise(m_map, m_mapSize, POSIX_MADV_SEQUENTIAL);
+		Index();
+		posix_madvise(m_map, m_mapSize, POSIX_MADV_NORMAL);
+	} catch(...) {
+		munmap(m_map, m_mapSize);
+		throw;
+	}
+}
+
+DumpFile::~DumpFile()
+{
+	munmap(m_map, m_mapSize);
+}
+
+bool DumpFile::ReadRecord(char const*& pos, char const* end, Record& record) const
+{
+	// Records are separated by any number of blank lines.
+	while(pos < end && *pos == '\n') {
+		++pos;
+	}
+	if(pos == end) {
+		return false;
+	}
+
+	record.m_type = Record::Type_Other;
+	record.m_revision = SVN_INVALID_REVNUM;
+	record.m_path.clear();
+	record.m_kind = 'U';
+	record.m_action = 0;
+	record.m_copyFromPath = Path();
+	record.m_copyFromRev = SVN_INVALID_REVNUM;
+	record.m_props = NULL;
+	record.m_propsLength = 0;
+	record.m_hasText = false;
+	record.m_delta = false;
+	record.m_text = NULL;
+	record.m_textLength = 0;
+	record.m_textMD5.clear();
+	record.m_baseMD5.clear();
+
+	unsigned long long contentLength = 0;
+	bool hasContentLength = false;
+
+	// Headers run up to a blank line.  Numbers are parsed in place, as
+	// every value ends with a newline.
+	while(true) {
+		char const* eol = static_cast<char const*>(memchr(pos, '\n', end - pos));
+		if(eol == NULL) {
+			throw EXCEPTION(("%s is truncated", m_fileName.c_str()));
+		}
+		if(eol == pos) {
+			++pos;
+			break;
+		}
+
+		char const* colon = static_cast<char const*>(memchr(pos, ':', eol - pos));
+		if(colon == NULL || colon + 1 == eol || colon[1] != ' ') {
+			throw EXCEPTION(("Malformed header in %s at offset %lu", m_fileName.c_str(), static_cast<unsigned long>(pos - static_cast<char const*>(m_map))));
+		}
+		char const* name = pos;
+		size_t nameLength = colon - pos;
+		char const* value = colon + 2;
+		pos = eol + 1;
+
+		if(HeaderIs(name, nameLength, "Revision-number")) {
+			record.m_type = Record::Type_Revision;
+			record.m_revision = strtol(value, NULL, 10);
+		} else if(HeaderIs(name, nameLength, "Node-path")) {
+			record.m_type = Record::Type_Node;
+			record.m_path.assign(value, eol);
+		} else if(HeaderIs(name, nameLength, "Node-kind")) {
+			record.m_kind = (eol - value == 3 && memcmp(value, "dir", 3) == 0)? 'D' : 'F';
+		} else if(HeaderIs(name, nameLength, "Node-action")) {
+			switch(*value) {
+				case 'a': record.m_action = 'A'; break;
+				case 'c': record.m_action = 'M'; break;
+				case 'd': record.m_action = 'D'; break;
+				case 'r': record.m_action = 'R'; break;
+				default:
+					throw EXCEPTION(("Unknown node action in %s at offset %lu", m_fileName.c_str(), static_cast<unsigned long>(value - static_cast<char const*>(m_map))));
+			}
+		} else if(HeaderIs(name, nameLength, "Node-copyfrom-rev")) {
+			record.m_copyFromRev = strtol(value, NULL, 10);
+		} else if(HeaderIs(name, nameLength, "Node-copyfrom-path")) {
+			record.m_copyFromPath = Path(std::string(value, eol));
+		} else if(HeaderIs(name, nameLength, "Prop-content-length")) {
+			record.m_propsLength = strtoull(value, NULL, 10);
+		} else if(HeaderIs(name, nameLength, "Text-content-length")) {
+			record.m_hasText = true;
+			record.m_textLength = strtoull(value, NULL, 10);
+		} else if(HeaderIs(name, nameLength, "Text-delta")) {
+			record.m_delta = (eol - value == 4 && memcmp(value, "true", 4) == 0);
+		} else if(HeaderIs(name, nameLength, "Text-content-md5")) {
+			record.m_textMD5.assign(value, eol);
+		} else if(HeaderIs(name, nameLength, "Text-delta-base-md5")) {
+			record.m_baseMD5.assign(value, eol);
+		} else if(HeaderIs(name, nameLength, "Content-length")) {
+			hasContentLength = true;
+			contentLength = strtoull(value, NULL, 10);
+		}
+	}
+
+	if(!hasContentLength) {
+		contentLength = record.m_propsLength + record.m_textLength;
+	}
+	if(contentLength > static_cast<unsigned long long>(end - pos) || record.m_propsLength + record.m_textLength > contentLength) {
+		throw EXCEPTION(("%s is truncated", m_fileName.c_str()));
+	}
+	record.m_props = pos;
+	record.m_text = pos + record.m_propsLength;
+	pos += contentLength;
+
+	return true;
+}
+
+void DumpFile::Index()
+{
+	char const* pos = static_cast<char const*>(m_map);
+	char const* end = pos + m_mapSize;
+	Record record;
+	while(true) {
+		char const* start = pos;
+		if(!ReadRecord(pos, end, record)) {
+			break;
+		}
+
+		if(record.m_type == Record::Type_Revision) {
+			if(m_revisions.size() && record.m_revision <= m_revisions.back().m_revision) {
+				throw EXCEPTION(("Revision %ld is out of order in %s", record.m_revision, m_fileName.c_str()));
+			}
+			Revision revision;
+			revision.m_revision = record.m_revision;
+			revision.m_start = start;
+			revision.m_end = pos;
+			m_revisions.push_back(revision);
+		} else if(record.m_type == Record::Type_Node) {
+			if(m_revisions.empty()) {
+				throw EXCEPTION(("%s has a node before the first revision", m_fileName.c_str()));
+			}
+			AddNode(record, m_revisions.back().m_revision);
+			m_revisions.back().m_end = pos;
+		}
+		// Anything else is the format version or UUID, which may be repeated
+		// by dumps concatenated together.
+	}
+}
+
+void DumpFile::AddNode(Record const& record, svn_revnum_t revision)
+{
+	if(record.m_action == 0) {
+		throw EXCEPTION(("%s@%ld has no action in %s", record.m_path.c_str(), revision, m_fileName.c_str()));
+	}
+
+	Path path(record.m_path);
+	Node node;
+	node.m_revision = revision;
+	node.m_kind = record.m_kind;
+	node.m_reset = record.m_action != 'M';
+	node.m_copyFromRev = SVN_INVALID_REVNUM;
+	node.m_text = NULL;
+
+	bool copied = record.m_action != 'M' && record.m_action != 'D' && SVN_IS_VALID_REVNUM(record.m_copyFromRev);
+	Node const* source = NULL;
+	bool sourceKnown = true;
+	if(copied) {
+		source = Resolve(record.m_copyFromPath, record.m_copyFromRev, sourceKnown);
+		if(source == NULL && sourceKnown) {
+			throw EXCEPTION(("%s@%ld is copied from %s@%ld, which isn't there", record.m_path.c_str(), revision, record.m_copyFromPath.str().c_str(), record.m_copyFromRev));
+		}
+	}
+
+	if(record.m_action == 'D') {
+		node.m_kind = 'X';
+	} else if(node.m_kind == 'U') {
+		// Only deletions normally leave out the kind.
+		bool known;
+		Node const* current = copied? source : Resolve(path, revision, known);
+		if(current == NULL) {
+			throw EXCEPTION(("No kind given for %s@%ld in %s", record.m_path.c_str(), revision, m_fileName.c_str()));
+		}
+		node.m_kind = current->m_kind;
+	}
+
+	if(node.m_kind == 'D' && copied) {
+		node.m_copyFromPath = record.m_copyFromPath;
+		node.m_copyFromRev = record.m_copyFromRev;
+	}
+
+	if(node.m_kind == 'F') {
+		// What the text is copied or changed from, and what any delta is
+		// against.
+		Text const* base = NULL;
+		if(copied) {
+			base = sourceKnown? source->m_text : &s_unknownText;
+		} else if(record.m_action == 'M') {
+			bool known;
+			Node const* current = Resolve(path, revision, known);
+			if(!known) {
+				base = &s_unknownText;
+			} else if(current == NULL || current->m_kind != 'F') {
+				throw EXCEPTION(("%s@%ld is changed but is not a file in %s", record.m_path.c_str(), revision, m_fileName.c_str()));
+			} else {
+				base = current->m_text;
+			}
+		}
+
+		if(record.m_hasText) {
+			Text text;
+			text.m_data = record.m_text;
+			text.m_length = record.m_textLength;
+			text.m_delta = record.m_delta;
+			text.m_base = record.m_delta? base : NULL;
+			m_texts.push_back(text);
+			node.m_text = &m_texts.back();
+		} else {
+			node.m_text = base? base : &s_emptyText;
+		}
+	}
+
+	m_nodes[path].push_back(node);
+
+	if(record.m_action != 'D' && !path.empty()) {
+		m_children[path.Parent()].insert(path);
+	}
+}
+
+void DumpFile::FindRevision(svn_revnum_t revision, Record& record, char const*& nodes, char const*& end) const
+{
+	size_t low = 0;
+	size_t high = m_revisions.size();
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		if(m_revisions[middle].m_revision < revision) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if(low == m_revisions.size() || m_revisions[low].m_revision != revision) {
+		throw EXCEPTION(("Revision %ld is not in %s", revision, m_fileName.c_str()));
+	}
+
+	nodes = m_revisions[low].m_start;
+	end = m_revisions[low].m_end;
+	ReadRecord(nodes, end, record);
+}
+
+DumpFile::Node const* DumpFile::Latest(Path const& path, svn_revnum_t revision) const
+{
+	Nodes::const_iterator it = m_nodes.find(path);
+	if(it == m_nodes.end()) {
+		return NULL;
+	}
+
+	std::vector<Node> const& versions = it->second;
+	size_t low = 0;
+	size_t high = versions.size();
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		if(versions[middle].m_revision <= revision) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low? &versions[low - 1] : NULL;
+}
+
+DumpFile::Node const* DumpFile::Decide(Path const& path, svn_revnum_t revision, bool ownChanges, Path& decider) const
+{
+	// Deepest first, so on a tie (a copy and then changes within it, in one
+	// revision) the deepest wins.
+	Node const* best = NULL;
+	Path current(path);
+	while(true) {
+		bool own = (current == path);
+		Node const* node = Latest(current, revision);
+		if(node && (node->m_reset || (own && ownChanges)) && (best == NULL || node->m_revision > best->m_revision)) {
+			best = node;
+			decider = current;
+		}
+		if(current.empty()) {
+			break;
+		}
+		current = current.Parent();
+		// The repository root is never in a dump.
+		if(current.empty()) {
+			break;
+		}
+	}
+	return best;
+}
+
+DumpFile::Node const* DumpFile::Resolve(Path const& path, svn_revnum_t revision, bool& known) const
+{
+	known = true;
+	Path current(path);
+	while(true) {
+		Path decider;
+		Node const* node = Decide(current, revision, true, decider);
+		if(node == NULL) {
+			if(current.empty()) {
+				return &s_root;
+			}
+			// A dump which starts after r0 doesn't say what was there before.
+			known = GetFirstRevision() == 0;
+			return NULL;
+		}
+		if(decider == current) {
+			return node->m_kind == 'X'? NULL : node;
+		}
+
+		// Under a parent which was added or deleted since; only a copy
+		// brings anything along with it.
+		if(node->m_kind != 'D' || !SVN_IS_VALID_REVNUM(node->m_copyFromRev)) {
+			return NULL;
+		}
+		current = Rebase(current, decider, node->m_copyFromPath);
+		revision = node->m_copyFromRev;
+	}
+}
+
+DumpFile::Node const* DumpFile::Find(std::string const& path, svn_revnum_t revision) const
+{
+	bool known;
+	Node const* node = Resolve(Path(path), revision, known);
+	if(!known) {
+		throw EXCEPTION(("%s@%ld is from before the start of %s", path.c_str(), revision, m_fileName.c_str()));
+	}
+	return node;
+}
+
+void DumpFile::Collect(Path const& path, svn_revnum_t revision, std::set<std::string>& names) const
+{
+	Children::const_iterator it = m_children.find(path);
+	if(it != m_children.end()) {
+		for(std::set<Path>::const_iterator child = it->second.begin(); child != it->second.end(); ++child) {
+			names.insert(child->Name());
+		}
+	}
+
+	// The directory, or one above it, may have been copied along with
+	// everything in it.
+	Path decider;
+	Node const* node = Decide(path, revision, false, decider);
+	if(node && node->m_kind == 'D' && SVN_IS_VALID_REVNUM(node->m_copyFromRev)) {
+		Collect(Rebase(path, decider, node->m_copyFromPath), node->m_copyFromRev, names);
+	}
+}
+
+void DumpFile::List(std::string const& path, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries) const
+{
+	Node const* dir = Find(path, revision);
+	if(dir == NULL || dir->m_kind != 'D') {
+		throw EXCEPTION(("%s@%ld is not a directory in %s", path.c_str(), revision, m_fileName.c_str()));
+	}
+
+	// Everything which has ever been there, less what isn't now.
+	Path dirPath(path);
+	std::set<std::string> names;
+	Collect(dirPath, revision, names);
+	for(std::set<std::string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+		Path child(dirPath.Child(*it));
+		bool known;
+		Node const* node = Resolve(child, revision, known);
+		if(!known) {
+			throw EXCEPTION(("%s@%ld is from before the start of %s", child.str().c_str(), revision, m_fileName.c_str()));
+		}
+		if(node) {
+			entries.push_back(std::make_pair(*it, node->m_kind == 'D'));
+		}
+	}
+}
+
+void DumpFile::WriteText(Text const* text, svn_stream_t* stream, apr_pool_t* pool) const
+{
+	svn_error_t* err;
+
+	// Deltas apply to the text before, back to a full one (or nothing), or
+	// to one rebuilt already.  Texts are mostly asked for in order, so the
+	// one rebuilt last for a file is the one the next delta is against.
+	Text const* wanted = text;
+	std::vector<Text const*> deltas;
+	std::string rebuilt;
+	bool found = false;
+	{
+		ScopedLock lock(m_rebuiltLock);
+		for(; text && text->m_delta; text = text->m_base) {
+			Rebuilt::iterator it = m_rebuilt.find(text);
+			if(it != m_rebuilt.end()) {
+				if(text == wanted) {
+					rebuilt = it->second;
+				} else {
+					// Taken out, as what it is rebuilt into replaces it.
+					rebuilt.swap(it->second);
+					m_rebuiltSize -= rebuilt.size();
+					m_rebuilt.erase(it);
+				}
+				found = true;
+				break;
+			}
+			deltas.push_back(text);
+		}
+	}
+	if(!found && text == &s_unknownText) {
+		throw EXCEPTION(("A text in %s is based on one from before the dump starts", m_fileName.c_str()));
+	}
+
+	if(deltas.empty()) {
+		apr_size_t length = found? rebuilt.size() : text->m_length;
+		if((err = svn_stream_write(stream, found? rebuilt.data() : text->m_data, &length))) {
+			throw EXCEPTION(("SVN Error: %s", err->message));
+		}
+		return;
+	}
+
+	apr_pool_t* sourcePool = svn_pool_create(pool);
+	svn_stringbuf_t* source;
+	if(found) {
+		source = svn_stringbuf_ncreate(rebuilt.data(), rebuilt.size(), sourcePool);
+	} else if(text) {
+		source = svn_stringbuf_ncreate(text->m_data, text->m_length, sourcePool);
+	} else {
+		source = svn_stringbuf_create_empty(sourcePool);
+	}
+	for(size_t i = deltas.size(); i-- > 0;) {
+		apr_pool_t* targetPool = svn_pool_create(pool);
+		svn_stringbuf_t* target = svn_stringbuf_create_empty(targetPool);
+
+		svn_txdelta_window_handler_t handler;
+		void* handlerBaton;
+		svn_txdelta_apply(svn_stream_from_stringbuf(source, targetPool), svn_stream_from_stringbuf(target, targetPool), NULL, NULL, targetPool, &handler, &handlerBaton);
+		svn_stream_t* parser = svn_txdelta_parse_svndiff(handler, handlerBaton, TRUE, targetPool);
+		apr_size_t length = deltas[i]->m_length;
+		if((err = svn_stream_write(parser, deltas[i]->m_data, &length)) || (err = svn_stream_close(parser))) {
+			throw EXCEPTION(("SVN Error: %s", err->message));
+		}
+
+		svn_pool_destroy(sourcePool);
+		sourcePool = targetPool;
+		source = target;
+	}
+
+	apr_size_t length = source->len;
+	if((err = svn_stream_write(stream, source->data, &length))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+
+	if(source->len <= REBUILT_TEXTS_SIZE) {
+		ScopedLock lock(m_rebuiltLock);
+		if(m_rebuiltSize + source->len > REBUILT_TEXTS_SIZE) {
+			m_rebuilt.clear();
+			m_rebuiltSize = 0;
+		}
+		std::string& entry = m_rebuilt[wanted];
+		m_rebuiltSize += source->len - entry.size();
+		entry.assign(source->data, source->len);
+	}
+	svn_pool_destroy(sourcePool);
+}
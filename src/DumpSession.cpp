@@ -0,0 +1,275 @@
+#include "DumpSession.h"
+#include "DumpFile.h"
+#include "Exception.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+extern "C" {
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <svn_delta.h>
+#include <svn_io.h>
+#include <svn_pools.h>
+#include <svn_string.h>
+}
+
+#define URL_SCHEME "dump://"
+
+static void Check(svn_error_t* err)
+{
+	if(err) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+}
+
+// Properties are "K <length>\n<name>\nV <length>\n<value>\n" pairs, up to
+// PROPS-END.
+static apr_hash_t* ReadProps(DumpFile::Record const& record, apr_pool_t* pool)
+{
+	apr_hash_t* props = apr_hash_make(pool);
+	char const* pos = record.m_props;
+	char const* end = pos + record.m_propsLength;
+	while(pos < end && static_cast<size_t>(end - pos) >= 9 && memcmp(pos, "PROPS-END", 9)) {
+		char const* parts[2];
+		size_t lengths[2];
+		for(int i = 0; i < 2; ++i) {
+			char* next;
+			lengths[i] = strtoul(pos + 2, &next, 10);
+			if(*pos != (i? 'V' : 'K') || *next != '\n' || lengths[i] >= static_cast<size_t>(end - next - 1)) {
+				throw EXCEPTION(("Malformed properties in revision %ld", record.m_revision));
+			}
+			parts[i] = next + 1;
+			pos = parts[i] + lengths[i] + 1;
+		}
+		apr_hash_set(props, apr_pstrmemdup(pool, parts[0], lengths[0]), lengths[0], svn_string_ncreate(parts[1], lengths[1], pool));
+	}
+	return props;
+}
+
+bool DumpSession::Handles(std::string const& url)
+{
+	return url.compare(0, strlen(URL_SCHEME), URL_SCHEME) == 0;
+}
+
+DumpSession::DumpSession(std::string const& url, apr_pool_t* pool) :
+	m_pool(pool),
+	m_dump(NULL)
+{
+	// The dump is the longest leading part of the path which is a file; the
+	// rest is the subtree.
+	std::string fileName(url.substr(strlen(URL_SCHEME)));
+	struct stat st;
+	while(stat(fileName.c_str(), &st) || !S_ISREG(st.st_mode)) {
+		size_t slash = fileName.rfind('/');
+		if(slash == std::string::npos || slash == 0) {
+			throw EXCEPTION(("No dump file found at %s", url.c_str()));
+		}
+		std::string name(fileName.substr(slash + 1));
+		if(name.size()) {
+			m_subtree = m_subtree.empty()? name : name + "/" + m_subtree;
+		}
+		fileName.erase(slash);
+	}
+
+	m_dump = DumpFile::Open(fileName);
+}
+
+DumpSession::~DumpSession()
+{
+	DumpFile::Release(m_dump);
+}
+
+std::string DumpSession::DumpPath(char const* relPath) const
+{
+	if(relPath[0] == '\0') {
+		return m_subtree;
+	}
+	return m_subtree.empty()? relPath : m_subtree + "/" + relPath;
+}
+
+svn_revnum_t DumpSession::GetLatestRevision()
+{
+	svn_revnum_t rev = m_dump->GetLatestRevision();
+	if(!SVN_IS_VALID_REVNUM(rev)) {
+		throw EXCEPTION(("%s has no revisions", m_dump->GetFileName().c_str()));
+	}
+	return rev;
+}
+
+svn_node_kind_t DumpSession::CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool)
+{
+	DumpFile::Node const* node = m_dump->Find(DumpPath(relPath), revision);
+	if(node == NULL) {
+		return svn_node_none;
+	}
+	return node->m_kind == 'D'? svn_node_dir : svn_node_file;
+}
+
+void DumpSession::GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool)
+{
+	m_dump->List(DumpPath(relPath), revision, entries);
+}
+
+void DumpSession::GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool)
+{
+	std::string path(DumpPath(relPath));
+	DumpFile::Node const* node = m_dump->Find(path, revision);
+	if(node == NULL || node->m_kind != 'F') {
+		throw EXCEPTION(("%s@%ld is not a file in %s", path.c_str(), revision, m_dump->GetFileName().c_str()));
+	}
+	m_dump->WriteText(node->m_text, stream, pool);
+}
+
+bool DumpSession::BorrowFile(char const* relPath, svn_revnum_t revision, char const** data, size_t* length)
+{
+	// Deltas have to be applied, and anything else is for GetFile() to
+	// complain about.
+	DumpFile::Node const* node = m_dump->Find(DumpPath(relPath), revision);
+	if(node == NULL || node->m_kind != 'F' || node->m_text->m_delta || node->m_text->m_data == NULL) {
+		return false;
+	}
+	*data = node->m_text->m_data;
+	*length = node->m_text->m_length;
+	return true;
+}
+
+void DumpSession::GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool)
+{
+	std::vector<std::string> dumpPaths;
+	if(paths) {
+		for(int i = 0; i < paths->nelts; ++i) {
+			dumpPaths.push_back(DumpPath(APR_ARRAY_IDX(paths, i, char const*)));
+		}
+	}
+
+	apr_pool_t* iterPool = svn_pool_create(pool);
+	for(svn_revnum_t rev = from; rev <= to; ++rev) {
+		svn_pool_clear(iterPool);
+
+		DumpFile::Record record;
+		char const* pos;
+		char const* end;
+		m_dump->FindRevision(rev, record, pos, end);
+
+		svn_log_entry_t* entry = svn_log_entry_create(iterPool);
+		entry->revision = rev;
+		entry->revprops = ReadProps(record, iterPool);
+		entry->changed_paths2 = apr_hash_make(iterPool);
+
+		bool wanted = paths == NULL;
+		while(m_dump->ReadRecord(pos, end, record)) {
+			if(record.m_type != DumpFile::Record::Type_Node) {
+				continue;
+			}
+
+			svn_log_changed_path2_t* change = svn_log_changed_path2_create(iterPool);
+			change->action = record.m_action;
+			if(SVN_IS_VALID_REVNUM(record.m_copyFromRev)) {
+				change->copyfrom_path = apr_pstrcat(iterPool, "/", record.m_copyFromPath.str().c_str(), NULL);
+				change->copyfrom_rev = record.m_copyFromRev;
+			}
+			change->node_kind = record.m_kind == 'D'? svn_node_dir : record.m_kind == 'F'? svn_node_file : svn_node_unknown;
+			apr_hash_set(entry->changed_paths2, apr_pstrcat(iterPool, "/", record.m_path.c_str(), NULL), APR_HASH_KEY_STRING, change);
+
+			for(std::vector<std::string>::const_iterator it = dumpPaths.begin(); !wanted && it != dumpPaths.end(); ++it) {
+				wanted = it->empty() || record.m_path == *it || (record.m_path.compare(0, it->size(), *it) == 0 && record.m_path[it->size()] == '/');
+			}
+		}
+
+		if(wanted) {
+			Check(receiver(baton, entry, iterPool));
+		}
+	}
+	svn_pool_destroy(iterPool);
+}
+
+void DumpSession::Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool)
+{
+	// Each revision drives the editor as svn_repos_replay2() would, with
+	// everything as a child of the root.
+	apr_pool_t* iterPool = svn_pool_create(pool);
+	for(svn_revnum_t rev = from; rev <= to; ++rev) {
+		svn_pool_clear(iterPool);
+
+		DumpFile::Record record;
+		char const* pos;
+		char const* end;
+		m_dump->FindRevision(rev, record, pos, end);
+		apr_hash_t* revProps = ReadProps(record, iterPool);
+
+		svn_delta_editor_t const* editor;
+		void* editBaton;
+		void* rootBaton;
+		Check(revStart(rev, baton, &editor, &editBaton, revProps, iterPool));
+		Check(editor->open_root(editBaton, rev - 1, iterPool, &rootBaton));
+
+		while(m_dump->ReadRecord(pos, end, record)) {
+			if(record.m_type != DumpFile::Record::Type_Node) {
+				continue;
+			}
+			std::string const& path = record.m_path;
+			if(m_subtree.size() && path != m_subtree && (path.compare(0, m_subtree.size(), m_subtree) || path[m_subtree.size()] != '/')) {
+				continue;
+			}
+
+			char const* copyFrom = NULL;
+			if(SVN_IS_VALID_REVNUM(record.m_copyFromRev)) {
+				copyFrom = apr_pstrcat(iterPool, "/", record.m_copyFromPath.str().c_str(), NULL);
+			}
+			char kind = record.m_kind;
+			if(kind == 'U' && record.m_action != 'D') {
+				DumpFile::Node const* node = m_dump->Find(path, rev);
+				kind = (node && node->m_kind == 'D')? 'D' : 'F';
+			}
+
+			if(record.m_action == 'D' || record.m_action == 'R') {
+				Check(editor->delete_entry(path.c_str(), rev - 1, rootBaton, iterPool));
+			}
+			if(record.m_action == 'D') {
+				continue;
+			}
+
+			if(kind == 'D') {
+				void* dirBaton;
+				if(record.m_action == 'M') {
+					Check(editor->open_directory(path.c_str(), rootBaton, rev - 1, iterPool, &dirBaton));
+				} else {
+					Check(editor->add_directory(path.c_str(), rootBaton, copyFrom, record.m_copyFromRev, iterPool, &dirBaton));
+				}
+				Check(editor->close_directory(dirBaton, iterPool));
+				continue;
+			}
+
+			void* fileBaton;
+			if(record.m_action == 'M') {
+				Check(editor->open_file(path.c_str(), rootBaton, rev - 1, iterPool, &fileBaton));
+			} else {
+				Check(editor->add_file(path.c_str(), rootBaton, copyFrom, record.m_copyFromRev, iterPool, &fileBaton));
+			}
+			if(sendDeltas && record.m_hasText) {
+				svn_txdelta_window_handler_t handler;
+				void* handlerBaton;
+				Check(editor->apply_textdelta(fileBaton, record.m_delta && record.m_baseMD5.size()? record.m_baseMD5.c_str() : NULL, iterPool, &handler, &handlerBaton));
+				if(record.m_delta) {
+					svn_stream_t* parser = svn_txdelta_parse_svndiff(handler, handlerBaton, TRUE, iterPool);
+					apr_size_t length = record.m_textLength;
+					Check(svn_stream_write(parser, record.m_text, &length));
+					Check(svn_stream_close(parser));
+				} else {
+					// Straight from the mapping.
+					svn_string_t text;
+					text.data = record.m_text;
+					text.len = record.m_textLength;
+					Check(svn_txdelta_send_string(&text, handler, handlerBaton, iterPool));
+				}
+			}
+			Check(editor->close_file(fileBaton, record.m_textMD5.size()? record.m_textMD5.c_str() : NULL, iterPool));
+		}
+
+		Check(editor->close_directory(rootBaton, iterPool));
+		Check(revFinish(rev, baton, editor, editBaton, revProps, iterPool));
+	}
+	svn_pool_destroy(iterPool);
+}
@@ -0,0 +1,331 @@
+// Times the CPU half of the export: the filter passes each revision goes
+// through, making commits, and dumping whole windows of revisions to
+// /dev/null, with no repository or network.
+//
+//   export-bench [scenario] [scale]
+//
+// Each scenario builds a set of revisions in memory, shaped like one kind
+// of history: many tiny revisions, one huge revision, long log messages,
+// many authors or many ignore patterns.  Their file contents are served
+// from a recording (see PlaybackSession) over the main session, so that
+// fetching costs only what the exporter itself does with each file.  The
+// stages run in the order an export runs them, each over every revision.
+//
+// Reports ns per file and operator new calls per revision for each stage.
+// scale multiplies the number of revisions (or files, for "huge").
+
+#include "SVNSimple.h"
+#include "FastExport.h"
+#include "FetchPool.h"
+#include "Filters.h"
+#include "IgnoreRules.h"
+#include "Output.h"
+#include "Recording.h"
+#include "Exception.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+typedef SVNSimple::Revision Revision;
+typedef std::vector<Revision> RevisionWindow;
+
+// As many revisions as are handed to DumpRevisions() at once.
+#define WINDOW_REVISIONS (64)
+#define CONTENT_BYTES (512)
+
+#if __cplusplus < 201103L
+#define THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define THROWS_NOTHING throw()
+#else
+#define THROWS_BAD_ALLOC
+#define THROWS_NOTHING noexcept
+#endif
+
+static unsigned long s_allocations = 0;
+
+void* operator new(size_t size) THROWS_BAD_ALLOC
+{
+	__sync_fetch_and_add(&s_allocations, 1);
+	void* p = malloc(size? size : 1);
+	if(p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) THROWS_NOTHING
+{
+	free(p);
+}
+
+struct Scenario
+{
+	char const* m_name;
+	unsigned long m_revisions;
+	unsigned long m_filesPerRevision;
+	unsigned long m_logBytes;
+	unsigned long m_authors;
+	unsigned long m_ignorePatterns;
+};
+
+static Scenario const s_scenarios[] = {
+	{ "tiny", 20000, 1, 60, 8, 0 },
+	{ "huge", 1, 100000, 60, 1, 0 },
+	{ "logs", 2000, 2, 32768, 8, 0 },
+	{ "authors", 10000, 2, 60, 5000, 0 },
+	{ "ignores", 2000, 20, 60, 8, 300 },
+};
+
+#define USER_PREFIX "ad-"
+
+// Exposes the commit pass on its own.
+class BenchExport : public FastExport
+{
+public:
+	BenchExport() : FastExport("refs/heads/bench", "") { }
+
+	void Commit(Revision const& rev, std::vector<unsigned long> const& fileMarks) { MakeCommits(rev, fileMarks); }
+};
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Every tenth file is one the ignore patterns may match.
+static std::string MakeFileName(Scenario const& scenario, unsigned long i)
+{
+	char name[96];
+	if(scenario.m_ignorePatterns && i % 10 == 0) {
+		snprintf(name, sizeof(name), "trunk/module%lu/gen%lu/file%lu.o", i % 211, i % scenario.m_ignorePatterns, i);
+	} else {
+		snprintf(name, sizeof(name), "trunk/module%lu/sub%lu/file%lu.c", i % 211, i % 13, i);
+	}
+	return name;
+}
+
+static std::string MakeAuthor(unsigned long i)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "%suser%lu", i % 2? USER_PREFIX : "", i);
+	return name;
+}
+
+static void MakeContents(Revision const& rev, Revision::File const& file, std::string& contents)
+{
+	char line[160];
+	int length = snprintf(line, sizeof(line), "revision %lu of %s\n", rev.m_revision, file.m_relPath.str().c_str());
+	contents.clear();
+	while(contents.size() < CONTENT_BYTES) {
+		contents.append(line, length);
+	}
+}
+
+static void Build(Scenario const& scenario, double scale, RevisionWindow& revisions, Recorder& recorder)
+{
+	unsigned long numRevisions = scenario.m_revisions;
+	unsigned long filesPerRevision = scenario.m_filesPerRevision;
+	if(numRevisions > 1) {
+		numRevisions = static_cast<unsigned long>(numRevisions * scale);
+	} else {
+		filesPerRevision = static_cast<unsigned long>(filesPerRevision * scale);
+	}
+
+	recorder.Write(Recording::Key("subtree", -1), std::string());
+	std::string log(scenario.m_logBytes, 'x');
+	std::string contents;
+	for(unsigned long r = 1; r <= numRevisions; ++r) {
+		Revision rev;
+		rev.m_revision = r;
+		rev.m_user = MakeAuthor(r % scenario.m_authors);
+		rev.m_log = log;
+		rev.m_date = 1000000000 + r;
+
+		for(unsigned long i = 0; i < filesPerRevision; ++i) {
+			Revision::File file;
+			file.m_action = r == 1? 'A' : 'M';
+			file.m_type = 'F';
+			file.m_relPath = Path(MakeFileName(scenario, (r - 1) * filesPerRevision + i));
+			rev.m_files.push_back(file);
+
+			MakeContents(rev, file, contents);
+			recorder.Write(Recording::Key("file", r, file.m_relPath.str().c_str()), contents);
+		}
+
+		revisions.push_back(Revision());
+		revisions.back().swap(rev);
+	}
+}
+
+static void Report(Scenario const& scenario, char const* stage, RevisionWindow const& revisions, double start, unsigned long allocations)
+{
+	Output::Flush();
+	double elapsed = Now() - start;
+	allocations = s_allocations - allocations;
+
+	unsigned long files = 0;
+	for(RevisionWindow::const_iterator it = revisions.begin(); it != revisions.end(); ++it) {
+		files += it->m_files.size();
+	}
+	printf("%-8s %-10s %10.1f ns/file %10.1f allocs/rev %8.3f s\n", scenario.m_name, stage,
+		files? elapsed * 1e9 / files : 0.0, revisions.size()? static_cast<double>(allocations) / revisions.size() : 0.0, elapsed);
+}
+
+static bool Selected(char const* name, Scenario const& scenario)
+{
+	return strcmp(name, "all") == 0 || strcmp(name, scenario.m_name) == 0;
+}
+
+static void Run(Scenario const& scenario, double scale)
+{
+	char fileName[] = "/tmp/export-bench.XXXXXX";
+	int fd = mkstemp(fileName);
+	if(fd < 0) {
+		throw EXCEPTION(("Could not create a recording: %s", strerror(errno)));
+	}
+	close(fd);
+
+	RevisionWindow revisions;
+	try {
+		{
+			Recorder recorder(fileName);
+			Build(scenario, scale, revisions, recorder);
+		}
+
+		IgnoreRules ignoreRules;
+		for(unsigned long i = 0; i < scenario.m_ignorePatterns; ++i) {
+			char pattern[64];
+			switch(i % 3) {
+				case 0: snprintf(pattern, sizeof(pattern), "*.tmp%lu", i); break;
+				case 1: snprintf(pattern, sizeof(pattern), "trunk/build%lu/*", i); break;
+				default: snprintf(pattern, sizeof(pattern), "*/gen%lu/*.o", i); break;
+			}
+			ignoreRules.Add(pattern);
+		}
+		// Authors without the prefix are mapped every other one; those with
+		// it are left for RewriteCommitters() to make up.
+		UserMap users;
+		for(unsigned long i = 0; i < scenario.m_authors; i += 2) {
+			std::string user(MakeAuthor(i));
+			users[user] = "User " + user + " <" + user + "@example.com>";
+		}
+
+		double start = Now();
+		unsigned long allocations = s_allocations;
+		for(RevisionWindow::iterator it = revisions.begin(); it != revisions.end(); ++it) {
+			FilterIgnoredFiles(*it, ignoreRules);
+		}
+		Report(scenario, "filter", revisions, start, allocations);
+
+		start = Now();
+		allocations = s_allocations;
+		for(RevisionWindow::iterator it = revisions.begin(); it != revisions.end(); ++it) {
+			AddSVNSourceTag(*it, "bench");
+		}
+		Report(scenario, "source-tag", revisions, start, allocations);
+
+		start = Now();
+		allocations = s_allocations;
+		for(RevisionWindow::iterator it = revisions.begin(); it != revisions.end(); ++it) {
+			RewriteCommitters(*it, users, USER_PREFIX);
+		}
+		Report(scenario, "committers", revisions, start, allocations);
+
+		{
+			BenchExport exporter;
+			std::vector<unsigned long> fileMarks;
+			start = Now();
+			allocations = s_allocations;
+			for(RevisionWindow::const_iterator it = revisions.begin(); it != revisions.end(); ++it) {
+				fileMarks.assign(it->m_files.size(), 1);
+				exporter.Commit(*it, fileMarks);
+			}
+			Report(scenario, "commits", revisions, start, allocations);
+		}
+
+		{
+			SVNSimple connection(std::string("recording://") + fileName, "", "");
+			FetchPool fetcher(connection, "", "", "", 0);
+			FastExport exporter("refs/heads/bench", "");
+
+			// In windows, as the export hands them over; DumpRevisions()
+			// only reads them.
+			start = Now();
+			allocations = s_allocations;
+			for(size_t first = 0; first < revisions.size(); first += WINDOW_REVISIONS) {
+				size_t last = std::min(first + WINDOW_REVISIONS, revisions.size());
+				RevisionWindow window;
+				window.reserve(last - first);
+				for(size_t i = first; i < last; ++i) {
+					window.push_back(Revision());
+					window.back().swap(revisions[i]);
+				}
+				exporter.DumpRevisions(fetcher, window);
+				for(size_t i = first; i < last; ++i) {
+					revisions[i].swap(window[i - first]);
+				}
+			}
+			Report(scenario, "dump", revisions, start, allocations);
+		}
+	} catch(...) {
+		unlink(fileName);
+		throw;
+	}
+	unlink(fileName);
+}
+
+int main(int argc, char** argv)
+{
+	char const* name = argc > 1? argv[1] : "all";
+	double scale = argc > 2? strtod(argv[2], NULL) : 1;
+	if(scale <= 0) {
+		scale = 1;
+	}
+
+	size_t const numScenarios = sizeof(s_scenarios) / sizeof(s_scenarios[0]);
+	size_t selected = 0;
+	for(size_t i = 0; i < numScenarios; ++i) {
+		selected += Selected(name, s_scenarios[i]);
+	}
+	if(selected == 0) {
+		fprintf(stderr, "usage: export-bench [all|tiny|huge|logs|authors|ignores] [scale]\n");
+		return 1;
+	}
+
+	int fd = open("/dev/null", O_WRONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Could not open /dev/null: %s\n", strerror(errno));
+		return 1;
+	}
+
+	try {
+		SVNSimple::Init();
+		Output::Init();
+		Output* output = Output::Open(fd, 1 << 20, 16);
+		{
+			Output::Scope scope(output);
+			for(size_t i = 0; i < numScenarios; ++i) {
+				if(Selected(name, s_scenarios[i])) {
+					Run(s_scenarios[i], scale);
+				}
+			}
+		}
+		Output::Close(output);
+	} catch(std::exception const& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	close(fd);
+	SVNSimple::Shutdown();
+	return 0;
+}
@@ -1,5 +1,17 @@
 #include "FastExport.h"
+#include "Output.h"
+#include "Stats.h"
+#include "Trace.h"
 #include "Exception.h"
+#include "Hex.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
 
 extern "C" {
 #include <svn_types.h>
@@ -10,27 +22,114 @@ extern "C" {
 FastExport::FastExport(std::string const& commitRef, std::string const& parentSHA) :
 	m_commitRef(commitRef),
 	m_parentSHA(parentSHA),
-	m_lastRevisionCommitted(SVN_INVALID_REVNUM)
+	m_lastRevisionCommitted(SVN_INVALID_REVNUM),
+	m_nextMark(1),
+	m_revisionIndex(NULL),
+	m_layout(NULL)
 {
 }
 
 FastExport::~FastExport() { }
 
-void FastExport::DumpRevisions(SVNSimple& connection, std::vector<SVNSimple::Revision>& revisions)
+// Source paths are followed by another path, so need quoting if they
+// contain a space.
+static std::string QuotePath(std::string const& path)
+{
+	if(path.find_first_of(" \"\\") == std::string::npos) {
+		return path;
+	}
+
+	std::string quoted("\"");
+	for(std::string::const_iterator it = path.begin(); it != path.end(); ++it) {
+		if(*it == '"' || *it == '\\') {
+			quoted.push_back('\\');
+		}
+		quoted.push_back(*it);
+	}
+	quoted.push_back('"');
+	return quoted;
+}
+
+bool FastExport::HasContents(SVNSimple::Revision::File const& file)
+{
+	switch(file.m_action) {
+		case 'A':
+		case 'M':
+		case 'R':
+		case 'C':
+			return file.m_type == 'F';
+		default:
+			return false;
+	}
+}
+
+void FastExport::WriteBlob(Output::Transaction& out, FetchPool::Request const& request)
 {
+	out.Printf("data %llu" LF, request.m_contents.Size());
+	request.m_contents.WriteTo(out);
+	out.Printf(LF);
+
+	Stats::Count(Stats::Counter_Blobs);
+	Stats::Count(Stats::Counter_BlobBytes, request.m_contents.Size());
+}
+
+// Requests hold their contents, so are kept by pointer rather than copied.
+static void DeleteRequests(std::deque<FetchPool::Request*>& requests)
+{
+	for(std::deque<FetchPool::Request*>::iterator it = requests.begin(); it != requests.end(); ++it) {
+		delete *it;
+	}
+	requests.clear();
+}
+
+void FastExport::DumpRevisions(FetchPool& fetcher, std::vector<SVNSimple::Revision>& revisions)
+{
+	// Queue every file in the window up front so that the fetch pool can
+	// work ahead of the output; contents are still written in order.
+	std::deque<FetchPool::Request*> requests;
+	try {
+		for(std::vector<SVNSimple::Revision>::const_iterator rit = revisions.begin(); rit != revisions.end(); ++rit)
+		{
+			for(SVNSimple::Revision::Files::const_iterator fit = rit->m_files.begin(); fit != rit->m_files.end(); ++fit)
+			{
+				if(HasContents(*fit)) {
+					requests.push_back(NULL);
+					requests.back() = new FetchPool::Request(fit->m_relPath, rit->m_revision, fit->m_contentFile);
+					fetcher.Queue(requests.back());
+				} else if(fit->m_contentFile.size()) {
+					// Replayed text for a file which won't be written (e.g. ignored)
+					unlink(fit->m_contentFile.c_str());
+				}
+			}
+		}
+
+		WriteRevisions(fetcher, revisions, requests);
+	} catch(...) {
+		// Workers must not be left holding on to the requests.
+		fetcher.Drain();
+		DeleteRequests(requests);
+		throw;
+	}
+	DeleteRequests(requests);
+}
+
+void FastExport::WriteRevisions(FetchPool& fetcher, std::vector<SVNSimple::Revision> const& revisions, std::deque<FetchPool::Request*>& requests)
+{
+	std::deque<FetchPool::Request*>::iterator request = requests.begin();
 	for(std::vector<SVNSimple::Revision>::const_iterator rit = revisions.begin(); rit != revisions.end(); ++rit)
 	{
 		SVNSimple::Revision const& rev = *rit;
 
 		if(rev.m_files.size() == 0) {
-			printf("# Skipping revision %lu; no files in commit" LF, rev.m_revision);
+			Output::Printf("# Skipping revision %lu; no files in commit" LF, rev.m_revision);
 		} else {
-			printf("# ========== Start of revision %lu" LF, rev.m_revision);
-			printf("progress Getting file data for revision %lu" LF, rev.m_revision);
+			Output::Printf("# ========== Start of revision %lu" LF, rev.m_revision);
+			Output::Printf("progress Getting file data for revision %lu" LF, rev.m_revision);
 
-			unsigned long fileMark = rev.m_revision + 1;
+			std::vector<unsigned long> fileMarks(rev.m_files.size(), 0);
+			std::vector<unsigned long>::iterator fileMark = fileMarks.begin();
 			unsigned int numFiles = 0;
-			for(std::vector<SVNSimple::Revision::File>::const_iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit)
+			for(SVNSimple::Revision::Files::const_iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit)
 			{
 				SVNSimple::Revision::File const& file = *fit;
 				switch(file.m_action) {
@@ -39,11 +138,29 @@ void FastExport::DumpRevisions(SVNSimple& connection, std::vector<SVNSimple::Rev
 					case 'R':
 					case 'C': {
 						if(file.m_type == 'F') {
-							printf("# %c %s" LF, file.m_action, file.m_relPath.c_str());
-							printf("blob" LF);
-							printf("mark :%lu" LF, fileMark);
-							connection.CatFile(file.m_relPath.c_str(), rev.m_revision);
+							fetcher.Wait(*request);
+							unsigned long existing = m_blobMarks.Find((*request)->m_blobId);
+							if(existing) {
+								*fileMark = existing;
+								Output::Printf("# %c %s (same contents as :%lu)" LF, file.m_action, file.m_relPath.str().c_str(), *fileMark);
+							} else {
+								*fileMark = m_nextMark++;
+								m_blobMarks.Set((*request)->m_blobId, *fileMark);
 
+								// The replay stage may write from another thread;
+								// keep each blob in one piece.
+								Output::Transaction out;
+								out.Printf("# %c %s" LF, file.m_action, file.m_relPath.str().c_str());
+								out.Printf("blob" LF);
+								out.Printf("mark :%lu" LF, *fileMark);
+								WriteBlob(out, **request);
+							}
+							fetcher.Release(*request);
+							++request;
+
+							numFiles += 1;
+						}
+						if(file.m_copyTree || file.m_copyBranch) {
 							numFiles += 1;
 						}
 						break;
@@ -54,19 +171,19 @@ void FastExport::DumpRevisions(SVNSimple& connection, std::vector<SVNSimple::Rev
 					case 'I':
 						break;
 					default:
-						printf("# Unknown thing: %c %s" LF, file.m_action, file.m_relPath.c_str());
+						Output::Printf("# Unknown thing: %c %s" LF, file.m_action, file.m_relPath.str().c_str());
 				}
 
-				fileMark += 1;
+				++fileMark;
 			}
 
 			if(numFiles == 0) {
-				printf("# Skipping revision %lu; no files in commit" LF, rev.m_revision);
+				Output::Printf("# Skipping revision %lu; no files in commit" LF, rev.m_revision);
 			} else {
-				printf("progress Committing revision %lu" LF, rev.m_revision);
-				printf("# Dumped all file data, making commit for revision %lu" LF, rev.m_revision);
-				MakeCommit(rev);
-				printf("# ========== End of revision %lu" LF, rev.m_revision);
+				Output::Printf("progress Committing revision %lu" LF, rev.m_revision);
+				Output::Printf("# Dumped all file data, making commit for revision %lu" LF, rev.m_revision);
+				MakeCommits(rev, fileMarks);
+				Output::Printf("# ========== End of revision %lu" LF, rev.m_revision);
 
 				m_lastRevisionCommitted = rev.m_revision;
 			}
@@ -74,45 +191,237 @@ void FastExport::DumpRevisions(SVNSimple& connection, std::vector<SVNSimple::Rev
 	}
 }
 
-void FastExport::MakeCommit(SVNSimple::Revision const& rev)
+void FastExport::MakeCommits(SVNSimple::Revision const& rev, std::vector<unsigned long> const& fileMarks)
 {
-	printf("commit %s" LF, m_commitRef.c_str());
-	printf("mark :%lu" LF, rev.m_revision);
-	printf("committer %s %ld +0000" LF, rev.m_user.c_str(), rev.m_date);
-	printf("data %lu" LF, rev.m_log.size());
+	if(m_layout == NULL) {
+		std::string from;
+		if(m_lastRevisionCommitted == SVN_INVALID_REVNUM) {
+			from = m_parentSHA;
+		}
+		MakeCommit(rev, fileMarks, m_commitRef, "", from, false);
+	} else {
+		// A commit for each branch or tag changed, in the order they were
+		// first changed in.
+		std::vector<std::string> roots;
+		for(SVNSimple::Revision::Files::const_iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit) {
+			std::string root, path;
+			if(!m_layout->Split(fit->m_relPath.str(), root, path)) {
+				if(fit->m_action != 'I') {
+					Output::Printf("# %c %s is in no branch or tag" LF, fit->m_action, fit->m_relPath.str().c_str());
+				}
+			} else if(std::find(roots.begin(), roots.end(), root) == roots.end()) {
+				roots.push_back(root);
+			}
+		}
+
+		// Copies are from branches as they were before this revision.
+		BranchTips previous(m_branchTips);
+		for(std::vector<std::string>::const_iterator it = roots.begin(); it != roots.end(); ++it) {
+			std::string const& root = *it;
+			std::string ref = m_layout->Ref(root);
+
+			std::string from;
+			bool copied = false;
+			bool changed = false;
+			// The root itself deleted, replaced or added other than by a
+			// branch copy; whatever the ref held before is gone.
+			bool deleteAll = false;
+			bool deleted = false;
+			for(SVNSimple::Revision::Files::const_iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit) {
+				std::string path;
+				if(!BranchPath(fit->m_relPath, root, path)) {
+					continue;
+				}
+				if(path.empty() && !fit->m_copyBranch && (fit->m_action == 'D' || fit->m_action == 'R' || fit->m_action == 'A')) {
+					deleteAll = true;
+					deleted = fit->m_action == 'D';
+					// A replaced root may be left empty.
+					changed = changed || fit->m_action == 'R';
+				}
+				if(fit->m_copyBranch && path.empty()) {
+					std::string fromRoot(fit->m_copyFromPath.str());
+					BranchTips::const_iterator tip = previous.find(fromRoot);
+					if(tip != previous.end()) {
+						from = tip->second;
+					} else if(m_parentSHA.size()) {
+						// The source ref is still as the last run left it.
+						from = m_layout->Ref(fromRoot) + "^0";
+					} else {
+						throw EXCEPTION(("%s is copied from %s, which has not been written", root.c_str(), fromRoot.c_str()));
+					}
+					copied = true;
+				} else if(path.size() && (fit->m_type == 'F' || fit->m_action == 'D' || fit->m_copyTree)) {
+					changed = true;
+				}
+			}
+
+			if(copied && !changed && m_layout->IsTag(root)) {
+				Output::Transaction out;
+				out.Printf("reset %s" LF, ref.c_str());
+				out.Printf("from %s" LF, from.c_str());
+				out.Printf(LF);
+				m_branchTips[root] = from;
+				continue;
+			}
+			if(deleted) {
+				// Anything added back later starts afresh.
+				m_branchTips.erase(root);
+			}
+			if(!copied && !changed) {
+				// Deleting a branch or tag leaves its ref as it was.
+				Output::Printf("# Nothing to commit to %s" LF, ref.c_str());
+				continue;
+			}
+			if(!copied && m_parentSHA.size() && m_branchTips.find(root) == m_branchTips.end()
+				&& std::find(rev.m_newBranches.begin(), rev.m_newBranches.end(), root) == rev.m_newBranches.end()) {
+				// The first commit to a branch from an earlier run.  Without
+				// one, it starts unparented like the commit ref does.
+				from = ref + "^0";
+			}
+
+			unsigned long commitMark = MakeCommit(rev, fileMarks, ref, root, from, deleteAll);
+			std::ostringstream mark;
+			mark << ':' << commitMark;
+			m_branchTips[root] = mark.str();
+		}
+	}
+}
+
+bool FastExport::BranchPath(Path const& relPath, std::string const& root, std::string& path) const
+{
+	if(m_layout == NULL) {
+		path = relPath.str();
+		return true;
+	}
+
+	std::string fileRoot;
+	return m_layout->Split(relPath.str(), fileRoot, path) && fileRoot == root;
+}
+
+unsigned long FastExport::MakeCommit(SVNSimple::Revision const& rev, std::vector<unsigned long> const& fileMarks, std::string const& ref, std::string const& root, std::string const& from, bool deleteAll)
+{
+	Trace::Span span("MakeCommit");
+	span.Arg("revision", rev.m_revision);
+	span.Arg("ref", ref);
+	Output::Transaction out;
+	out.Printf("commit %s" LF, ref.c_str());
+	unsigned long commitMark = m_nextMark++;
+	out.Printf("mark :%lu" LF, commitMark);
+	out.Printf("committer %s %ld +0000" LF, rev.m_user.c_str(), rev.m_date);
+	out.Printf("data %lu" LF, rev.m_log.size());
 	if(rev.m_log.size()) {
-		fwrite(rev.m_log.c_str(), 1, rev.m_log.size(), stdout);
+		out.Write(rev.m_log.c_str(), rev.m_log.size());
 	}
-	if(m_lastRevisionCommitted == SVN_INVALID_REVNUM && m_parentSHA.size()) {
-		printf("from %s" LF, m_parentSHA.c_str());
+	if(from.size()) {
+		out.Printf("from %s" LF, from.c_str());
+	}
+	if(deleteAll) {
+		out.Printf("deleteall" LF);
 	}
 
-	unsigned long fileMark = rev.m_revision + 1;
-	for(std::vector<SVNSimple::Revision::File>::const_iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit)
+	// Copy trees before anything else so the source is still as it was in
+	// the previous revision.
+	std::string path;
+	for(SVNSimple::Revision::Files::const_iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit)
 	{
 		SVNSimple::Revision::File const& file = *fit;
-		if(file.m_type == 'F' || file.m_action == 'D') {
+		if(file.m_copyTree && (file.m_action == 'C' || file.m_action == 'R') && BranchPath(file.m_relPath, root, path)) {
+			std::string fromPath;
+			BranchPath(file.m_copyFromPath, root, fromPath);
+			if(file.m_action == 'R') {
+				out.Printf("D %s" LF, path.c_str());
+			}
+			out.Printf("C %s %s" LF, QuotePath(fromPath).c_str(), path.c_str());
+		}
+	}
+
+	std::vector<unsigned long>::const_iterator fileMark = fileMarks.begin();
+	for(SVNSimple::Revision::Files::const_iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit)
+	{
+		SVNSimple::Revision::File const& file = *fit;
+		// The root of a branch is only ever copied or deleted whole.
+		if((file.m_type == 'F' || file.m_action == 'D') && BranchPath(file.m_relPath, root, path) && (m_layout == NULL || path.size())) {
 			switch(file.m_action)
 			{
 				case 'M':
 				case 'A':
 				case 'C':
-					printf("M 644 :%lu %s" LF, fileMark, file.m_relPath.c_str());
+					out.Printf("M 644 :%lu %s" LF, *fileMark, path.c_str());
 					break;
 				case 'D':
-					printf("D %s" LF, file.m_relPath.c_str());
+					out.Printf("D %s" LF, path.c_str());
 					break;
 				case 'R':
-					printf("D %s" LF, file.m_relPath.c_str());
-					printf("M 100644 :%lu %s" LF, fileMark, file.m_relPath.c_str());
+					out.Printf("D %s" LF, path.c_str());
+					out.Printf("M 100644 :%lu %s" LF, *fileMark, path.c_str());
 					break;
 				default:
 					break;
 			}
 		}
 
-		fileMark += 1;
+		++fileMark;
+	}
+
+	out.Printf(LF);
+
+	if(m_revisionIndex) {
+		m_revisionIndex->Append(rev.m_revision, commitMark);
+	}
+	return commitMark;
+}
+
+void FastExport::ImportMarks(std::string const& fileName, RevisionIndex const* commits)
+{
+	FILE* f = fopen(fileName.c_str(), "r");
+	if(f == NULL) {
+		if(errno == ENOENT) {
+			return;
+		}
+		throw EXCEPTION(("Could not read marks %s: %s", fileName.c_str(), strerror(errno)));
+	}
+
+	char line[128];
+	std::string id;
+	while(fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		char* end;
+		unsigned long mark = strtoul(line + 1, &end, 10);
+		if(line[0] != ':' || *end != ' ' || !FromHex(end + 1, id)) {
+			continue;
+		}
+
+		if(commits && commits->HasMark(mark)) {
+			m_commitMarks[mark] = id;
+		} else if(id.size() == BLOB_ID_SIZE) {
+			m_blobMarks.Set(id, mark);
+		}
+		if(mark >= m_nextMark) {
+			m_nextMark = mark + 1;
+		}
+	}
+
+	fclose(f);
+}
+
+bool FastExport::GetMarkId(unsigned long mark, std::string& id) const
+{
+	CommitMarks::const_iterator it = m_commitMarks.find(mark);
+	if(it == m_commitMarks.end()) {
+		return false;
+	}
+	id = ToHex(it->second);
+	return true;
+}
+
+void FastExport::Checkpoint(svn_revnum_t revision)
+{
+	if(m_revisionIndex) {
+		m_revisionIndex->Sync();
 	}
 
-	printf(LF);
+	Output::Transaction out;
+	out.Printf("checkpoint" LF);
+	out.Printf(LF);
+	out.Printf("progress Checkpoint after revision %lu" LF, revision);
 }
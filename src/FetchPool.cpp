@@ -0,0 +1,193 @@
+#include "FetchPool.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Exception.h"
+
+#include <unistd.h>
+
+// How many fetched-but-unwritten files each worker may hold in memory.
+#define BUFFERED_PER_WORKER (4)
+
+FetchPool::Worker::Worker(FetchPool& pool, std::string const& url, std::string const& username, std::string const& password) :
+	m_pool(pool),
+	m_connection(url, username, password),
+	m_stats(Stats::Current())
+{
+}
+
+FetchPool::Worker::~Worker() { }
+
+void FetchPool::Worker::Run()
+{
+	Stats::Scope scope(m_stats);
+	Trace::NameThread("Fetch");
+	Request* request;
+	while((request = m_pool.NextRequest())) {
+		m_pool.Fetch(m_connection, request);
+	}
+}
+
+FetchPool::FetchPool(SVNSimple& connection, std::string const& url, std::string const& username, std::string const& password, unsigned int numWorkers) :
+	m_connection(connection),
+	m_baseTexts(NULL),
+	m_blobCache(NULL),
+	m_queued(m_mutex),
+	m_fetched(m_mutex),
+	m_fetching(0),
+	m_buffered(0),
+	m_maxBuffered(numWorkers * BUFFERED_PER_WORKER),
+	m_stopping(false)
+{
+	// Sessions are opened here, one after the other, rather than by the
+	// workers themselves as the RA layer loads its modules lazily.
+	try {
+		m_workers.reserve(numWorkers);
+		for(unsigned int i = 0; i < numWorkers; i += 1) {
+			m_workers.push_back(new Worker(*this, url, username, password));
+		}
+		for(std::vector<Worker*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+			(*it)->Start();
+		}
+	} catch(...) {
+		// The destructor won't run; those created, and any started, must
+		// not outlive the pool.
+		Stop();
+		throw;
+	}
+}
+
+FetchPool::~FetchPool()
+{
+	Stop();
+}
+
+void FetchPool::Stop()
+{
+	{
+		ScopedLock lock(m_mutex);
+		m_stopping = true;
+		m_queued.Broadcast();
+	}
+
+	for(std::vector<Worker*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+		(*it)->Join();
+		delete *it;
+	}
+	m_workers.clear();
+}
+
+void FetchPool::SetRecorder(Recorder* recorder)
+{
+	ScopedLock lock(m_mutex);
+	for(std::vector<Worker*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+		(*it)->SetRecorder(recorder);
+	}
+}
+
+void FetchPool::Queue(Request* request)
+{
+	ScopedLock lock(m_mutex);
+	request->m_state = Request::Queued;
+	m_queue.push_back(request);
+	m_queued.Signal();
+}
+
+FetchPool::Request* FetchPool::NextRequest()
+{
+	ScopedLock lock(m_mutex);
+	while(!m_stopping && (m_queue.empty() || m_buffered >= m_maxBuffered)) {
+		m_queued.Wait();
+	}
+	if(m_stopping) {
+		return NULL;
+	}
+
+	Request* request = m_queue.front();
+	m_queue.pop_front();
+	request->m_state = Request::Fetching;
+	m_fetching += 1;
+	m_buffered += 1;
+	return request;
+}
+
+void FetchPool::Fetch(SVNSimple& connection, Request* request)
+{
+	std::string error;
+	try {
+		if(request->m_contentFile.size()) {
+			request->m_contents.Adopt(request->m_contentFile);
+			request->m_blobId = request->m_contents.BlobId();
+		} else {
+			std::string relPath(request->m_relPath.str());
+			if(m_blobCache == NULL || !m_blobCache->Find(request->m_relPath, request->m_revision, request->m_contents, request->m_blobId)) {
+				connection.GetFile(relPath.c_str(), request->m_revision, request->m_contents);
+				request->m_blobId = request->m_contents.BlobId();
+				if(m_blobCache) {
+					m_blobCache->Save(request->m_relPath, request->m_revision, request->m_contents, request->m_blobId);
+				}
+			}
+			if(m_baseTexts) {
+				m_baseTexts->Save(relPath, request->m_revision, request->m_contents);
+			}
+		}
+	} catch(std::exception const& e) {
+		error = e.what();
+	}
+
+	ScopedLock lock(m_mutex);
+	request->m_error.swap(error);
+	request->m_state = Request::Done;
+	m_fetching -= 1;
+	m_fetched.Broadcast();
+}
+
+void FetchPool::Wait(Request* request)
+{
+	if(m_workers.empty()) {
+		{
+			ScopedLock lock(m_mutex);
+			// Requests are always waited on in queue order.
+			m_queue.pop_front();
+			m_fetching += 1;
+		}
+		Fetch(m_connection, request);
+	}
+
+	ScopedLock lock(m_mutex);
+	while(request->m_state != Request::Done) {
+		m_fetched.Wait();
+	}
+
+	if(request->m_error.size()) {
+		throw EXCEPTION(("Could not fetch %s at revision %lu: %s", request->m_relPath.str().c_str(), request->m_revision, request->m_error.c_str()));
+	}
+}
+
+void FetchPool::Release(Request* request)
+{
+	request->m_contents.Clear();
+
+	if(m_workers.size()) {
+		ScopedLock lock(m_mutex);
+		m_buffered -= 1;
+		m_queued.Signal();
+	}
+}
+
+void FetchPool::Drain()
+{
+	ScopedLock lock(m_mutex);
+	// Fetched contents delete their file when freed; nothing else will
+	// take the files of those never fetched.
+	for(std::deque<Request*>::const_iterator it = m_queue.begin(); it != m_queue.end(); ++it) {
+		if((*it)->m_contentFile.size()) {
+			unlink((*it)->m_contentFile.c_str());
+		}
+	}
+	m_queue.clear();
+	while(m_fetching) {
+		m_fetched.Wait();
+	}
+	m_buffered = 0;
+	m_queued.Broadcast();
+}
@@ -0,0 +1,308 @@
+#include "FileContents.h"
+#include "Exception.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+extern "C" {
+#include <apr_sha1.h>
+#include <svn_io.h>
+#include <svn_pools.h>
+#include <svn_checksum.h>
+}
+
+// Files larger than this are spooled to disk.  The fetch pool holds a few
+// files per worker, so this bounds its memory use.
+#define MEMORY_LIMIT (8 << 20)
+
+std::string FileContents::s_directory;
+
+FileContents::FileContents() :
+	m_fd(-1),
+	m_map(NULL),
+	m_borrowed(NULL),
+	m_size(0)
+{
+}
+
+FileContents::~FileContents()
+{
+	Clear();
+}
+
+void FileContents::SetSpoolDirectory(std::string const& directory)
+{
+	s_directory = directory;
+}
+
+void FileContents::Spool()
+{
+	std::string directory(s_directory);
+	if(directory.empty()) {
+		char const* tmp = getenv("TMPDIR");
+		directory = (tmp && *tmp)? tmp : "/tmp";
+	}
+
+	std::string name(directory + "/svnescape.XXXXXX");
+	std::vector<char> temp(name.begin(), name.end());
+	temp.push_back('\0');
+	m_fd = mkstemp(&temp[0]);
+	if(m_fd < 0) {
+		throw EXCEPTION(("Could not create spool file in %s: %s", directory.c_str(), strerror(errno)));
+	}
+	m_fileName = &temp[0];
+
+	std::string data;
+	data.swap(m_data);
+	m_size = 0;
+	Append(data.data(), data.size());
+}
+
+void FileContents::Append(char const* data, size_t length)
+{
+	if(m_fileName.size() && m_fd < 0) {
+		throw EXCEPTION(("Cannot append to mapped file %s", m_fileName.c_str()));
+	}
+	if(m_borrowed) {
+		throw EXCEPTION(("Cannot append to borrowed contents"));
+	}
+	if(m_fd < 0 && m_data.size() + length > MEMORY_LIMIT) {
+		Spool();
+	}
+
+	if(m_fd < 0) {
+		m_data.append(data, length);
+		m_size += length;
+		return;
+	}
+
+	while(length) {
+		ssize_t written = write(m_fd, data, length);
+		if(written < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			throw EXCEPTION(("Could not write spool file %s: %s", m_fileName.c_str(), strerror(errno)));
+		}
+		data += written;
+		length -= written;
+		m_size += written;
+	}
+}
+
+static svn_error_t* AppendToContents(void* baton, char const* data, apr_size_t* len)
+{
+	try {
+		static_cast<FileContents*>(baton)->Append(data, *len);
+	} catch(std::exception const& e) {
+		return svn_error_create(APR_EGENERAL, NULL, e.what());
+	}
+	return SVN_NO_ERROR;
+}
+
+svn_stream_t* FileContents::Stream(apr_pool_t* pool)
+{
+	svn_stream_t* stream = svn_stream_create(this, pool);
+	svn_stream_set_write(stream, &AppendToContents);
+	return stream;
+}
+
+void FileContents::Adopt(std::string const& fileName)
+{
+	Clear();
+
+	m_fd = open(fileName.c_str(), O_RDONLY);
+	if(m_fd < 0) {
+		throw EXCEPTION(("Could not open %s: %s", fileName.c_str(), strerror(errno)));
+	}
+	m_fileName = fileName;
+
+	struct stat st;
+	if(fstat(m_fd, &st)) {
+		throw EXCEPTION(("Could not stat %s: %s", fileName.c_str(), strerror(errno)));
+	}
+	m_size = st.st_size;
+}
+
+void FileContents::Map(std::string const& fileName)
+{
+	Clear();
+
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if(fd < 0) {
+		throw EXCEPTION(("Could not open %s: %s", fileName.c_str(), strerror(errno)));
+	}
+
+	struct stat st;
+	if(fstat(fd, &st)) {
+		close(fd);
+		throw EXCEPTION(("Could not stat %s: %s", fileName.c_str(), strerror(errno)));
+	}
+
+	// Empty files can't be mapped, but have nothing to read anyway.
+	if(st.st_size) {
+		void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(map == MAP_FAILED) {
+			close(fd);
+			throw EXCEPTION(("Could not map %s: %s", fileName.c_str(), strerror(errno)));
+		}
+		m_map = map;
+	}
+	close(fd);
+
+	m_fileName = fileName;
+	m_size = st.st_size;
+}
+
+void FileContents::Borrow(char const* data, size_t length)
+{
+	Clear();
+	m_borrowed = data;
+	m_size = length;
+}
+
+void FileContents::Clear()
+{
+	if(m_fd >= 0) {
+		close(m_fd);
+		unlink(m_fileName.c_str());
+		m_fd = -1;
+	}
+	if(m_map) {
+		munmap(m_map, m_size);
+		m_map = NULL;
+	}
+	m_borrowed = NULL;
+	m_fileName.clear();
+	std::string().swap(m_data);
+	m_size = 0;
+}
+
+void FileContents::ReadAll(void (*consume)(void* baton, char const* data, size_t length), void* baton) const
+{
+	if(m_map) {
+		consume(baton, static_cast<char const*>(m_map), m_size);
+		return;
+	}
+	if(m_borrowed) {
+		consume(baton, m_borrowed, m_size);
+		return;
+	}
+	if(m_fd < 0) {
+		consume(baton, m_data.data(), m_data.size());
+		return;
+	}
+
+	char buf[65536];
+	off_t offset = 0;
+	while(static_cast<unsigned long long>(offset) < m_size) {
+		ssize_t len = pread(m_fd, buf, sizeof(buf), offset);
+		if(len < 0 && errno == EINTR) {
+			continue;
+		}
+		if(len <= 0) {
+			throw EXCEPTION(("Could not read spool file %s: %s", m_fileName.c_str(), len? strerror(errno) : "file is truncated"));
+		}
+		consume(baton, buf, len);
+		offset += len;
+	}
+}
+
+static void UpdateChecksumThunk(void* baton, char const* data, size_t length)
+{
+	svn_error_t* err;
+	if((err = svn_checksum_update(static_cast<svn_checksum_ctx_t*>(baton), data, length))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+}
+
+void FileContents::UpdateChecksum(svn_checksum_ctx_t* ctx) const
+{
+	ReadAll(&UpdateChecksumThunk, ctx);
+}
+
+std::string FileContents::BlobId() const
+{
+	apr_pool_t* pool = svn_pool_create(NULL);
+	svn_checksum_ctx_t* ctx = svn_checksum_ctx_create(svn_checksum_sha1, pool);
+	svn_checksum_t* checksum;
+	svn_error_t* err;
+
+	char header[32];
+	int headerLen = snprintf(header, sizeof(header), "blob %llu", m_size) + 1;
+	if((err = svn_checksum_update(ctx, header, headerLen))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	UpdateChecksum(ctx);
+	if((err = svn_checksum_final(&checksum, ctx, pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+
+	std::string id(reinterpret_cast<char const*>(checksum->digest), APR_SHA1_DIGESTSIZE);
+	svn_pool_destroy(pool);
+	return id;
+}
+
+static void WriteThunk(void* baton, char const* data, size_t length)
+{
+	static_cast<Output::Transaction*>(baton)->Write(data, length);
+}
+
+void FileContents::WriteTo(Output::Transaction& out) const
+{
+	ReadAll(&WriteThunk, &out);
+}
+
+static void WriteStdioThunk(void* baton, char const* data, size_t length)
+{
+	fwrite(data, 1, length, static_cast<FILE*>(baton));
+}
+
+void FileContents::WriteTo(FILE* file) const
+{
+	ReadAll(&WriteStdioThunk, file);
+}
+
+static void WriteFileThunk(void* baton, char const* data, size_t length)
+{
+	int fd = *static_cast<int*>(baton);
+	while(length) {
+		ssize_t written = write(fd, data, length);
+		if(written < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			throw EXCEPTION(("Could not write file: %s", strerror(errno)));
+		}
+		data += written;
+		length -= written;
+	}
+}
+
+void FileContents::WriteToFile(std::string const& fileName) const
+{
+	unlink(fileName.c_str());
+	if(m_fileName.size() && link(m_fileName.c_str(), fileName.c_str()) == 0) {
+		return;
+	}
+
+	int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(fd < 0) {
+		throw EXCEPTION(("Could not create %s: %s", fileName.c_str(), strerror(errno)));
+	}
+	try {
+		ReadAll(&WriteFileThunk, &fd);
+	} catch(...) {
+		close(fd);
+		unlink(fileName.c_str());
+		throw;
+	}
+	close(fd);
+}
@@ -0,0 +1,52 @@
+#include "Filters.h"
+#include "IgnoreRules.h"
+#include "Output.h"
+
+#include <sstream>
+
+#define LF "\x0A"
+
+void FilterIgnoredFiles(SVNSimple::Revision& rev, IgnoreRules const& ignoreRules)
+{
+	char const* pattern;
+	for(SVNSimple::Revision::Files::iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit) {
+		SVNSimple::Revision::File& file = *fit;
+		pattern = ignoreRules.Match(file.m_relPath.str());
+		if(pattern) {
+			file.m_action = 'I';
+			Output::Printf("# %lu > %c %s - Ignored by ignore pattern %s" LF, rev.m_revision, file.m_action, file.m_relPath.str().c_str(), pattern);
+		}
+	}
+}
+
+void AddSVNSourceTag(SVNSimple::Revision& rev, std::string const& repoName)
+{
+	std::ostringstream ss;
+	ss << rev.m_log;
+	ss << "\n\nsvn-source: " << repoName << "@";
+	ss << rev.m_revision;
+
+	rev.m_log = ss.str();
+}
+
+void RewriteCommitters(SVNSimple::Revision& rev, UserMap const& users, std::string const& prefix)
+{
+	if(rev.m_user.size()) {
+		if(prefix.size() && rev.m_user.size() >= prefix.size()) {
+			if(rev.m_user.compare(0, prefix.size(), prefix) == 0)
+			{
+				rev.m_user = rev.m_user.substr(prefix.size());
+			}
+		}
+		UserMap::const_iterator it = users.find(rev.m_user);
+		if(it == users.end()) {
+			std::ostringstream ss;
+			ss << rev.m_user << " <" << rev.m_user << "@localhost>";
+			rev.m_user = ss.str();
+		} else {
+			rev.m_user = it->second;
+		}
+	} else {
+		rev.m_user = "Unknown <Unknown@localhost>";
+	}
+}
@@ -0,0 +1,269 @@
+#include "IgnoreRules.h"
+
+#include <string.h>
+#include <fnmatch.h>
+
+#define WILDCARDS "*?[\\"
+
+// The position of the ']' closing the bracket expression opened at start,
+// or npos if there is none and the '[' is an ordinary character.
+static std::string::size_type BracketEnd(std::string const& pattern, std::string::size_type start)
+{
+	std::string::size_type i = start + 1;
+	if(i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^')) {
+		++i;
+	}
+	// A ']' straight after the '[' is part of the set.
+	if(i < pattern.size() && pattern[i] == ']') {
+		++i;
+	}
+	while(i < pattern.size()) {
+		if(pattern[i] == '[' && i + 1 < pattern.size() && strchr(":.=", pattern[i + 1])) {
+			// [:class:], [.symbol.] and [=equivalent=] may hold a ']'.
+			char const close[] = { pattern[i + 1], ']', '\0' };
+			std::string::size_type end = pattern.find(close, i + 2);
+			if(end == std::string::npos) {
+				return std::string::npos;
+			}
+			i = end + 2;
+		} else if(pattern[i] == ']') {
+			return i;
+		} else {
+			i += (pattern[i] == '\\' && i + 1 < pattern.size())? 2 : 1;
+		}
+	}
+	return std::string::npos;
+}
+
+IgnoreRules::IgnoreRules() :
+	m_prefixes(1),
+	m_suffixes(1),
+	m_heads(1)
+{
+}
+
+void IgnoreRules::Compile(std::string const& pattern, std::vector<Element>& elements)
+{
+	for(std::string::size_type i = 0; i < pattern.size(); ++i) {
+		Element element;
+		element.m_kind = 'c';
+		element.m_char = pattern[i];
+		switch(pattern[i]) {
+			case '*':
+				if(elements.size() && elements.back().m_kind == '*') {
+					continue;
+				}
+				element.m_kind = '*';
+				break;
+			case '?':
+				element.m_kind = '?';
+				break;
+			case '\\':
+				if(i + 1 < pattern.size()) {
+					element.m_char = pattern[++i];
+				}
+				break;
+			case '[': {
+				// Brackets are rare enough to leave to fnmatch, a character
+				// at a time.
+				std::string::size_type end = BracketEnd(pattern, i);
+				if(end != std::string::npos) {
+					element.m_kind = '[';
+					element.m_bracket = pattern.substr(i, end - i + 1);
+					i = end;
+				}
+				break;
+			}
+		}
+		elements.push_back(element);
+	}
+}
+
+// Matches s against elements from first on, as fnmatch with no flags does.
+// A '*' matches anything, so only the last one need ever be backtracked to.
+bool IgnoreRules::Glob(std::vector<Element> const& elements, size_t first, char const* s, char const* end)
+{
+	size_t e = first;
+	size_t starElement = elements.size();
+	char const* starPosition = NULL;
+	while(s < end) {
+		if(e < elements.size()) {
+			Element const& element = elements[e];
+			if(element.m_kind == '*') {
+				starElement = ++e;
+				starPosition = s;
+				continue;
+			}
+
+			bool matched;
+			if(element.m_kind == '[') {
+				char const c[] = { *s, '\0' };
+				matched = fnmatch(element.m_bracket.c_str(), c, 0) == 0;
+			} else {
+				matched = element.m_kind == '?' || element.m_char == *s;
+			}
+			if(matched) {
+				++e;
+				++s;
+				continue;
+			}
+		}
+		if(starPosition == NULL) {
+			return false;
+		}
+		e = starElement;
+		s = ++starPosition;
+	}
+
+	while(e < elements.size() && elements[e].m_kind == '*') {
+		++e;
+	}
+	return e == elements.size();
+}
+
+void IgnoreRules::Insert(std::vector<TrieNode>& trie, std::string const& key, size_t pattern)
+{
+	size_t node = 0;
+	for(std::string::size_type i = 0; i < key.size(); ++i) {
+		std::map<char, size_t>::const_iterator it = trie[node].m_children.find(key[i]);
+		if(it != trie[node].m_children.end()) {
+			node = it->second;
+		} else {
+			trie[node].m_children[key[i]] = trie.size();
+			node = trie.size();
+			trie.push_back(TrieNode());
+		}
+	}
+	trie[node].m_patterns.push_back(pattern);
+}
+
+void IgnoreRules::Add(std::string const& pattern)
+{
+	Pattern p;
+	p.m_pattern = pattern;
+	p.m_prefix = pattern.substr(0, pattern.find_first_of(WILDCARDS));
+	p.m_suffixOnly = pattern.size() > 1 && pattern[0] == '*'
+		&& pattern.find_first_of(WILDCARDS "/", 1) == std::string::npos;
+	Compile(pattern, p.m_elements);
+	bool allUnder = p.m_elements.size() && p.m_elements.back().m_kind == '*';
+	if(allUnder) {
+		p.m_head.assign(p.m_elements.begin(), p.m_elements.end() - 1);
+	}
+	m_patterns.push_back(p);
+
+	if(allUnder) {
+		Insert(m_heads, p.m_prefix, m_patterns.size() - 1);
+	}
+
+	// Patterns starting with a wildcard are found by the literal characters
+	// they end with instead, if there are any.
+	std::string tail;
+	for(std::vector<Element>::const_reverse_iterator it = p.m_elements.rbegin(); p.m_prefix.empty() && it != p.m_elements.rend() && it->m_kind == 'c'; ++it) {
+		tail.push_back(it->m_char);
+	}
+	if(tail.size()) {
+		Insert(m_suffixes, tail, m_patterns.size() - 1);
+	} else {
+		Insert(m_prefixes, p.m_prefix, m_patterns.size() - 1);
+	}
+}
+
+char const* IgnoreRules::Match(std::string const& path) const
+{
+	// The first pattern added which matches, as if each were tried in turn.
+	size_t best = m_patterns.size();
+	char const* end = path.data() + path.size();
+
+	size_t node = 0;
+	for(std::string::size_type i = 0; ; ++i) {
+		std::vector<size_t> const& patterns = m_prefixes[node].m_patterns;
+		for(std::vector<size_t>::const_iterator it = patterns.begin(); it != patterns.end() && *it < best; ++it) {
+			if(Glob(m_patterns[*it].m_elements, i, path.data() + i, end)) {
+				best = *it;
+				break;
+			}
+		}
+
+		if(i == path.size()) {
+			break;
+		}
+		std::map<char, size_t>::const_iterator child = m_prefixes[node].m_children.find(path[i]);
+		if(child == m_prefixes[node].m_children.end()) {
+			break;
+		}
+		node = child->second;
+	}
+
+	node = 0;
+	for(std::string::size_type i = path.size(); i > 0; --i) {
+		std::map<char, size_t>::const_iterator child = m_suffixes[node].m_children.find(path[i - 1]);
+		if(child == m_suffixes[node].m_children.end()) {
+			break;
+		}
+		node = child->second;
+
+		std::vector<size_t> const& patterns = m_suffixes[node].m_patterns;
+		for(std::vector<size_t>::const_iterator it = patterns.begin(); it != patterns.end() && *it < best; ++it) {
+			Pattern const& pattern = m_patterns[*it];
+			if(pattern.m_suffixOnly || Glob(pattern.m_elements, 0, path.data(), end)) {
+				best = *it;
+				break;
+			}
+		}
+	}
+
+	return best < m_patterns.size()? m_patterns[best].m_pattern.c_str() : NULL;
+}
+
+bool IgnoreRules::MayAffect(std::string const& dir) const
+{
+	for(std::vector<Pattern>::const_iterator pit = m_patterns.begin(); pit != m_patterns.end(); ++pit) {
+		if(pit->m_suffixOnly) {
+			// Matches the same files wherever they are; only matters if it
+			// matches the directory itself.
+			if(fnmatch(pit->m_pattern.c_str(), dir.c_str(), 0) == 0) {
+				return true;
+			}
+		} else if(pit->m_prefix.empty()) {
+			return true;
+		} else if(dir.compare(0, pit->m_prefix.size(), pit->m_prefix) == 0
+			|| pit->m_prefix.compare(0, dir.size(), dir) == 0
+		) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool IgnoreRules::IgnoresAllUnder(std::string const& dir) const
+{
+	// A pattern "<head>*" matches everything under dir if <head> matches
+	// the start of "dir/".
+	std::string under(dir.empty()? dir : dir + "/");
+	size_t node = 0;
+	for(std::string::size_type i = 0; ; ++i) {
+		// Every pattern here has a prefix of i characters, which under
+		// starts with.
+		std::vector<size_t> const& patterns = m_heads[node].m_patterns;
+		for(std::vector<size_t>::const_iterator it = patterns.begin(); it != patterns.end(); ++it) {
+			std::vector<Element> const& head = m_patterns[*it].m_head;
+			for(std::string::size_type length = i; length <= under.size(); ++length) {
+				if(Glob(head, i, under.data() + i, under.data() + length)) {
+					return true;
+				}
+			}
+		}
+
+		if(i == under.size()) {
+			break;
+		}
+		std::map<char, size_t>::const_iterator child = m_heads[node].m_children.find(under[i]);
+		if(child == m_heads[node].m_children.end()) {
+			break;
+		}
+		node = child->second;
+	}
+
+	return false;
+}
@@ -0,0 +1,71 @@
+#include "Layout.h"
+
+Layout::Layout(std::string const& trunk, std::string const& branches, std::string const& tags, std::string const& refPrefix) :
+	m_trunk(trunk),
+	m_branches(branches),
+	m_tags(tags),
+	m_refPrefix(refPrefix)
+{
+}
+
+// Matches relPath against dir/name/...
+bool Layout::SplitUnder(std::string const& dir, std::string const& relPath, std::string& root, std::string& path)
+{
+	if(dir.empty() || relPath.size() <= dir.size() + 1
+		|| relPath.compare(0, dir.size(), dir) || relPath[dir.size()] != '/') {
+		return false;
+	}
+
+	std::string::size_type end = relPath.find('/', dir.size() + 1);
+	if(end == std::string::npos) {
+		root = relPath;
+		path.clear();
+	} else {
+		root = relPath.substr(0, end);
+		path = relPath.substr(end + 1);
+	}
+	return true;
+}
+
+bool Layout::Split(std::string const& relPath, std::string& root, std::string& path) const
+{
+	if(m_trunk.size() && relPath.compare(0, m_trunk.size(), m_trunk) == 0) {
+		if(relPath.size() == m_trunk.size()) {
+			root = m_trunk;
+			path.clear();
+			return true;
+		}
+		if(relPath[m_trunk.size()] == '/') {
+			root = m_trunk;
+			path = relPath.substr(m_trunk.size() + 1);
+			return true;
+		}
+	}
+
+	return SplitUnder(m_branches, relPath, root, path) || SplitUnder(m_tags, relPath, root, path);
+}
+
+bool Layout::IsRoot(std::string const& relPath) const
+{
+	std::string root;
+	std::string path;
+	return Split(relPath, root, path) && path.empty();
+}
+
+bool Layout::IsTag(std::string const& root) const
+{
+	return m_tags.size() && root.size() > m_tags.size()
+		&& root.compare(0, m_tags.size(), m_tags) == 0 && root[m_tags.size()] == '/';
+}
+
+std::string Layout::Ref(std::string const& root) const
+{
+	if(root == m_trunk) {
+		return m_refPrefix + "/trunk";
+	}
+	// The name is everything after the branches or tags directory.
+	if(IsTag(root)) {
+		return "refs/tags/" + root.substr(m_tags.size() + 1);
+	}
+	return m_refPrefix + "/" + root.substr(m_branches.size() + 1);
+}
@@ -0,0 +1,368 @@
+#include "Output.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Exception.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/uio.h>
+
+extern "C" {
+#include <apr_thread_proc.h>
+#include <svn_io.h>
+#include <svn_pools.h>
+}
+
+#ifndef IOV_MAX
+#define IOV_MAX (1024)
+#endif
+
+apr_pool_t* Output::s_pool = NULL;
+apr_threadkey_t* Output::s_current = NULL;
+
+Output::Output(int fd, size_t bufferSize, unsigned int maxBuffers) :
+	m_fd(fd),
+	m_bufferSize(bufferSize),
+	m_maxBuffers(maxBuffers? maxBuffers : 1),
+	m_queued(m_queueLock),
+	m_written(m_queueLock),
+	m_writing(false),
+	m_stopping(false)
+{
+	m_fill.reserve(m_bufferSize);
+}
+
+Output::~Output()
+{
+}
+
+void Output::Init()
+{
+	s_pool = svn_pool_create(NULL);
+	if(apr_threadkey_private_create(&s_current, NULL, s_pool) != APR_SUCCESS) {
+		throw EXCEPTION(("Could not create thread key"));
+	}
+}
+
+Output* Output::Open(int fd, size_t bufferSize, unsigned int maxBuffers)
+{
+	Output* output = new Output(fd, bufferSize, maxBuffers);
+	try {
+		output->Thread::Start();
+	} catch(...) {
+		delete output;
+		throw;
+	}
+	return output;
+}
+
+void Output::Close(Output* output)
+{
+	Stop(output, false);
+}
+
+void Output::Abandon(Output* output)
+{
+	Stop(output, true);
+}
+
+void Output::Stop(Output* output, bool discard)
+{
+	std::string error;
+	try {
+		ScopedLock lock(output->m_writeLock);
+		if(discard) {
+			output->m_fill.clear();
+		} else {
+			output->FlushLocked();
+		}
+	} catch(std::exception const& e) {
+		error = e.what();
+	}
+	{
+		ScopedLock lock(output->m_queueLock);
+		if(discard) {
+			output->m_queue.clear();
+		}
+		output->m_stopping = true;
+		output->m_queued.Signal();
+		if(error.empty()) {
+			error = output->m_error;
+		}
+	}
+	output->Join();
+
+	delete output;
+
+	if(error.size() && !discard) {
+		throw EXCEPTION(("Writing output failed: %s", error.c_str()));
+	}
+}
+
+Output* Output::Current()
+{
+	void* output = NULL;
+	if(s_current) {
+		apr_threadkey_private_get(&output, s_current);
+	}
+	return static_cast<Output*>(output);
+}
+
+Output& Output::Get()
+{
+	Output* output = Current();
+	if(output == NULL) {
+		throw EXCEPTION(("No output for this thread"));
+	}
+	return *output;
+}
+
+Output::Scope::Scope(Output* output) :
+	m_previous(Current())
+{
+	apr_threadkey_private_set(output, s_current);
+}
+
+Output::Scope::~Scope()
+{
+	apr_threadkey_private_set(m_previous, s_current);
+}
+
+void Output::Printf(char const* fmt, ...)
+{
+	Output& output = Get();
+	ScopedLock lock(output.m_writeLock);
+
+	va_list args;
+	va_start(args, fmt);
+	try {
+		output.VPrintf(fmt, args);
+	} catch(...) {
+		va_end(args);
+		throw;
+	}
+	va_end(args);
+}
+
+void Output::Push()
+{
+	Output& output = Get();
+	ScopedLock lock(output.m_writeLock);
+	if(output.m_fill.size()) {
+		output.QueueFill();
+	}
+}
+
+void Output::VPrintf(char const* fmt, va_list args)
+{
+	char buffer[512];
+	va_list copy;
+	va_copy(copy, args);
+	int length = vsnprintf(buffer, sizeof(buffer), fmt, copy);
+	va_end(copy);
+
+	if(length < 0) {
+		throw EXCEPTION(("Could not format output \"%s\"", fmt));
+	}
+	if(static_cast<size_t>(length) < sizeof(buffer)) {
+		Append(buffer, length);
+	} else {
+		std::vector<char> large(length + 1);
+		vsnprintf(&large[0], large.size(), fmt, args);
+		Append(&large[0], length);
+	}
+}
+
+void Output::Append(char const* data, size_t length)
+{
+	if(m_fill.size() && m_fill.size() + length > m_bufferSize && length <= m_bufferSize) {
+		QueueFill();
+	}
+	// Anything larger than a buffer is split across as many as it takes,
+	// so a huge blob never needs more than the buffers themselves.
+	while(length) {
+		size_t chunk = m_bufferSize - m_fill.size();
+		if(chunk > length) {
+			chunk = length;
+		}
+		m_fill.append(data, chunk);
+		data += chunk;
+		length -= chunk;
+		if(m_fill.size() >= m_bufferSize) {
+			QueueFill();
+		}
+	}
+}
+
+void Output::QueueFill()
+{
+	Stats::Timer timer(Stats::Phase_Write);
+	Trace::Span span("QueueOutput");
+	ScopedLock lock(m_queueLock);
+	while(m_error.empty() && m_queue.size() >= m_maxBuffers) {
+		m_written.Wait();
+	}
+	if(m_error.size()) {
+		throw EXCEPTION(("Writing output failed: %s", m_error.c_str()));
+	}
+
+	m_queue.push_back(std::string());
+	m_queue.back().swap(m_fill);
+	if(m_spare.size()) {
+		m_fill.swap(m_spare.back());
+		m_spare.pop_back();
+	}
+	m_queued.Signal();
+}
+
+void Output::Flush()
+{
+	Output& output = Get();
+	ScopedLock lock(output.m_writeLock);
+	output.FlushLocked();
+}
+
+void Output::FlushLocked()
+{
+	if(m_fill.size()) {
+		QueueFill();
+	}
+
+	Stats::Timer timer(Stats::Phase_Write);
+	Trace::Span span("FlushOutput");
+	ScopedLock lock(m_queueLock);
+	while(m_error.empty() && (m_queue.size() || m_writing)) {
+		m_written.Wait();
+	}
+}
+
+void Output::Run()
+{
+	std::vector<std::string> batch;
+	std::vector<struct iovec> iov;
+	Trace::NameThread("Output");
+
+	ScopedLock lock(m_queueLock);
+	while(true) {
+		while(m_queue.empty() && !m_stopping) {
+			m_queued.Wait();
+		}
+		if(m_queue.empty()) {
+			break;
+		}
+
+		batch.resize(m_queue.size() < IOV_MAX? m_queue.size() : IOV_MAX);
+		for(std::vector<std::string>::iterator it = batch.begin(); it != batch.end(); ++it) {
+			it->swap(m_queue.front());
+			m_queue.pop_front();
+		}
+		m_writing = true;
+
+		m_queueLock.Unlock();
+		iov.resize(batch.size());
+		for(size_t i = 0; i < batch.size(); ++i) {
+			iov[i].iov_base = const_cast<char*>(batch[i].data());
+			iov[i].iov_len = batch[i].size();
+		}
+
+		std::string error;
+		struct iovec* next = &iov[0];
+		size_t remaining = iov.size();
+		Trace::Span span("WriteOutput");
+		if(Trace::Enabled()) {
+			long bytes = 0;
+			for(size_t i = 0; i < iov.size(); ++i) {
+				bytes += iov[i].iov_len;
+			}
+			span.Arg("bytes", bytes);
+		}
+		while(remaining) {
+			ssize_t written = writev(m_fd, next, remaining);
+			if(written < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				error = strerror(errno);
+				break;
+			}
+
+			// Skip whatever was written, which may end part way through a
+			// buffer.
+			while(remaining && static_cast<size_t>(written) >= next->iov_len) {
+				written -= next->iov_len;
+				++next;
+				--remaining;
+			}
+			if(remaining) {
+				next->iov_base = static_cast<char*>(next->iov_base) + written;
+				next->iov_len -= written;
+			}
+		}
+		m_queueLock.Lock();
+
+		for(std::vector<std::string>::iterator it = batch.begin(); it != batch.end(); ++it) {
+			if(m_spare.size() < m_maxBuffers) {
+				it->clear();
+				m_spare.push_back(std::string());
+				m_spare.back().swap(*it);
+			}
+		}
+		batch.clear();
+
+		if(error.size()) {
+			// Nothing more can be written; fail every writer from now on.
+			m_error = error;
+			m_queue.clear();
+		}
+		m_writing = false;
+		m_written.Broadcast();
+	}
+}
+
+Output::Transaction::Transaction() :
+	m_output(Output::Get())
+{
+	m_output.m_writeLock.Lock();
+}
+
+Output::Transaction::~Transaction()
+{
+	m_output.m_writeLock.Unlock();
+}
+
+void Output::Transaction::Printf(char const* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	try {
+		m_output.VPrintf(fmt, args);
+	} catch(...) {
+		va_end(args);
+		throw;
+	}
+	va_end(args);
+}
+
+void Output::Transaction::Write(char const* data, size_t length)
+{
+	m_output.Append(data, length);
+}
+
+static svn_error_t* WriteToTransaction(void* baton, char const* data, apr_size_t* len)
+{
+	try {
+		static_cast<Output::Transaction*>(baton)->Write(data, *len);
+	} catch(std::exception const& e) {
+		return svn_error_create(APR_EGENERAL, NULL, e.what());
+	}
+	return SVN_NO_ERROR;
+}
+
+svn_stream_t* Output::Transaction::Stream(apr_pool_t* pool)
+{
+	svn_stream_t* stream = svn_stream_create(this, pool);
+	svn_stream_set_write(stream, &WriteToTransaction);
+	return stream;
+}
@@ -0,0 +1,360 @@
+#include "Path.h"
+#include "Thread.h"
+#include "Exception.h"
+
+#include <string.h>
+#include <vector>
+
+// Open addressing, kept at most half full.  Slots hold a node id, or 0 when
+// empty.
+#define INITIAL_SLOTS (1024)
+
+// Nodes are stored in chunks which never move, so they can be read without
+// the lock while others are added.
+#define NODE_CHUNK_BITS (16)
+#define NODE_CHUNK_SIZE (1U << NODE_CHUNK_BITS)
+#define NODE_CHUNKS (1U << (32 - NODE_CHUNK_BITS))
+
+// Likewise names, which are referred to by chunk and offset.
+#define NAME_CHUNK_BITS (20)
+#define NAME_CHUNK_SIZE (1U << NAME_CHUNK_BITS)
+#define NAME_CHUNKS (1U << (32 - NAME_CHUNK_BITS))
+
+/**
+ * Interned paths are found and read without taking the lock; only adding a
+ * path does.  A node is fully written before its id is stored in a slot,
+ * and a grown slot array is filled before it replaces the old one, which
+ * is kept for lookups still running over it.
+ */
+class Path::Table
+{
+public:
+	Table();
+
+	unsigned int Child(unsigned int parent, char const* name, size_t length);
+	unsigned int Parent(unsigned int id) const { return GetNode(id).m_parent; }
+	unsigned int Depth(unsigned int id) const { return GetNode(id).m_depth; }
+	std::string String(unsigned int id) const;
+	std::string Component(unsigned int id) const;
+	void Size(size_t& paths, size_t& bytes);
+
+private:
+	struct Node
+	{
+		unsigned int m_parent;
+		unsigned int m_depth;
+		// Of the whole path.
+		unsigned int m_length;
+		unsigned int m_name;
+	};
+
+	struct Slots
+	{
+		explicit Slots(size_t size) : m_mask(size - 1), m_ids(size, 0) { }
+
+		size_t m_mask;
+		std::vector<unsigned int> m_ids;
+	};
+
+	static size_t HashName(char const* name, size_t length);
+	static size_t HashNode(unsigned int parent, size_t nameHash);
+	Node const& GetNode(unsigned int id) const { return m_nodes[id >> NODE_CHUNK_BITS][id & (NODE_CHUNK_SIZE - 1)]; }
+	char const* GetName(unsigned int name) const { return m_names[name >> NAME_CHUNK_BITS] + (name & (NAME_CHUNK_SIZE - 1)); }
+	size_t NameLength(Node const& node) const;
+	bool NodeEquals(unsigned int id, unsigned int parent, char const* name, size_t length) const;
+	unsigned int Find(unsigned int parent, char const* name, size_t length, size_t hash) const;
+	unsigned int Name(char const* name, size_t length);
+	void GrowNames();
+	void GrowNodes();
+
+	// Held while adding paths.
+	Mutex m_mutex;
+
+	// Component names, back to back.  Only the first node with each name
+	// is in m_nameSlots, which is only used while adding.
+	char* m_names[NAME_CHUNKS];
+	unsigned int m_nameChunks;
+	size_t m_nameUsed;
+	std::vector<unsigned int> m_nameSlots;
+	size_t m_nameCount;
+
+	// Node 0 is the empty path.
+	Node* m_nodes[NODE_CHUNKS];
+	unsigned int m_nodeCount;
+	Slots* m_nodeSlots;
+	// Replaced slot arrays; never freed, as lookups may still be using them.
+	std::vector<Slots*> m_retiredSlots;
+};
+
+Path::Table::Table() :
+	m_nameChunks(1),
+	m_nameUsed(0),
+	m_nameSlots(INITIAL_SLOTS, 0),
+	m_nameCount(0),
+	m_nodeCount(1),
+	m_nodeSlots(new Slots(INITIAL_SLOTS))
+{
+	memset(m_names, 0, sizeof(m_names));
+	memset(m_nodes, 0, sizeof(m_nodes));
+	m_names[0] = new char[NAME_CHUNK_SIZE];
+	m_nodes[0] = new Node[NODE_CHUNK_SIZE];
+	Node root = { 0, 0, 0, 0 };
+	m_nodes[0][0] = root;
+}
+
+// FNV-1a
+size_t Path::Table::HashName(char const* name, size_t length)
+{
+	unsigned long h = 2166136261UL;
+	for(size_t i = 0; i < length; ++i) {
+		h = ((h ^ static_cast<unsigned char>(name[i])) * 16777619UL) & 0xFFFFFFFFUL;
+	}
+	return h;
+}
+
+size_t Path::Table::HashNode(unsigned int parent, size_t nameHash)
+{
+	return (parent * 2654435761UL) ^ nameHash;
+}
+
+size_t Path::Table::NameLength(Node const& node) const
+{
+	if(node.m_parent == 0) {
+		return node.m_length;
+	}
+	return node.m_length - GetNode(node.m_parent).m_length - 1;
+}
+
+bool Path::Table::NodeEquals(unsigned int id, unsigned int parent, char const* name, size_t length) const
+{
+	Node const& node = GetNode(id);
+	return node.m_parent == parent && NameLength(node) == length
+		&& memcmp(GetName(node.m_name), name, length) == 0;
+}
+
+unsigned int Path::Table::Find(unsigned int parent, char const* name, size_t length, size_t hash) const
+{
+	Slots const* slots = __atomic_load_n(&m_nodeSlots, __ATOMIC_ACQUIRE);
+	size_t slot = hash & slots->m_mask;
+	unsigned int id;
+	while((id = __atomic_load_n(&slots->m_ids[slot], __ATOMIC_ACQUIRE))) {
+		if(NodeEquals(id, parent, name, length)) {
+			return id;
+		}
+		slot = (slot + 1) & slots->m_mask;
+	}
+	return 0;
+}
+
+void Path::Table::GrowNames()
+{
+	std::vector<unsigned int> slots(m_nameSlots.size() * 2, 0);
+	size_t mask = slots.size() - 1;
+	for(std::vector<unsigned int>::const_iterator it = m_nameSlots.begin(); it != m_nameSlots.end(); ++it) {
+		if(*it == 0) {
+			continue;
+		}
+		Node const& node = GetNode(*it);
+		size_t slot = HashName(GetName(node.m_name), NameLength(node)) & mask;
+		while(slots[slot]) {
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = *it;
+	}
+	m_nameSlots.swap(slots);
+}
+
+void Path::Table::GrowNodes()
+{
+	Slots* slots = new Slots(m_nodeSlots->m_ids.size() * 2);
+	for(unsigned int id = 1; id < m_nodeCount; ++id) {
+		Node const& node = GetNode(id);
+		size_t slot = HashNode(node.m_parent, HashName(GetName(node.m_name), NameLength(node))) & slots->m_mask;
+		while(slots->m_ids[slot]) {
+			slot = (slot + 1) & slots->m_mask;
+		}
+		slots->m_ids[slot] = id;
+	}
+	m_retiredSlots.push_back(m_nodeSlots);
+	__atomic_store_n(&m_nodeSlots, slots, __ATOMIC_RELEASE);
+}
+
+// The name of a node with name, or of a new one about to be added.
+unsigned int Path::Table::Name(char const* name, size_t length)
+{
+	size_t mask = m_nameSlots.size() - 1;
+	size_t slot = HashName(name, length) & mask;
+	while(m_nameSlots[slot]) {
+		Node const& node = GetNode(m_nameSlots[slot]);
+		if(NameLength(node) == length && memcmp(GetName(node.m_name), name, length) == 0) {
+			return node.m_name;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	if(length > NAME_CHUNK_SIZE) {
+		throw EXCEPTION(("Path component too long"));
+	}
+	if(m_nameUsed + length > NAME_CHUNK_SIZE) {
+		if(m_nameChunks == NAME_CHUNKS) {
+			throw EXCEPTION(("Too many distinct path components"));
+		}
+		m_names[m_nameChunks++] = new char[NAME_CHUNK_SIZE];
+		m_nameUsed = 0;
+	}
+
+	unsigned int index = ((m_nameChunks - 1) << NAME_CHUNK_BITS) | m_nameUsed;
+	memcpy(m_names[m_nameChunks - 1] + m_nameUsed, name, length);
+	m_nameUsed += length;
+
+	// Grown by Child() once the node is written.
+	m_nameSlots[slot] = m_nodeCount;
+	m_nameCount += 1;
+	return index;
+}
+
+unsigned int Path::Table::Child(unsigned int parent, char const* name, size_t length)
+{
+	size_t hash = HashNode(parent, HashName(name, length));
+	unsigned int id = Find(parent, name, length, hash);
+	if(id) {
+		return id;
+	}
+
+	ScopedLock lock(m_mutex);
+	// Someone else may have added it since.
+	id = Find(parent, name, length, hash);
+	if(id) {
+		return id;
+	}
+
+	if(m_nodeCount == 0xFFFFFFFFUL) {
+		throw EXCEPTION(("Too many distinct paths"));
+	}
+	id = m_nodeCount;
+	if(m_nodes[id >> NODE_CHUNK_BITS] == NULL) {
+		m_nodes[id >> NODE_CHUNK_BITS] = new Node[NODE_CHUNK_SIZE];
+	}
+
+	Node const& parentNode = GetNode(parent);
+	Node& node = m_nodes[id >> NODE_CHUNK_BITS][id & (NODE_CHUNK_SIZE - 1)];
+	node.m_parent = parent;
+	node.m_depth = parentNode.m_depth + 1;
+	node.m_length = parentNode.m_length + (parent? 1 : 0) + length;
+	node.m_name = Name(name, length);
+	m_nodeCount += 1;
+	if(m_nameCount * 2 > m_nameSlots.size()) {
+		GrowNames();
+	}
+
+	size_t slot = hash & m_nodeSlots->m_mask;
+	while(m_nodeSlots->m_ids[slot]) {
+		slot = (slot + 1) & m_nodeSlots->m_mask;
+	}
+	__atomic_store_n(&m_nodeSlots->m_ids[slot], id, __ATOMIC_RELEASE);
+
+	if(m_nodeCount * 2 > m_nodeSlots->m_ids.size()) {
+		GrowNodes();
+	}
+	return id;
+}
+
+std::string Path::Table::String(unsigned int id) const
+{
+	// Filled in from the end, a component at a time.
+	std::string relPath(GetNode(id).m_length, '\0');
+	size_t end = relPath.size();
+	while(id) {
+		Node const& node = GetNode(id);
+		size_t length = NameLength(node);
+		end -= length;
+		memcpy(&relPath[end], GetName(node.m_name), length);
+		if(end) {
+			relPath[--end] = '/';
+		}
+		id = node.m_parent;
+	}
+	return relPath;
+}
+
+std::string Path::Table::Component(unsigned int id) const
+{
+	Node const& node = GetNode(id);
+	return std::string(GetName(node.m_name), NameLength(node));
+}
+
+void Path::Table::Size(size_t& paths, size_t& bytes)
+{
+	ScopedLock lock(m_mutex);
+	paths = m_nodeCount - 1;
+	bytes = static_cast<size_t>(m_nameChunks) * NAME_CHUNK_SIZE
+		+ m_nameSlots.capacity() * sizeof(unsigned int)
+		+ ((m_nodeCount + NODE_CHUNK_SIZE - 1) >> NODE_CHUNK_BITS) * NODE_CHUNK_SIZE * sizeof(Node)
+		+ m_nodeSlots->m_ids.capacity() * sizeof(unsigned int);
+	for(std::vector<Slots*>::const_iterator it = m_retiredSlots.begin(); it != m_retiredSlots.end(); ++it) {
+		bytes += (*it)->m_ids.capacity() * sizeof(unsigned int);
+	}
+}
+
+Path::Table& Path::GetTable()
+{
+	// Never destroyed; Paths may be in use by other threads at exit.
+	static Table* table = new Table;
+	return *table;
+}
+
+Path::Path(std::string const& relPath) :
+	m_id(Path().Child(relPath).m_id)
+{
+}
+
+Path::Path(char const* relPath) :
+	m_id(Path().Child(relPath).m_id)
+{
+}
+
+Path Path::Child(std::string const& relPath) const
+{
+	Table& table = GetTable();
+
+	Path child(*this);
+	std::string::size_type start = 0;
+	while(start < relPath.size()) {
+		std::string::size_type end = relPath.find('/', start);
+		if(end == std::string::npos) {
+			end = relPath.size();
+		}
+		if(end > start) {
+			child.m_id = table.Child(child.m_id, relPath.data() + start, end - start);
+		}
+		start = end + 1;
+	}
+	return child;
+}
+
+Path Path::Parent() const
+{
+	Path parent;
+	parent.m_id = GetTable().Parent(m_id);
+	return parent;
+}
+
+unsigned int Path::Depth() const
+{
+	return GetTable().Depth(m_id);
+}
+
+std::string Path::str() const
+{
+	return GetTable().String(m_id);
+}
+
+std::string Path::Name() const
+{
+	return GetTable().Component(m_id);
+}
+
+void Path::TableSize(size_t& paths, size_t& bytes)
+{
+	GetTable().Size(paths, bytes);
+}
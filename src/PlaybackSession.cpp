@@ -0,0 +1,335 @@
+#include "PlaybackSession.h"
+#include "Recording.h"
+#include "Exception.h"
+
+#include <string.h>
+
+extern "C" {
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <svn_delta.h>
+#include <svn_io.h>
+#include <svn_pools.h>
+#include <svn_string.h>
+}
+
+#define URL_SCHEME "recording://"
+
+apr_interval_time_t PlaybackSession::s_latency = 0;
+
+static void Check(svn_error_t* err)
+{
+	if(err) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+}
+
+static apr_hash_t* DecodeProps(Recording::Decoder& decoder, apr_pool_t* pool)
+{
+	apr_hash_t* props = apr_hash_make(pool);
+	for(long count = decoder.Int(); count > 0; --count) {
+		size_t nameLength, valueLength;
+		char const* name = decoder.String(nameLength);
+		char const* value = decoder.String(valueLength);
+		apr_hash_set(props, apr_pstrmemdup(pool, name, nameLength), nameLength, svn_string_ncreate(value, valueLength, pool));
+	}
+	return props;
+}
+
+// NULL for a NULL string.
+static char const* DecodeCString(Recording::Decoder& decoder, apr_pool_t* pool)
+{
+	size_t length;
+	char const* data = decoder.String(length);
+	return data? apr_pstrmemdup(pool, data, length) : NULL;
+}
+
+bool PlaybackSession::Handles(std::string const& url)
+{
+	return url.compare(0, strlen(URL_SCHEME), URL_SCHEME) == 0;
+}
+
+PlaybackSession::PlaybackSession(std::string const& url, apr_pool_t* pool) :
+	m_pool(pool),
+	m_recording(NULL)
+{
+	m_recording = Recording::Open(url.substr(strlen(URL_SCHEME)));
+
+	try {
+		char const* data;
+		size_t length;
+		Answer(Recording::Key("subtree", -1), &data, &length);
+		m_subtree.assign(data, length);
+	} catch(...) {
+		Recording::Release(m_recording);
+		throw;
+	}
+}
+
+PlaybackSession::~PlaybackSession()
+{
+	Recording::Release(m_recording);
+}
+
+void PlaybackSession::Answer(std::string const& key, char const** data, size_t* length)
+{
+	if(s_latency > 0) {
+		apr_sleep(s_latency);
+	}
+	if(!m_recording->Find(key, data, length)) {
+		// Keys are readable enough to say what was missing.
+		throw EXCEPTION(("No answer in %s to %s", m_recording->GetFileName().c_str(), key.c_str()));
+	}
+}
+
+svn_revnum_t PlaybackSession::GetLatestRevision()
+{
+	char const* data;
+	size_t length;
+	Answer(Recording::Key("latest", -1), &data, &length);
+	return Recording::Decoder(data, length).Int();
+}
+
+svn_node_kind_t PlaybackSession::CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool)
+{
+	char const* data;
+	size_t length;
+	Answer(Recording::Key("check", revision, relPath), &data, &length);
+	return static_cast<svn_node_kind_t>(Recording::Decoder(data, length).Int());
+}
+
+void PlaybackSession::GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool)
+{
+	char const* data;
+	size_t length;
+	Answer(Recording::Key("dir", revision, relPath), &data, &length);
+
+	Recording::Decoder decoder(data, length);
+	for(long count = decoder.Int(); count > 0; --count) {
+		bool directory = decoder.Char() == 'd';
+		entries.push_back(std::make_pair(decoder.String(), directory));
+	}
+}
+
+void PlaybackSession::GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool)
+{
+	char const* data;
+	size_t length;
+	Answer(Recording::Key("file", revision, relPath), &data, &length);
+	apr_size_t written = length;
+	Check(svn_stream_write(stream, data, &written));
+}
+
+bool PlaybackSession::BorrowFile(char const* relPath, svn_revnum_t revision, char const** data, size_t* length)
+{
+	// Straight from the mapping.
+	Answer(Recording::Key("file", revision, relPath), data, length);
+	return true;
+}
+
+void PlaybackSession::GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool)
+{
+	char const* data;
+	size_t length;
+	Answer(Recording::LogKey(paths, from, to), &data, &length);
+
+	Recording::Decoder decoder(data, length);
+	apr_pool_t* iterPool = svn_pool_create(pool);
+	while(!decoder.AtEnd()) {
+		svn_pool_clear(iterPool);
+
+		svn_log_entry_t* entry = svn_log_entry_create(iterPool);
+		entry->revision = decoder.Int();
+		entry->revprops = DecodeProps(decoder, iterPool);
+		entry->changed_paths2 = apr_hash_make(iterPool);
+		for(long count = decoder.Int(); count > 0; --count) {
+			char const* path = DecodeCString(decoder, iterPool);
+			svn_log_changed_path2_t* change = svn_log_changed_path2_create(iterPool);
+			change->action = decoder.Char();
+			change->copyfrom_path = DecodeCString(decoder, iterPool);
+			change->copyfrom_rev = decoder.Int();
+			change->node_kind = static_cast<svn_node_kind_t>(decoder.Int());
+			apr_hash_set(entry->changed_paths2, path, APR_HASH_KEY_STRING, change);
+		}
+
+		Check(receiver(baton, entry, iterPool));
+	}
+	svn_pool_destroy(iterPool);
+}
+
+// Drives editor with a revision as RecordingSession recorded it.
+static void Drive(Recording::Decoder& decoder, svn_delta_editor_t const* editor, void* editBaton, apr_pool_t* pool)
+{
+	// Batons by the number they were recorded with.
+	std::vector<void*> batons;
+	svn_txdelta_window_handler_t handler = NULL;
+	void* handlerBaton = NULL;
+	std::vector<svn_txdelta_op_t> ops;
+
+	while(!decoder.AtEnd()) {
+		char op = decoder.Char();
+		char const* path = NULL;
+		long parent = -1;
+		void* baton = NULL;
+		switch(op) {
+			case 'S':
+				Check(editor->set_target_revision(editBaton, decoder.Int(), pool));
+				break;
+			case 'R':
+				Check(editor->open_root(editBaton, decoder.Int(), pool, &baton));
+				batons.push_back(baton);
+				break;
+			case 'd': {
+				path = DecodeCString(decoder, pool);
+				svn_revnum_t revision = decoder.Int();
+				parent = decoder.Int();
+				if(parent < 0 || static_cast<size_t>(parent) >= batons.size()) {
+					throw EXCEPTION(("Malformed replay in recording"));
+				}
+				Check(editor->delete_entry(path, revision, batons[parent], pool));
+				break;
+			}
+			case 'A':
+			case 'a': {
+				path = DecodeCString(decoder, pool);
+				parent = decoder.Int();
+				char const* copyFromPath = DecodeCString(decoder, pool);
+				svn_revnum_t copyFromRevision = decoder.Int();
+				if(parent < 0 || static_cast<size_t>(parent) >= batons.size()) {
+					throw EXCEPTION(("Malformed replay in recording"));
+				}
+				if(op == 'A') {
+					Check(editor->add_directory(path, batons[parent], copyFromPath, copyFromRevision, pool, &baton));
+				} else {
+					Check(editor->add_file(path, batons[parent], copyFromPath, copyFromRevision, pool, &baton));
+				}
+				batons.push_back(baton);
+				break;
+			}
+			case 'O':
+			case 'o': {
+				path = DecodeCString(decoder, pool);
+				parent = decoder.Int();
+				svn_revnum_t baseRevision = decoder.Int();
+				if(parent < 0 || static_cast<size_t>(parent) >= batons.size()) {
+					throw EXCEPTION(("Malformed replay in recording"));
+				}
+				if(op == 'O') {
+					Check(editor->open_directory(path, batons[parent], baseRevision, pool, &baton));
+				} else {
+					Check(editor->open_file(path, batons[parent], baseRevision, pool, &baton));
+				}
+				batons.push_back(baton);
+				break;
+			}
+			case 'x':
+			case 'X': {
+				path = DecodeCString(decoder, pool);
+				parent = decoder.Int();
+				if(parent < 0 || static_cast<size_t>(parent) >= batons.size()) {
+					throw EXCEPTION(("Malformed replay in recording"));
+				}
+				if(op == 'x') {
+					Check(editor->absent_directory(path, batons[parent], pool));
+				} else {
+					Check(editor->absent_file(path, batons[parent], pool));
+				}
+				break;
+			}
+			case 'P':
+			case 'p':
+			case 'C':
+			case 'T':
+			case 'W':
+			case 'c': {
+				long id = decoder.Int();
+				if(id < 0 || static_cast<size_t>(id) >= batons.size()) {
+					throw EXCEPTION(("Malformed replay in recording"));
+				}
+				baton = batons[id];
+				if(op == 'P' || op == 'p') {
+					char const* name = DecodeCString(decoder, pool);
+					size_t length;
+					char const* value = decoder.String(length);
+					svn_string_t const* string = value? svn_string_ncreate(value, length, pool) : NULL;
+					if(op == 'P') {
+						Check(editor->change_dir_prop(baton, name, string, pool));
+					} else {
+						Check(editor->change_file_prop(baton, name, string, pool));
+					}
+				} else if(op == 'C') {
+					Check(editor->close_directory(baton, pool));
+				} else if(op == 'T') {
+					Check(editor->apply_textdelta(baton, DecodeCString(decoder, pool), pool, &handler, &handlerBaton));
+				} else if(op == 'c') {
+					Check(editor->close_file(baton, DecodeCString(decoder, pool), pool));
+				} else if(handler == NULL) {
+					throw EXCEPTION(("Malformed replay in recording"));
+				} else if(decoder.Int() == 0) {
+					Check(handler(NULL, handlerBaton));
+					handler = NULL;
+				} else {
+					svn_txdelta_window_t window;
+					window.sview_offset = decoder.Int();
+					window.sview_len = decoder.Int();
+					window.tview_len = decoder.Int();
+					window.src_ops = decoder.Int();
+					window.num_ops = decoder.Int();
+					ops.resize(window.num_ops > 0? window.num_ops : 1);
+					for(int i = 0; i < window.num_ops; ++i) {
+						ops[i].action_code = static_cast<enum svn_delta_action>(decoder.Int());
+						ops[i].offset = decoder.Int();
+						ops[i].length = decoder.Int();
+					}
+					window.ops = &ops[0];
+					size_t length;
+					char const* newData = decoder.String(length);
+					svn_string_t newString;
+					newString.data = newData;
+					newString.len = length;
+					window.new_data = newData? &newString : NULL;
+					Check(handler(&window, handlerBaton));
+				}
+				break;
+			}
+			case 'E':
+				Check(editor->close_edit(editBaton, pool));
+				break;
+			case 'B':
+				Check(editor->abort_edit(editBaton, pool));
+				break;
+			default:
+				throw EXCEPTION(("Malformed replay in recording"));
+		}
+	}
+}
+
+void PlaybackSession::Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool)
+{
+	// One request for the whole range, as svn_ra_replay_range() is.
+	if(s_latency > 0) {
+		apr_sleep(s_latency);
+	}
+
+	char const* request = sendDeltas? "replay-deltas" : "replay";
+	apr_pool_t* iterPool = svn_pool_create(pool);
+	for(svn_revnum_t rev = from; rev <= to; ++rev) {
+		svn_pool_clear(iterPool);
+
+		std::string key(Recording::Key(request, rev));
+		char const* data;
+		size_t length;
+		if(!m_recording->Find(key, &data, &length)) {
+			throw EXCEPTION(("No answer in %s to %s", m_recording->GetFileName().c_str(), key.c_str()));
+		}
+
+		Recording::Decoder decoder(data, length);
+		apr_hash_t* revProps = DecodeProps(decoder, iterPool);
+		svn_delta_editor_t const* editor;
+		void* editBaton;
+		Check(revStart(rev, baton, &editor, &editBaton, revProps, iterPool));
+		Drive(decoder, editor, editBaton, iterPool);
+		Check(revFinish(rev, baton, editor, editBaton, revProps, iterPool));
+	}
+	svn_pool_destroy(iterPool);
+}
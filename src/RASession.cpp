@@ -0,0 +1,141 @@
+#include "RASession.h"
+#include "Exception.h"
+
+#include <string.h>
+
+extern "C" {
+#include <apr_hash.h>
+#include <svn_pools.h>
+}
+
+RASession::RASession(std::string const& url, svn_ra_callbacks2_t* callbacks, apr_hash_t* config, apr_pool_t* pool) :
+	m_pool(pool)
+{
+	svn_error_t* err;
+	if((err = svn_ra_open4(&m_session, NULL, url.c_str(), NULL, callbacks, NULL, config, m_pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+}
+
+std::string RASession::GetSubtree()
+{
+	svn_error_t* err;
+	char const* sessionURL;
+	char const* rootURL;
+	if((err = svn_ra_get_session_url(m_session, &sessionURL, m_pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	if((err = svn_ra_get_repos_root2(m_session, &rootURL, m_pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+
+	return sessionURL + strlen(rootURL);
+}
+
+svn_revnum_t RASession::GetLatestRevision()
+{
+	svn_revnum_t rev;
+	svn_error_t* err;
+	if((err = svn_ra_get_latest_revnum(m_session, &rev, m_pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	return rev;
+}
+
+svn_node_kind_t RASession::CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool)
+{
+	svn_node_kind_t kind;
+	svn_error_t* err;
+	if((err = svn_ra_check_path(m_session, relPath, revision, &kind, pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	return kind;
+}
+
+void RASession::GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool)
+{
+	apr_hash_t* dirents;
+	svn_error_t* err;
+	if((err = svn_ra_get_dir2(
+		m_session,
+		&dirents,
+		NULL,
+		NULL,
+		relPath,
+		revision,
+		SVN_DIRENT_KIND, // Only want to know the type of dirents
+		pool
+	))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+
+	for(apr_hash_index_t* index = apr_hash_first(pool, dirents); index; index = apr_hash_next(index))
+	{
+		void const* key;
+		apr_ssize_t keyLen;
+		void* val;
+		apr_hash_this(index, &key, &keyLen, &val);
+
+		char const* path = static_cast<char const*>(key);
+		svn_dirent_t* info = static_cast<svn_dirent_t*>(val);
+
+		switch(info->kind)
+		{
+			case svn_node_file:
+				entries.push_back(std::make_pair(std::string(path), false));
+				break;
+			case svn_node_dir:
+				entries.push_back(std::make_pair(std::string(path), true));
+				break;
+			default:
+				ERROR(("Unknown file kind: \"%s\" in directory \"%s\"", path, relPath));
+		}
+	}
+}
+
+void RASession::GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool)
+{
+	svn_error_t* err;
+	if((err = svn_ra_get_file(m_session, relPath, revision, stream, NULL, NULL /* TODO: props*/, pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+}
+
+void RASession::GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool)
+{
+	svn_error_t* err;
+	if((err = svn_ra_get_log2(
+		m_session,
+		paths,
+		from,
+		to,
+		0, // No limit
+		1, // Generate a list of changed paths
+		0, // Don't follow copies
+		0, // No merge info
+		NULL, // TODO: Filter revprops
+		receiver,
+		baton,
+		pool
+	))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+}
+
+void RASession::Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool)
+{
+	svn_error_t* err;
+	if((err = svn_ra_replay_range(
+		m_session,
+		from,
+		to,
+		0,
+		sendDeltas,
+		revStart,
+		revFinish,
+		baton,
+		pool
+	))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+}
@@ -0,0 +1,311 @@
+#include "Recording.h"
+#include "FileContents.h"
+#include "Exception.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern "C" {
+#include <apr_tables.h>
+}
+
+#define HEADER "svnescape-recording 1\n"
+
+Mutex* Recording::s_lock = NULL;
+std::map<std::string, Recording*> Recording::s_open;
+
+void Recording::Encoder::Int(long value)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%ld ", value);
+	m_out.append(buffer);
+}
+
+void Recording::Encoder::String(char const* data, size_t length)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%lu:", static_cast<unsigned long>(length));
+	m_out.append(buffer);
+	m_out.append(data, length);
+}
+
+void Recording::Encoder::String(char const* value)
+{
+	if(value == NULL) {
+		m_out.push_back('-');
+	} else {
+		String(value, strlen(value));
+	}
+}
+
+char Recording::Decoder::Char()
+{
+	if(m_pos == m_end) {
+		throw EXCEPTION(("Recording ends unexpectedly"));
+	}
+	return *m_pos++;
+}
+
+long Recording::Decoder::Int()
+{
+	// Never runs off the end, as every value is followed by its key's "\n".
+	char* next;
+	long value = strtol(m_pos, &next, 10);
+	if(next == m_pos || next >= m_end || *next != ' ') {
+		throw EXCEPTION(("Malformed number in recording"));
+	}
+	m_pos = next + 1;
+	return value;
+}
+
+char const* Recording::Decoder::String(size_t& length)
+{
+	if(m_pos < m_end && *m_pos == '-') {
+		++m_pos;
+		length = 0;
+		return NULL;
+	}
+
+	char* next;
+	length = strtoul(m_pos, &next, 10);
+	if(next == m_pos || next >= m_end || *next != ':' || length > static_cast<size_t>(m_end - next - 1)) {
+		throw EXCEPTION(("Malformed string in recording"));
+	}
+	char const* data = next + 1;
+	m_pos = data + length;
+	return data;
+}
+
+std::string Recording::Decoder::String()
+{
+	size_t length;
+	char const* data = String(length);
+	return data? std::string(data, length) : std::string();
+}
+
+std::string Recording::Key(char const* request, long revision, char const* path)
+{
+	std::string key;
+	Encoder encoder(key);
+	encoder.String(request);
+	encoder.Int(revision);
+	encoder.String(path);
+	return key;
+}
+
+std::string Recording::LogKey(apr_array_header_t const* paths, long from, long to)
+{
+	std::string key(Key("log", from));
+	Encoder encoder(key);
+	encoder.Int(to);
+	encoder.Int(paths? paths->nelts : -1);
+	for(int i = 0; paths && i < paths->nelts; ++i) {
+		encoder.String(APR_ARRAY_IDX(paths, i, char const*));
+	}
+	return key;
+}
+
+void Recording::Init()
+{
+	s_lock = new Mutex;
+}
+
+void Recording::Shutdown()
+{
+	delete s_lock;
+	s_lock = NULL;
+}
+
+Recording* Recording::Open(std::string const& fileName)
+{
+	ScopedLock lock(*s_lock);
+	std::map<std::string, Recording*>::iterator it = s_open.find(fileName);
+	if(it != s_open.end()) {
+		it->second->m_refs += 1;
+		return it->second;
+	}
+
+	Recording* recording = new Recording(fileName);
+	s_open[fileName] = recording;
+	return recording;
+}
+
+void Recording::Release(Recording* recording)
+{
+	ScopedLock lock(*s_lock);
+	recording->m_refs -= 1;
+	if(recording->m_refs == 0) {
+		s_open.erase(recording->m_fileName);
+		delete recording;
+	}
+}
+
+Recording::Recording(std::string const& fileName) :
+	m_fileName(fileName),
+	m_refs(1),
+	m_map(NULL),
+	m_mapSize(0),
+	m_completeSize(0)
+{
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if(fd < 0) {
+		throw EXCEPTION(("Could not open %s: %s", fileName.c_str(), strerror(errno)));
+	}
+
+	struct stat st;
+	if(fstat(fd, &st)) {
+		close(fd);
+		throw EXCEPTION(("Could not stat %s: %s", fileName.c_str(), strerror(errno)));
+	}
+	if(static_cast<size_t>(st.st_size) < strlen(HEADER)) {
+		close(fd);
+		throw EXCEPTION(("%s is not a recording", fileName.c_str()));
+	}
+
+	m_mapSize = st.st_size;
+	m_map = mmap(NULL, m_mapSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(m_map == MAP_FAILED) {
+		throw EXCEPTION(("Could not map %s: %s", fileName.c_str(), strerror(errno)));
+	}
+
+	try {
+		Index();
+	} catch(...) {
+		munmap(m_map, m_mapSize);
+		throw;
+	}
+}
+
+Recording::~Recording()
+{
+	munmap(m_map, m_mapSize);
+}
+
+void Recording::Index()
+{
+	char const* pos = static_cast<char const*>(m_map);
+	char const* end = pos + m_mapSize;
+	if(memcmp(pos, HEADER, strlen(HEADER))) {
+		throw EXCEPTION(("%s is not a recording", m_fileName.c_str()));
+	}
+	pos += strlen(HEADER);
+	m_completeSize = strlen(HEADER);
+
+	while(pos < end) {
+		// A record cut short by the recording export dying is dropped.
+		char const* newline = static_cast<char const*>(memchr(pos, '\n', end - pos));
+		if(newline == NULL) {
+			break;
+		}
+		char* next;
+		size_t keyLength = strtoul(pos, &next, 10);
+		size_t valueLength = strtoul(next, &next, 10);
+		if(next != newline) {
+			throw EXCEPTION(("Malformed record in %s", m_fileName.c_str()));
+		}
+		char const* key = newline + 1;
+		if(static_cast<size_t>(end - key) < keyLength + valueLength + 1) {
+			break;
+		}
+
+		m_answers[std::string(key, keyLength)] = std::make_pair(key + keyLength, valueLength);
+		pos = key + keyLength + valueLength + 1;
+		m_completeSize = pos - static_cast<char const*>(m_map);
+	}
+}
+
+bool Recording::Find(std::string const& key, char const** data, size_t* length) const
+{
+	Answers::const_iterator it = m_answers.find(key);
+	if(it == m_answers.end()) {
+		return false;
+	}
+	*data = it->second.first;
+	*length = it->second.second;
+	return true;
+}
+
+void Recording::Keys(std::set<std::string>& keys) const
+{
+	for(Answers::const_iterator it = m_answers.begin(); it != m_answers.end(); ++it) {
+		keys.insert(keys.end(), it->first);
+	}
+}
+
+Recorder::Recorder(std::string const& fileName) :
+	m_fileName(fileName),
+	m_file(NULL)
+{
+	struct stat st;
+	if(stat(fileName.c_str(), &st) == 0 && st.st_size > 0) {
+		// What an earlier run recorded needn't be written again, and
+		// records appended after one it was cut short in wouldn't be read.
+		Recording* recording = Recording::Open(fileName);
+		size_t complete = recording->GetCompleteSize();
+		recording->Keys(m_written);
+		Recording::Release(recording);
+		if(complete < static_cast<size_t>(st.st_size) && truncate(fileName.c_str(), complete)) {
+			throw EXCEPTION(("Could not truncate %s: %s", fileName.c_str(), strerror(errno)));
+		}
+	}
+
+	m_file = fopen(fileName.c_str(), "a");
+	if(m_file == NULL) {
+		throw EXCEPTION(("Could not open %s: %s", fileName.c_str(), strerror(errno)));
+	}
+	fseek(m_file, 0, SEEK_END);
+	if(ftell(m_file) == 0) {
+		fputs(HEADER, m_file);
+	}
+}
+
+Recorder::~Recorder()
+{
+	if(fclose(m_file)) {
+		fprintf(stderr, "[ERROR] Could not write %s: %s\n", m_fileName.c_str(), strerror(errno));
+	}
+}
+
+bool Recorder::Written(std::string const& key)
+{
+	ScopedLock lock(m_mutex);
+	return m_written.find(key) != m_written.end();
+}
+
+void Recorder::Write(std::string const& key, char const* value, size_t length, bool replace)
+{
+	ScopedLock lock(m_mutex);
+	if(!m_written.insert(key).second && !replace) {
+		return;
+	}
+
+	fprintf(m_file, "%lu %lu\n", static_cast<unsigned long>(key.size()), static_cast<unsigned long>(length));
+	fwrite(key.data(), 1, key.size(), m_file);
+	fwrite(value, 1, length, m_file);
+	fputc('\n', m_file);
+	if(ferror(m_file)) {
+		throw EXCEPTION(("Could not write %s: %s", m_fileName.c_str(), strerror(errno)));
+	}
+}
+
+void Recorder::Write(std::string const& key, FileContents const& value)
+{
+	ScopedLock lock(m_mutex);
+	if(!m_written.insert(key).second) {
+		return;
+	}
+
+	fprintf(m_file, "%lu %llu\n", static_cast<unsigned long>(key.size()), value.Size());
+	fwrite(key.data(), 1, key.size(), m_file);
+	value.WriteTo(m_file);
+	fputc('\n', m_file);
+	if(ferror(m_file)) {
+		throw EXCEPTION(("Could not write %s: %s", m_fileName.c_str(), strerror(errno)));
+	}
+}
@@ -0,0 +1,450 @@
+#include "RecordingSession.h"
+#include "Recording.h"
+#include "FileContents.h"
+#include "Exception.h"
+
+extern "C" {
+#include <apr_hash.h>
+#include <svn_delta.h>
+#include <svn_io.h>
+#include <svn_string.h>
+}
+
+static void EncodeProps(Recording::Encoder& encoder, apr_hash_t* props, apr_pool_t* pool)
+{
+	encoder.Int(props? apr_hash_count(props) : 0);
+	for(apr_hash_index_t* index = props? apr_hash_first(pool, props) : NULL; index; index = apr_hash_next(index)) {
+		void const* key;
+		apr_ssize_t keyLength;
+		void* value;
+		apr_hash_this(index, &key, &keyLength, &value);
+		svn_string_t const* string = static_cast<svn_string_t const*>(value);
+		encoder.String(static_cast<char const*>(key), keyLength);
+		encoder.String(string->data, string->len);
+	}
+}
+
+RecordingSession::RecordingSession(Session* session, Recorder* recorder) :
+	m_session(session),
+	m_recorder(recorder)
+{
+	m_subtree = m_session->GetSubtree();
+	m_recorder->Write(Recording::Key("subtree", -1), m_subtree);
+}
+
+RecordingSession::~RecordingSession()
+{
+	delete m_session;
+}
+
+svn_revnum_t RecordingSession::GetLatestRevision()
+{
+	svn_revnum_t revision = m_session->GetLatestRevision();
+	std::string value;
+	Recording::Encoder(value).Int(revision);
+	// A later export of the same recording wants the latest answer.
+	m_recorder->Write(Recording::Key("latest", -1), value, true);
+	return revision;
+}
+
+svn_node_kind_t RecordingSession::CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool)
+{
+	svn_node_kind_t kind = m_session->CheckPath(relPath, revision, pool);
+	std::string value;
+	Recording::Encoder(value).Int(kind);
+	m_recorder->Write(Recording::Key("check", revision, relPath), value);
+	return kind;
+}
+
+void RecordingSession::GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool)
+{
+	size_t first = entries.size();
+	m_session->GetDirectory(relPath, revision, entries, pool);
+
+	std::string value;
+	Recording::Encoder encoder(value);
+	encoder.Int(entries.size() - first);
+	for(size_t i = first; i < entries.size(); ++i) {
+		encoder.Char(entries[i].second? 'd' : 'f');
+		encoder.String(entries[i].first);
+	}
+	m_recorder->Write(Recording::Key("dir", revision, relPath), value);
+}
+
+void RecordingSession::GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool)
+{
+	std::string key(Recording::Key("file", revision, relPath));
+	if(m_recorder->Written(key)) {
+		m_session->GetFile(relPath, revision, stream, pool);
+		return;
+	}
+
+	// Kept until it has all arrived, so a failed fetch isn't recorded;
+	// large files are spooled to disk rather than held in memory.
+	FileContents contents;
+	m_session->GetFile(relPath, revision, svn_stream_tee(stream, contents.Stream(pool), pool), pool);
+	m_recorder->Write(key, contents);
+}
+
+bool RecordingSession::BorrowFile(char const* relPath, svn_revnum_t revision, char const** data, size_t* length)
+{
+	if(!m_session->BorrowFile(relPath, revision, data, length)) {
+		return false;
+	}
+	m_recorder->Write(Recording::Key("file", revision, relPath), *data, *length);
+	return true;
+}
+
+struct RecordLogBaton
+{
+	svn_log_entry_receiver_t m_receiver;
+	void* m_baton;
+	std::string m_log;
+};
+
+static svn_error_t* RecordLogEntry(void* batonData, svn_log_entry_t* entry, apr_pool_t* pool)
+{
+	RecordLogBaton* baton = static_cast<RecordLogBaton*>(batonData);
+	Recording::Encoder encoder(baton->m_log);
+	encoder.Int(entry->revision);
+	EncodeProps(encoder, entry->revprops, pool);
+
+	apr_hash_t* changes = entry->changed_paths2;
+	encoder.Int(changes? apr_hash_count(changes) : 0);
+	for(apr_hash_index_t* index = changes? apr_hash_first(pool, changes) : NULL; index; index = apr_hash_next(index)) {
+		void const* key;
+		apr_ssize_t keyLength;
+		void* value;
+		apr_hash_this(index, &key, &keyLength, &value);
+		svn_log_changed_path2_t const* change = static_cast<svn_log_changed_path2_t const*>(value);
+		encoder.String(static_cast<char const*>(key), keyLength);
+		encoder.Char(change->action);
+		encoder.String(change->copyfrom_path);
+		encoder.Int(change->copyfrom_rev);
+		encoder.Int(change->node_kind);
+	}
+
+	return baton->m_receiver(baton->m_baton, entry, pool);
+}
+
+void RecordingSession::GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool)
+{
+	RecordLogBaton logBaton;
+	logBaton.m_receiver = receiver;
+	logBaton.m_baton = baton;
+	m_session->GetLog(paths, from, to, &RecordLogEntry, &logBaton, pool);
+	m_recorder->Write(Recording::LogKey(paths, from, to), logBaton.m_log);
+}
+
+// Each replayed revision's drive is recorded as a sequence of operations,
+// one letter and then its arguments; see PlaybackSession::Replay().
+// Batons are numbered in the order they were made, from 0 for the root.
+struct RecordReplayBaton
+{
+	svn_ra_replay_revstart_callback_t m_revStart;
+	svn_ra_replay_revfinish_callback_t m_revFinish;
+	void* m_baton;
+	Recorder* m_recorder;
+	char const* m_request;
+	// The drive of the revision being replayed.
+	std::string m_drive;
+};
+
+struct RecordEditBaton
+{
+	RecordReplayBaton* m_replay;
+	svn_delta_editor_t const* m_editor;
+	void* m_editBaton;
+	long m_nextId;
+};
+
+struct RecordNodeBaton
+{
+	RecordEditBaton* m_edit;
+	long m_id;
+	void* m_baton;
+};
+
+struct RecordWindowBaton
+{
+	RecordEditBaton* m_edit;
+	long m_id;
+	svn_txdelta_window_handler_t m_handler;
+	void* m_baton;
+};
+
+static RecordNodeBaton* MakeNodeBaton(RecordEditBaton* edit, void* baton, apr_pool_t* pool)
+{
+	RecordNodeBaton* node = static_cast<RecordNodeBaton*>(apr_palloc(pool, sizeof(RecordNodeBaton)));
+	node->m_edit = edit;
+	node->m_id = edit->m_nextId++;
+	node->m_baton = baton;
+	return node;
+}
+
+static Recording::Encoder Op(RecordEditBaton* edit, char op)
+{
+	Recording::Encoder encoder(edit->m_replay->m_drive);
+	encoder.Char(op);
+	return encoder;
+}
+
+static svn_error_t* RecordSetTargetRevision(void* editBaton, svn_revnum_t revision, apr_pool_t* pool)
+{
+	RecordEditBaton* edit = static_cast<RecordEditBaton*>(editBaton);
+	Op(edit, 'S').Int(revision);
+	return edit->m_editor->set_target_revision(edit->m_editBaton, revision, pool);
+}
+
+static svn_error_t* RecordOpenRoot(void* editBaton, svn_revnum_t baseRevision, apr_pool_t* pool, void** rootBaton)
+{
+	RecordEditBaton* edit = static_cast<RecordEditBaton*>(editBaton);
+	Op(edit, 'R').Int(baseRevision);
+	void* baton;
+	SVN_ERR(edit->m_editor->open_root(edit->m_editBaton, baseRevision, pool, &baton));
+	*rootBaton = MakeNodeBaton(edit, baton, pool);
+	return SVN_NO_ERROR;
+}
+
+static svn_error_t* RecordDeleteEntry(char const* path, svn_revnum_t revision, void* parentBaton, apr_pool_t* pool)
+{
+	RecordNodeBaton* parent = static_cast<RecordNodeBaton*>(parentBaton);
+	Recording::Encoder encoder(Op(parent->m_edit, 'd'));
+	encoder.String(path);
+	encoder.Int(revision);
+	encoder.Int(parent->m_id);
+	return parent->m_edit->m_editor->delete_entry(path, revision, parent->m_baton, pool);
+}
+
+static svn_error_t* RecordAddDirectory(char const* path, void* parentBaton, char const* copyFromPath, svn_revnum_t copyFromRevision, apr_pool_t* pool, void** childBaton)
+{
+	RecordNodeBaton* parent = static_cast<RecordNodeBaton*>(parentBaton);
+	Recording::Encoder encoder(Op(parent->m_edit, 'A'));
+	encoder.String(path);
+	encoder.Int(parent->m_id);
+	encoder.String(copyFromPath);
+	encoder.Int(copyFromRevision);
+	void* baton;
+	SVN_ERR(parent->m_edit->m_editor->add_directory(path, parent->m_baton, copyFromPath, copyFromRevision, pool, &baton));
+	*childBaton = MakeNodeBaton(parent->m_edit, baton, pool);
+	return SVN_NO_ERROR;
+}
+
+static svn_error_t* RecordOpenDirectory(char const* path, void* parentBaton, svn_revnum_t baseRevision, apr_pool_t* pool, void** childBaton)
+{
+	RecordNodeBaton* parent = static_cast<RecordNodeBaton*>(parentBaton);
+	Recording::Encoder encoder(Op(parent->m_edit, 'O'));
+	encoder.String(path);
+	encoder.Int(parent->m_id);
+	encoder.Int(baseRevision);
+	void* baton;
+	SVN_ERR(parent->m_edit->m_editor->open_directory(path, parent->m_baton, baseRevision, pool, &baton));
+	*childBaton = MakeNodeBaton(parent->m_edit, baton, pool);
+	return SVN_NO_ERROR;
+}
+
+static svn_error_t* RecordChangeDirProp(void* dirBaton, char const* name, svn_string_t const* value, apr_pool_t* pool)
+{
+	RecordNodeBaton* dir = static_cast<RecordNodeBaton*>(dirBaton);
+	Recording::Encoder encoder(Op(dir->m_edit, 'P'));
+	encoder.Int(dir->m_id);
+	encoder.String(name);
+	if(value) {
+		encoder.String(value->data, value->len);
+	} else {
+		encoder.String(NULL);
+	}
+	return dir->m_edit->m_editor->change_dir_prop(dir->m_baton, name, value, pool);
+}
+
+static svn_error_t* RecordCloseDirectory(void* dirBaton, apr_pool_t* pool)
+{
+	RecordNodeBaton* dir = static_cast<RecordNodeBaton*>(dirBaton);
+	Op(dir->m_edit, 'C').Int(dir->m_id);
+	return dir->m_edit->m_editor->close_directory(dir->m_baton, pool);
+}
+
+static svn_error_t* RecordAbsentDirectory(char const* path, void* parentBaton, apr_pool_t* pool)
+{
+	RecordNodeBaton* parent = static_cast<RecordNodeBaton*>(parentBaton);
+	Recording::Encoder encoder(Op(parent->m_edit, 'x'));
+	encoder.String(path);
+	encoder.Int(parent->m_id);
+	return parent->m_edit->m_editor->absent_directory(path, parent->m_baton, pool);
+}
+
+static svn_error_t* RecordAddFile(char const* path, void* parentBaton, char const* copyFromPath, svn_revnum_t copyFromRevision, apr_pool_t* pool, void** fileBaton)
+{
+	RecordNodeBaton* parent = static_cast<RecordNodeBaton*>(parentBaton);
+	Recording::Encoder encoder(Op(parent->m_edit, 'a'));
+	encoder.String(path);
+	encoder.Int(parent->m_id);
+	encoder.String(copyFromPath);
+	encoder.Int(copyFromRevision);
+	void* baton;
+	SVN_ERR(parent->m_edit->m_editor->add_file(path, parent->m_baton, copyFromPath, copyFromRevision, pool, &baton));
+	*fileBaton = MakeNodeBaton(parent->m_edit, baton, pool);
+	return SVN_NO_ERROR;
+}
+
+static svn_error_t* RecordOpenFile(char const* path, void* parentBaton, svn_revnum_t baseRevision, apr_pool_t* pool, void** fileBaton)
+{
+	RecordNodeBaton* parent = static_cast<RecordNodeBaton*>(parentBaton);
+	Recording::Encoder encoder(Op(parent->m_edit, 'o'));
+	encoder.String(path);
+	encoder.Int(parent->m_id);
+	encoder.Int(baseRevision);
+	void* baton;
+	SVN_ERR(parent->m_edit->m_editor->open_file(path, parent->m_baton, baseRevision, pool, &baton));
+	*fileBaton = MakeNodeBaton(parent->m_edit, baton, pool);
+	return SVN_NO_ERROR;
+}
+
+static svn_error_t* RecordWindow(svn_txdelta_window_t* window, void* batonData)
+{
+	RecordWindowBaton* baton = static_cast<RecordWindowBaton*>(batonData);
+	Recording::Encoder encoder(Op(baton->m_edit, 'W'));
+	encoder.Int(baton->m_id);
+	encoder.Int(window != NULL);
+	if(window) {
+		encoder.Int(window->sview_offset);
+		encoder.Int(window->sview_len);
+		encoder.Int(window->tview_len);
+		encoder.Int(window->src_ops);
+		encoder.Int(window->num_ops);
+		for(int i = 0; i < window->num_ops; ++i) {
+			encoder.Int(window->ops[i].action_code);
+			encoder.Int(window->ops[i].offset);
+			encoder.Int(window->ops[i].length);
+		}
+		if(window->new_data) {
+			encoder.String(window->new_data->data, window->new_data->len);
+		} else {
+			encoder.String(NULL);
+		}
+	}
+	return baton->m_handler(window, baton->m_baton);
+}
+
+static svn_error_t* RecordApplyTextDelta(void* fileBaton, char const* baseChecksum, apr_pool_t* pool, svn_txdelta_window_handler_t* handler, void** handlerBaton)
+{
+	RecordNodeBaton* file = static_cast<RecordNodeBaton*>(fileBaton);
+	Recording::Encoder encoder(Op(file->m_edit, 'T'));
+	encoder.Int(file->m_id);
+	encoder.String(baseChecksum);
+
+	RecordWindowBaton* baton = static_cast<RecordWindowBaton*>(apr_palloc(pool, sizeof(RecordWindowBaton)));
+	baton->m_edit = file->m_edit;
+	baton->m_id = file->m_id;
+	SVN_ERR(file->m_edit->m_editor->apply_textdelta(file->m_baton, baseChecksum, pool, &baton->m_handler, &baton->m_baton));
+	*handler = &RecordWindow;
+	*handlerBaton = baton;
+	return SVN_NO_ERROR;
+}
+
+static svn_error_t* RecordChangeFileProp(void* fileBaton, char const* name, svn_string_t const* value, apr_pool_t* pool)
+{
+	RecordNodeBaton* file = static_cast<RecordNodeBaton*>(fileBaton);
+	Recording::Encoder encoder(Op(file->m_edit, 'p'));
+	encoder.Int(file->m_id);
+	encoder.String(name);
+	if(value) {
+		encoder.String(value->data, value->len);
+	} else {
+		encoder.String(NULL);
+	}
+	return file->m_edit->m_editor->change_file_prop(file->m_baton, name, value, pool);
+}
+
+static svn_error_t* RecordCloseFile(void* fileBaton, char const* textChecksum, apr_pool_t* pool)
+{
+	RecordNodeBaton* file = static_cast<RecordNodeBaton*>(fileBaton);
+	Recording::Encoder encoder(Op(file->m_edit, 'c'));
+	encoder.Int(file->m_id);
+	encoder.String(textChecksum);
+	return file->m_edit->m_editor->close_file(file->m_baton, textChecksum, pool);
+}
+
+static svn_error_t* RecordAbsentFile(char const* path, void* parentBaton, apr_pool_t* pool)
+{
+	RecordNodeBaton* parent = static_cast<RecordNodeBaton*>(parentBaton);
+	Recording::Encoder encoder(Op(parent->m_edit, 'X'));
+	encoder.String(path);
+	encoder.Int(parent->m_id);
+	return parent->m_edit->m_editor->absent_file(path, parent->m_baton, pool);
+}
+
+static svn_error_t* RecordCloseEdit(void* editBaton, apr_pool_t* pool)
+{
+	RecordEditBaton* edit = static_cast<RecordEditBaton*>(editBaton);
+	Op(edit, 'E');
+	return edit->m_editor->close_edit(edit->m_editBaton, pool);
+}
+
+static svn_error_t* RecordAbortEdit(void* editBaton, apr_pool_t* pool)
+{
+	RecordEditBaton* edit = static_cast<RecordEditBaton*>(editBaton);
+	Op(edit, 'B');
+	return edit->m_editor->abort_edit(edit->m_editBaton, pool);
+}
+
+static svn_error_t* RecordRevStart(svn_revnum_t revision, void* batonData, svn_delta_editor_t const** editor, void** editBaton, apr_hash_t* revProps, apr_pool_t* pool)
+{
+	RecordReplayBaton* baton = static_cast<RecordReplayBaton*>(batonData);
+	baton->m_drive.clear();
+	Recording::Encoder encoder(baton->m_drive);
+	EncodeProps(encoder, revProps, pool);
+
+	RecordEditBaton* edit = static_cast<RecordEditBaton*>(apr_palloc(pool, sizeof(RecordEditBaton)));
+	edit->m_replay = baton;
+	edit->m_nextId = 0;
+	SVN_ERR(baton->m_revStart(revision, baton->m_baton, &edit->m_editor, &edit->m_editBaton, revProps, pool));
+
+	svn_delta_editor_t* recorder = svn_delta_default_editor(pool);
+	recorder->set_target_revision = &RecordSetTargetRevision;
+	recorder->open_root = &RecordOpenRoot;
+	recorder->delete_entry = &RecordDeleteEntry;
+	recorder->add_directory = &RecordAddDirectory;
+	recorder->open_directory = &RecordOpenDirectory;
+	recorder->change_dir_prop = &RecordChangeDirProp;
+	recorder->close_directory = &RecordCloseDirectory;
+	recorder->absent_directory = &RecordAbsentDirectory;
+	recorder->add_file = &RecordAddFile;
+	recorder->open_file = &RecordOpenFile;
+	recorder->apply_textdelta = &RecordApplyTextDelta;
+	recorder->change_file_prop = &RecordChangeFileProp;
+	recorder->close_file = &RecordCloseFile;
+	recorder->absent_file = &RecordAbsentFile;
+	recorder->close_edit = &RecordCloseEdit;
+	recorder->abort_edit = &RecordAbortEdit;
+
+	*editor = recorder;
+	*editBaton = edit;
+	return SVN_NO_ERROR;
+}
+
+static svn_error_t* RecordRevFinish(svn_revnum_t revision, void* batonData, svn_delta_editor_t const* editor, void* editBaton, apr_hash_t* revProps, apr_pool_t* pool)
+{
+	RecordReplayBaton* baton = static_cast<RecordReplayBaton*>(batonData);
+	RecordEditBaton* edit = static_cast<RecordEditBaton*>(editBaton);
+	SVN_ERR(baton->m_revFinish(revision, baton->m_baton, edit->m_editor, edit->m_editBaton, revProps, pool));
+
+	try {
+		baton->m_recorder->Write(Recording::Key(baton->m_request, revision), baton->m_drive);
+	} catch(std::exception const& e) {
+		return svn_error_create(APR_EGENERAL, NULL, e.what());
+	}
+	return SVN_NO_ERROR;
+}
+
+void RecordingSession::Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool)
+{
+	RecordReplayBaton replayBaton;
+	replayBaton.m_revStart = revStart;
+	replayBaton.m_revFinish = revFinish;
+	replayBaton.m_baton = baton;
+	replayBaton.m_recorder = m_recorder;
+	// Replays with and without deltas drive the editor differently.
+	replayBaton.m_request = sendDeltas? "replay-deltas" : "replay";
+	m_session->Replay(from, to, sendDeltas, &RecordRevStart, &RecordRevFinish, &replayBaton, pool);
+}
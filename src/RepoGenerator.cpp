@@ -0,0 +1,230 @@
+// Writes a synthetic repository history to stdout as an svnadmin dump, for
+// loading into a file:// repository (or reading as a dump:// one) to run
+// exports against.
+//
+//   repo-generator [revisions] [files] [file size] [depth] [changes]
+//                  [branch every] [tag every] [seed]
+//
+// r1 creates trunk with the given number of files, in directories nested
+// depth deep.  Every revision after that changes a number of files in trunk
+// and adds one, and changes one on the newest branch if there is one.
+// Every so often trunk is copied whole to a new branch or tag; 0 never
+// does.  File sizes vary around the given size.  The same arguments always
+// give the same dump.  Defaults are 1000 revisions of 10 changes to 1000
+// 4KB files 4 deep, with a branch every 100 revisions and a tag every 250.
+//
+// A summary goes to stderr.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <set>
+#include <string>
+
+// Fan out of each directory level.
+#define FANOUT (8)
+// Contents are slices of this much random text.
+#define POOL_SIZE (4 << 20)
+
+static unsigned long long s_state = 88172645463325252ULL;
+
+// xorshift64, so that every platform generates the same history.
+static unsigned long long Random()
+{
+	s_state ^= s_state << 13;
+	s_state ^= s_state >> 7;
+	s_state ^= s_state << 17;
+	return s_state;
+}
+
+static std::string s_textPool;
+
+// Lines of words, which compress about as well as source code does.
+static void MakeTextPool()
+{
+	static char const* const words[] = {
+		"int", "return", "if", "else", "for", "while", "const", "static", "void", "char",
+		"std::string", "size_t", "result", "index", "count", "buffer", "length", "value", "node", "error",
+		"=", "==", "+", "(", ")", "{", "}", ";", "->", "0", "1", "NULL"
+	};
+	s_textPool.reserve(POOL_SIZE + 128);
+	while(s_textPool.size() < POOL_SIZE) {
+		unsigned int indent = Random() % 4;
+		s_textPool.append(indent, '\t');
+		unsigned int count = 1 + Random() % 10;
+		for(unsigned int i = 0; i < count; ++i) {
+			s_textPool.append(words[Random() % (sizeof(words) / sizeof(words[0]))]);
+			s_textPool.push_back(i + 1 < count? ' ' : '\n');
+		}
+	}
+}
+
+static std::string FilePath(unsigned long i, unsigned int depth)
+{
+	char name[32];
+	std::string path;
+	unsigned long long h = i * 2654435761ULL;
+	for(unsigned int level = 0; level < depth; ++level) {
+		snprintf(name, sizeof(name), "dir%llu/", (h >> (level * 3)) % FANOUT);
+		path.append(name);
+	}
+	snprintf(name, sizeof(name), "file%lu.c", i);
+	path.append(name);
+	return path;
+}
+
+static unsigned long long s_textBytes = 0;
+
+static void WriteProps(std::string& out, char const* const* props, unsigned int count)
+{
+	char line[64];
+	for(unsigned int i = 0; i < count; ++i) {
+		snprintf(line, sizeof(line), "%c %lu\n", i % 2? 'V' : 'K', static_cast<unsigned long>(strlen(props[i])));
+		out.append(line);
+		out.append(props[i]);
+		out.push_back('\n');
+	}
+	out.append("PROPS-END\n");
+}
+
+static void WriteRevision(unsigned long revision, char const* log)
+{
+	char date[64];
+	// A commit a minute from 2010.
+	time_t when = 1262304000 + revision * 60;
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S.000000Z", gmtime(&when));
+
+	std::string props;
+	char const* const values[] = { "svn:author", "generator", "svn:date", date, "svn:log", log };
+	WriteProps(props, values, revision? 6 : 4);
+
+	printf("Revision-number: %lu\nProp-content-length: %lu\nContent-length: %lu\n\n%s\n", revision, static_cast<unsigned long>(props.size()), static_cast<unsigned long>(props.size()), props.c_str());
+}
+
+static void WriteDirectory(std::string const& path, char const* copyFrom, unsigned long copyFromRev)
+{
+	printf("Node-path: %s\nNode-kind: dir\nNode-action: add\n", path.c_str());
+	if(copyFrom) {
+		printf("Node-copyfrom-rev: %lu\nNode-copyfrom-path: %s\n", copyFromRev, copyFrom);
+	}
+	printf("\n\n");
+}
+
+static void WriteFile(std::string const& path, char const* action, unsigned long revision, unsigned long size)
+{
+	// A slice of the pool, with a line making this version unique.
+	char header[128];
+	int headerLength = snprintf(header, sizeof(header), "// %s r%lu\n", path.c_str(), revision);
+	size_t offset = Random() % (s_textPool.size() - size);
+	unsigned long length = headerLength + size;
+
+	printf("Node-path: %s\nNode-kind: file\nNode-action: %s\nText-content-length: %lu\nContent-length: %lu\n\n", path.c_str(), action, length, length);
+	fwrite(header, 1, headerLength, stdout);
+	fwrite(s_textPool.data() + offset, 1, size, stdout);
+	printf("\n\n");
+	s_textBytes += length;
+}
+
+// Adds any directories above path not added yet.
+static void WriteParents(std::string const& path, std::set<std::string>& directories)
+{
+	for(size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+		std::string directory(path.substr(0, slash));
+		if(directories.insert(directory).second) {
+			WriteDirectory(directory, NULL, 0);
+		}
+	}
+}
+
+static unsigned long FileSize(unsigned long mean)
+{
+	// Anywhere from half to one and a half times the mean.
+	return mean? mean / 2 + Random() % (mean + 1) : 0;
+}
+
+int main(int argc, char** argv)
+{
+	int arg = 1;
+	unsigned long revisions = argc > arg? strtoul(argv[arg++], NULL, 10) : 1000;
+	unsigned long files = argc > arg? strtoul(argv[arg++], NULL, 10) : 1000;
+	unsigned long fileSize = argc > arg? strtoul(argv[arg++], NULL, 10) : 4096;
+	unsigned int depth = argc > arg? strtoul(argv[arg++], NULL, 10) : 4;
+	unsigned long changes = argc > arg? strtoul(argv[arg++], NULL, 10) : 10;
+	unsigned long branchEvery = argc > arg? strtoul(argv[arg++], NULL, 10) : 100;
+	unsigned long tagEvery = argc > arg? strtoul(argv[arg++], NULL, 10) : 250;
+	if(argc > arg) {
+		s_state += strtoull(argv[arg++], NULL, 10);
+	}
+	if(fileSize > POOL_SIZE / 2) {
+		fprintf(stderr, "File size is limited to %d bytes\n", POOL_SIZE / 2);
+		return 1;
+	}
+
+	MakeTextPool();
+
+	printf("SVN-fs-dump-format-version: 2\n\n");
+	WriteRevision(0, NULL);
+
+	std::set<std::string> directories;
+	unsigned long branches = 0;
+	unsigned long tags = 0;
+	// How many files the newest branch was copied with.
+	unsigned long branchFiles = 0;
+	std::string branch;
+
+	WriteRevision(1, "Initial import");
+	directories.insert("trunk");
+	directories.insert("branches");
+	directories.insert("tags");
+	WriteDirectory("trunk", NULL, 0);
+	WriteDirectory("branches", NULL, 0);
+	WriteDirectory("tags", NULL, 0);
+	for(unsigned long i = 0; i < files; ++i) {
+		std::string path("trunk/" + FilePath(i, depth));
+		WriteParents(path, directories);
+		WriteFile(path, "add", 1, FileSize(fileSize));
+	}
+
+	for(unsigned long r = 2; r <= revisions; ++r) {
+		char name[64];
+		if(branchEvery && r % branchEvery == 0) {
+			snprintf(name, sizeof(name), "branches/branch%lu", ++branches);
+			WriteRevision(r, "Branch");
+			WriteDirectory(name, "trunk", r - 1);
+			branch = name;
+			branchFiles = files;
+			continue;
+		}
+		if(tagEvery && r % tagEvery == 0) {
+			snprintf(name, sizeof(name), "tags/tag%lu", ++tags);
+			WriteRevision(r, "Tag");
+			WriteDirectory(name, "trunk", r - 1);
+			continue;
+		}
+
+		WriteRevision(r, "Change some files");
+		// Distinct files, as a path can only be changed once per revision.
+		std::set<unsigned long> changed;
+		for(unsigned long c = 0; c < changes && c < files; ++c) {
+			changed.insert(Random() % files);
+		}
+		for(std::set<unsigned long>::const_iterator it = changed.begin(); it != changed.end(); ++it) {
+			WriteFile("trunk/" + FilePath(*it, depth), "change", r, FileSize(fileSize));
+		}
+
+		std::string path("trunk/" + FilePath(files, depth));
+		WriteParents(path, directories);
+		WriteFile(path, "add", r, FileSize(fileSize));
+		files += 1;
+
+		if(branchFiles) {
+			WriteFile(branch + "/" + FilePath(Random() % branchFiles, depth), "change", r, FileSize(fileSize));
+		}
+	}
+
+	fflush(stdout);
+	fprintf(stderr, "%lu revisions, %lu files in trunk, %lu branches, %lu tags, %llu MB of file text\n", revisions, files, branches, tags, s_textBytes >> 20);
+
+	return 0;
+}
@@ -0,0 +1,312 @@
+#include "RepoTree.h"
+
+RepoTree::RepoTree(Lister& lister, svn_revnum_t baseRevision) :
+	m_lister(lister),
+	m_previous(NULL)
+{
+	if(SVN_IS_VALID_REVNUM(baseRevision)) {
+		m_root = Unloaded("", baseRevision, baseRevision);
+	} else {
+		m_root = new Node(true, 0);
+	}
+}
+
+RepoTree::~RepoTree()
+{
+	if(m_previous) {
+		Release(m_previous);
+	}
+	Release(m_root);
+}
+
+void RepoTree::StartRevision()
+{
+	if(m_previous) {
+		Release(m_previous);
+	}
+	// Changes unshare the root, so this keeps its current state.
+	m_previous = m_root;
+	m_previous->m_refs += 1;
+}
+
+RepoTree::Node* RepoTree::Unloaded(std::string const& path, svn_revnum_t loadRevision, svn_revnum_t revision)
+{
+	Node* node = new Node(true, revision);
+	node->m_loaded = false;
+	node->m_loadPath = path;
+	node->m_loadRevision = loadRevision;
+	return node;
+}
+
+void RepoTree::Release(Node* node)
+{
+	if(--node->m_refs == 0) {
+		for(Node::Children::iterator it = node->m_children.begin(); it != node->m_children.end(); ++it) {
+			Release(it->second);
+		}
+		delete node;
+	}
+}
+
+void RepoTree::Unshare(Node*& node)
+{
+	if(node->m_refs > 1) {
+		Node* copy = new Node(*node);
+		copy->m_refs = 1;
+		for(Node::Children::iterator it = copy->m_children.begin(); it != copy->m_children.end(); ++it) {
+			it->second->m_refs += 1;
+		}
+		node->m_refs -= 1;
+		node = copy;
+	}
+}
+
+void RepoTree::Load(Node* node)
+{
+	if(node->m_loaded) {
+		return;
+	}
+
+	// Loading doesn't change what the node represents, so shared nodes can
+	// be loaded in place.
+	std::vector<std::pair<std::string, bool> > entries;
+	m_lister.List(node->m_loadPath, node->m_loadRevision, entries);
+
+	for(std::vector<std::pair<std::string, bool> >::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+		Node* child;
+		if(it->second) {
+			std::string path(node->m_loadPath);
+			if(path.size()) {
+				path.append("/");
+			}
+			path.append(it->first);
+			child = Unloaded(path, node->m_loadRevision, node->m_created);
+		} else {
+			child = new Node(false, node->m_created);
+		}
+		node->m_children[it->first] = child;
+	}
+
+	node->m_loaded = true;
+	node->m_loadPath.clear();
+}
+
+RepoTree::Node* RepoTree::Find(Node* root, std::string const& relPath, bool checkCreated, svn_revnum_t revision)
+{
+	Node* node = root;
+	std::string::size_type start = 0;
+	while(node) {
+		if(checkCreated && node->m_created > revision) {
+			return NULL;
+		}
+		if(start >= relPath.size()) {
+			break;
+		}
+
+		std::string::size_type end = relPath.find('/', start);
+		if(end == std::string::npos) {
+			end = relPath.size();
+		}
+
+		Load(node);
+		Node::Children::const_iterator it = node->m_children.find(relPath.substr(start, end - start));
+		node = (it == node->m_children.end())? NULL : it->second;
+		start = end + 1;
+	}
+
+	return node;
+}
+
+RepoTree::Node* RepoTree::MutableParent(std::string const& relPath, svn_revnum_t revision, std::string& name)
+{
+	// Load before unsharing so a shared directory is only listed once.
+	Load(m_root);
+	Unshare(m_root);
+	m_root->m_changed = revision;
+
+	Node* dir = m_root;
+	std::string::size_type start = 0;
+	std::string::size_type end;
+	while((end = relPath.find('/', start)) != std::string::npos) {
+		std::string component(relPath.substr(start, end - start));
+		Node::Children::iterator it = dir->m_children.find(component);
+		if(it == dir->m_children.end() || !it->second->m_isDirectory) {
+			// Parent directories which were added without being recorded.
+			if(it != dir->m_children.end()) {
+				Release(it->second);
+				dir->m_children.erase(it);
+			}
+			it = dir->m_children.insert(Node::Children::value_type(component, new Node(true, revision))).first;
+		}
+
+		Load(it->second);
+		Unshare(it->second);
+		dir = it->second;
+		dir->m_changed = revision;
+		start = end + 1;
+	}
+
+	name = relPath.substr(start);
+	return dir;
+}
+
+void RepoTree::Insert(std::string const& relPath, svn_revnum_t revision, Node* node)
+{
+	std::string name;
+	Node* parent = MutableParent(relPath, revision, name);
+
+	Node::Children::iterator it = parent->m_children.find(name);
+	if(it != parent->m_children.end()) {
+		Release(it->second);
+		it->second = node;
+	} else {
+		parent->m_children[name] = node;
+	}
+}
+
+void RepoTree::AddFile(std::string const& relPath, svn_revnum_t revision)
+{
+	Insert(relPath, revision, new Node(false, revision));
+}
+
+void RepoTree::AddDirectory(std::string const& relPath, svn_revnum_t revision)
+{
+	Insert(relPath, revision, new Node(true, revision));
+}
+
+void RepoTree::Modify(std::string const& relPath, svn_revnum_t revision)
+{
+	std::string name;
+	Node* parent = MutableParent(relPath, revision, name);
+
+	Node::Children::iterator it = parent->m_children.find(name);
+	if(it == parent->m_children.end()) {
+		parent->m_children[name] = new Node(false, revision);
+	} else {
+		Unshare(it->second);
+		it->second->m_changed = revision;
+	}
+}
+
+void RepoTree::Delete(std::string const& relPath, svn_revnum_t revision)
+{
+	std::string name;
+	Node* parent = MutableParent(relPath, revision, name);
+
+	Node::Children::iterator it = parent->m_children.find(name);
+	if(it != parent->m_children.end()) {
+		Release(it->second);
+		parent->m_children.erase(it);
+	}
+}
+
+void RepoTree::Copy(std::string const& fromPath, svn_revnum_t fromRevision, std::string const& relPath, bool isDirectory, svn_revnum_t revision)
+{
+	Node* node;
+	Node* source = NULL;
+	if(fromPath.size()) {
+		Node* previous = m_previous? m_previous : m_root;
+		source = Find(previous, fromPath, true, fromRevision);
+		if(source && source->m_changed > fromRevision) {
+			source = NULL;
+		}
+	}
+
+	if(source && source->m_isDirectory == isDirectory) {
+		// Share the source's children; the copy itself is new.
+		Load(source);
+		node = new Node(*source);
+		node->m_refs = 1;
+		node->m_created = revision;
+		node->m_changed = revision;
+		for(Node::Children::iterator it = node->m_children.begin(); it != node->m_children.end(); ++it) {
+			it->second->m_refs += 1;
+		}
+	} else if(isDirectory) {
+		// The copy as it stands at the end of this revision.
+		node = Unloaded(relPath, revision, revision);
+	} else {
+		node = new Node(false, revision);
+	}
+
+	Insert(relPath, revision, node);
+}
+
+void RepoTree::Reload(std::string const& relPath, svn_revnum_t revision)
+{
+	if(relPath.empty()) {
+		Node* root = Unloaded(relPath, revision, m_root->m_created);
+		root->m_changed = revision;
+		Release(m_root);
+		m_root = root;
+		return;
+	}
+
+	std::string name;
+	Node* parent = MutableParent(relPath, revision, name);
+
+	Node* node = Unloaded(relPath, revision, revision);
+	Node::Children::iterator it = parent->m_children.find(name);
+	if(it != parent->m_children.end()) {
+		node->m_created = it->second->m_created;
+		Release(it->second);
+		it->second = node;
+	} else {
+		parent->m_children[name] = node;
+	}
+}
+
+bool RepoTree::ChangedSince(std::string const& relPath, svn_revnum_t revision)
+{
+	Node* node = Find(m_root, relPath, true, revision);
+	return node == NULL || node->m_changed > revision;
+}
+
+bool RepoTree::HasFiles(std::string const& relPath)
+{
+	Node* node = Find(m_root, relPath, false, SVN_INVALID_REVNUM);
+	if(node == NULL) {
+		return false;
+	}
+
+	std::vector<Node*> stack(1, node);
+	while(stack.size()) {
+		node = stack.back();
+		stack.pop_back();
+
+		if(!node->m_isDirectory) {
+			return true;
+		}
+
+		Load(node);
+		for(Node::Children::const_iterator it = node->m_children.begin(); it != node->m_children.end(); ++it) {
+			stack.push_back(it->second);
+		}
+	}
+
+	return false;
+}
+
+void RepoTree::ListFiles(std::string const& relPath, std::vector<std::string>& files)
+{
+	Node* node = Find(m_root, relPath, false, SVN_INVALID_REVNUM);
+	if(node && node->m_isDirectory) {
+		ListFiles(node, relPath, "", files);
+	}
+}
+
+void RepoTree::ListFiles(Node* node, std::string const& relPath, std::string const& prefix, std::vector<std::string>& files)
+{
+	Load(node);
+	for(Node::Children::const_iterator it = node->m_children.begin(); it != node->m_children.end(); ++it) {
+		std::string path(prefix + it->first);
+		if(it->second->m_isDirectory) {
+			std::string childPath(relPath.empty()? it->first : relPath + "/" + it->first);
+			if(!m_lister.Prune(childPath)) {
+				ListFiles(it->second, childPath, path + "/", files);
+			}
+		} else {
+			files.push_back(path);
+		}
+	}
+}
@@ -0,0 +1,180 @@
+#include "ReposSession.h"
+#include "Exception.h"
+
+#include <string.h>
+
+extern "C" {
+#include <apr_hash.h>
+#include <svn_dirent_uri.h>
+#include <svn_fs.h>
+#include <svn_pools.h>
+#include <svn_repos.h>
+}
+
+bool ReposSession::Handles(std::string const& url)
+{
+	return url.compare(0, 7, "file://") == 0;
+}
+
+ReposSession::ReposSession(std::string const& url, apr_pool_t* pool) :
+	m_pool(pool)
+{
+	svn_error_t* err;
+	char const* dirent;
+	if((err = svn_uri_get_dirent_from_file_url(&dirent, svn_uri_canonicalize(url.c_str(), m_pool), m_pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+
+	char const* root = svn_repos_find_root_path(dirent, m_pool);
+	if(root == NULL) {
+		throw EXCEPTION(("No repository found at %s", url.c_str()));
+	}
+	if((err = svn_repos_open2(&m_repos, root, NULL, m_pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	m_fs = svn_repos_fs(m_repos);
+
+	m_subtree = dirent + strlen(root);
+}
+
+std::string ReposSession::FsPath(char const* relPath) const
+{
+	if(relPath[0] == '\0') {
+		return m_subtree.empty()? "/" : m_subtree;
+	}
+	return m_subtree + "/" + relPath;
+}
+
+svn_revnum_t ReposSession::GetLatestRevision()
+{
+	svn_revnum_t rev;
+	svn_error_t* err;
+	if((err = svn_fs_youngest_rev(&rev, m_fs, m_pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	return rev;
+}
+
+svn_node_kind_t ReposSession::CheckPath(char const* relPath, svn_revnum_t revision, apr_pool_t* pool)
+{
+	svn_error_t* err;
+	svn_fs_root_t* root;
+	svn_node_kind_t kind;
+	if((err = svn_fs_revision_root(&root, m_fs, revision, pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	if((err = svn_fs_check_path(&kind, root, FsPath(relPath).c_str(), pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	return kind;
+}
+
+void ReposSession::GetDirectory(char const* relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries, apr_pool_t* pool)
+{
+	svn_error_t* err;
+	svn_fs_root_t* root;
+	apr_hash_t* dirents;
+	if((err = svn_fs_revision_root(&root, m_fs, revision, pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	if((err = svn_fs_dir_entries(&dirents, root, FsPath(relPath).c_str(), pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+
+	for(apr_hash_index_t* index = apr_hash_first(pool, dirents); index; index = apr_hash_next(index))
+	{
+		void const* key;
+		apr_ssize_t keyLen;
+		void* val;
+		apr_hash_this(index, &key, &keyLen, &val);
+
+		char const* path = static_cast<char const*>(key);
+		svn_fs_dirent_t* info = static_cast<svn_fs_dirent_t*>(val);
+
+		switch(info->kind)
+		{
+			case svn_node_file:
+				entries.push_back(std::make_pair(std::string(path), false));
+				break;
+			case svn_node_dir:
+				entries.push_back(std::make_pair(std::string(path), true));
+				break;
+			default:
+				ERROR(("Unknown file kind: \"%s\" in directory \"%s\"", path, relPath));
+		}
+	}
+}
+
+void ReposSession::GetFile(char const* relPath, svn_revnum_t revision, svn_stream_t* stream, apr_pool_t* pool)
+{
+	svn_error_t* err;
+	svn_fs_root_t* root;
+	svn_stream_t* contents;
+	if((err = svn_fs_revision_root(&root, m_fs, revision, pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	if((err = svn_fs_file_contents(&contents, root, FsPath(relPath).c_str(), pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	// The caller closes its own stream.
+	if((err = svn_stream_copy3(contents, svn_stream_disown(stream, pool), NULL, NULL, pool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+}
+
+void ReposSession::GetLog(apr_array_header_t const* paths, svn_revnum_t from, svn_revnum_t to, svn_log_entry_receiver_t receiver, void* baton, apr_pool_t* pool)
+{
+	svn_error_t* err;
+	apr_array_header_t* fsPaths = apr_array_make(pool, paths? paths->nelts : 1, sizeof(char const*));
+	if(paths) {
+		for(int i = 0; i < paths->nelts; ++i) {
+			char const* path = APR_ARRAY_IDX(paths, i, char const*);
+			APR_ARRAY_PUSH(fsPaths, char const*) = apr_pstrdup(pool, FsPath(path).c_str());
+		}
+	} else {
+		APR_ARRAY_PUSH(fsPaths, char const*) = apr_pstrdup(pool, FsPath("").c_str());
+	}
+
+	if((err = svn_repos_get_logs4(
+		m_repos,
+		fsPaths,
+		from,
+		to,
+		0, // No limit
+		1, // Generate a list of changed paths
+		0, // Don't follow copies
+		0, // No merge info
+		NULL, // All revprops
+		NULL, // No authz
+		NULL,
+		receiver,
+		baton,
+		pool
+	))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+}
+
+void ReposSession::Replay(svn_revnum_t from, svn_revnum_t to, bool sendDeltas, svn_ra_replay_revstart_callback_t revStart, svn_ra_replay_revfinish_callback_t revFinish, void* baton, apr_pool_t* pool)
+{
+	// As svn_ra_replay_range() does over ra_local, one revision at a time.
+	std::string baseDir = FsPath("");
+	apr_pool_t* iterPool = svn_pool_create(pool);
+	for(svn_revnum_t rev = from; rev <= to; ++rev) {
+		svn_pool_clear(iterPool);
+
+		svn_error_t* err;
+		apr_hash_t* revProps;
+		svn_delta_editor_t const* editor;
+		void* editBaton;
+		svn_fs_root_t* root;
+		if((err = svn_fs_revision_proplist(&revProps, m_fs, rev, iterPool))
+			|| (err = revStart(rev, baton, &editor, &editBaton, revProps, iterPool))
+			|| (err = svn_fs_revision_root(&root, m_fs, rev, iterPool))
+			|| (err = svn_repos_replay2(root, baseDir.c_str(), 0, sendDeltas, editor, editBaton, NULL, NULL, iterPool))
+			|| (err = revFinish(rev, baton, editor, editBaton, revProps, iterPool))) {
+			throw EXCEPTION(("SVN Error: %s", err->message));
+		}
+	}
+	svn_pool_destroy(iterPool);
+}
@@ -0,0 +1,147 @@
+#include "RevisionIndex.h"
+#include "Exception.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Identifies the file, and changes if the layout of Entry does.
+#define MAGIC "SVNREV01"
+#define HEADER_SIZE (sizeof(MAGIC) - 1)
+
+RevisionIndex::RevisionIndex(std::string const& fileName) :
+	m_fileName(fileName),
+	m_fd(-1),
+	m_map(NULL),
+	m_mapSize(0),
+	m_mapped(NULL),
+	m_mappedCount(0)
+{
+	m_fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_APPEND, 0666);
+	if(m_fd < 0) {
+		throw EXCEPTION(("Could not open revision index %s: %s", fileName.c_str(), strerror(errno)));
+	}
+
+	struct stat st;
+	if(fstat(m_fd, &st)) {
+		close(m_fd);
+		throw EXCEPTION(("Could not stat revision index %s: %s", fileName.c_str(), strerror(errno)));
+	}
+
+	if(st.st_size == 0) {
+		if(write(m_fd, MAGIC, HEADER_SIZE) != static_cast<ssize_t>(HEADER_SIZE)) {
+			close(m_fd);
+			throw EXCEPTION(("Could not write revision index %s: %s", fileName.c_str(), strerror(errno)));
+		}
+		return;
+	}
+
+	if(static_cast<size_t>(st.st_size) < HEADER_SIZE) {
+		close(m_fd);
+		throw EXCEPTION(("%s is not a revision index", fileName.c_str()));
+	}
+
+	m_mapSize = st.st_size;
+	m_map = mmap(NULL, m_mapSize, PROT_READ, MAP_SHARED, m_fd, 0);
+	if(m_map == MAP_FAILED) {
+		close(m_fd);
+		throw EXCEPTION(("Could not map revision index %s: %s", fileName.c_str(), strerror(errno)));
+	}
+	if(memcmp(m_map, MAGIC, HEADER_SIZE)) {
+		munmap(m_map, m_mapSize);
+		close(m_fd);
+		throw EXCEPTION(("%s is not a revision index", fileName.c_str()));
+	}
+
+	m_mapped = reinterpret_cast<Entry const*>(static_cast<char const*>(m_map) + HEADER_SIZE);
+	m_mappedCount = (m_mapSize - HEADER_SIZE) / sizeof(Entry);
+	if(HEADER_SIZE + m_mappedCount * sizeof(Entry) != m_mapSize) {
+		// An entry cut short by a crash.
+		Truncate(m_mappedCount);
+	}
+}
+
+RevisionIndex::~RevisionIndex()
+{
+	if(m_map) {
+		munmap(m_map, m_mapSize);
+	}
+	close(m_fd);
+}
+
+RevisionIndex::Entry const& RevisionIndex::operator[](size_t i) const
+{
+	return i < m_mappedCount? m_mapped[i] : m_appended[i - m_mappedCount];
+}
+
+RevisionIndex::Entry const* RevisionIndex::Find(svn_revnum_t revision) const
+{
+	// The first entry after revision...
+	size_t low = 0;
+	size_t high = Size();
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		if((*this)[middle].m_revision <= revision) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	// ...and the one before it.
+	return low? &(*this)[low - 1] : NULL;
+}
+
+bool RevisionIndex::HasMark(unsigned long mark) const
+{
+	size_t low = 0;
+	size_t high = Size();
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		if((*this)[middle].m_mark < mark) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low < Size() && (*this)[low].m_mark == mark;
+}
+
+void RevisionIndex::Append(svn_revnum_t revision, unsigned long mark)
+{
+	if(Size() && ((*this)[Size() - 1].m_revision > revision || (*this)[Size() - 1].m_mark >= mark)) {
+		throw EXCEPTION(("Revision %lu added to index %s out of order", revision, m_fileName.c_str()));
+	}
+
+	Entry entry;
+	entry.m_revision = revision;
+	entry.m_mark = mark;
+	if(write(m_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+		throw EXCEPTION(("Could not write revision index %s: %s", m_fileName.c_str(), strerror(errno)));
+	}
+	m_appended.push_back(entry);
+}
+
+void RevisionIndex::Truncate(size_t count)
+{
+	if(count < m_mappedCount) {
+		m_mappedCount = count;
+		m_appended.clear();
+	} else if(count < Size()) {
+		m_appended.resize(count - m_mappedCount);
+	}
+
+	if(ftruncate(m_fd, HEADER_SIZE + Size() * sizeof(Entry))) {
+		throw EXCEPTION(("Could not truncate revision index %s: %s", m_fileName.c_str(), strerror(errno)));
+	}
+}
+
+void RevisionIndex::Sync()
+{
+	if(fdatasync(m_fd)) {
+		throw EXCEPTION(("Could not sync revision index %s: %s", m_fileName.c_str(), strerror(errno)));
+	}
+}
@@ -1,10 +1,29 @@
 #include "SVNSimple.h"
+#include "BaseTextStore.h"
+#include "FileContents.h"
+#include "IgnoreRules.h"
+#include "Layout.h"
+#include "Output.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "DumpFile.h"
+#include "DumpSession.h"
+#include "PlaybackSession.h"
+#include "RASession.h"
+#include "Recording.h"
+#include "RecordingSession.h"
+#include "ReposSession.h"
+#include "Thread.h"
 #include "Exception.h"
 
+#include <unistd.h>
+#include <algorithm>
+
 extern "C" {
 #include <apr_lib.h>
 #include <apr_getopt.h>
 #include <apr_general.h>
+#include <apr_md5.h>
 
 #include <svn_ra.h>
 #include <svn_types.h>
@@ -12,6 +31,7 @@ extern "C" {
 #include <svn_pools.h>
 #include <svn_auth.h>
 #include <svn_cmdline.h>
+#include <svn_fs.h>
 #include <svn_io.h>
 }
 
@@ -21,6 +41,21 @@ extern "C" {
 
 static svn_error_t* cancel_func(void* baton) { return NULL; }
 
+static Semaphore* s_requests = NULL;
+static apr_pool_t* s_fsPool = NULL;
+
+// Holds one of the requests which may be made at once, if they are limited.
+class RequestSlot
+{
+public:
+	RequestSlot() { if(s_requests) s_requests->Acquire(); }
+	~RequestSlot() { if(s_requests) s_requests->Release(); }
+
+private:
+	RequestSlot(RequestSlot const&);
+	RequestSlot& operator=(RequestSlot const&);
+};
+
 /* This function is from svn-fast-export.c
  * Author: Chris Lee <clee@kde.org>
  * License: MIT <http://www.opensource.org/licenses/mit-license.php>
@@ -40,60 +75,109 @@ void SVNSimple::Init()
 	if(apr_initialize() != APR_SUCCESS) {
 		throw EXCEPTION(("APR Initialisation failed"));
 	}
+
+	// Local repositories are read from several threads at once.
+	svn_error_t* err;
+	s_fsPool = svn_pool_create(NULL);
+	if((err = svn_fs_initialize(s_fsPool))) {
+		throw EXCEPTION(("SVN Error: %s", err->message));
+	}
+	DumpFile::Init();
+	Recording::Init();
 }
 
 void SVNSimple::Shutdown()
 {
+	delete s_requests;
+	s_requests = NULL;
+	svn_pool_destroy(s_fsPool);
+	s_fsPool = NULL;
+	DumpFile::Shutdown();
+	Recording::Shutdown();
 	apr_terminate();
 }
 
-SVNSimple::SVNSimple(std::string url, std::string username, std::string password)
+void SVNSimple::SetRequestLimit(unsigned int limit)
+{
+	delete s_requests;
+	s_requests = limit? new Semaphore(limit) : NULL;
+}
+
+SVNSimple::SVNSimple(std::string url, std::string username, std::string password) :
+	m_callbacks(NULL),
+	m_session(NULL),
+	m_listSession(NULL),
+	m_recorder(NULL),
+	m_url(url),
+	m_config(NULL),
+	m_baseTexts(NULL),
+	m_ignoreRules(NULL),
+	m_layout(NULL),
+	m_parented(false),
+	m_historyStart(SVN_INVALID_REVNUM),
+	m_tree(NULL)
 {
 	svn_error_t* err;
-	apr_hash_t* config;
 
 	m_pool = svn_pool_create(NULL);
-	if((err = svn_ra_create_callbacks(&m_callbacks, m_pool))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
-	}
+	if(!ReposSession::Handles(m_url) && !DumpSession::Handles(m_url) && !PlaybackSession::Handles(m_url)) {
+		if((err = svn_ra_create_callbacks(&m_callbacks, m_pool))) {
+			throw EXCEPTION(("SVN Error: %s", err->message));
+		}
 
-	if((err = svn_config_get_config(&config, NULL, m_pool))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
-	}
-	{
-		svn_config_t* cfg = static_cast<svn_config_t*>(apr_hash_get(config, SVN_CONFIG_CATEGORY_CONFIG, APR_HASH_KEY_STRING));
-		svn_cmdline_create_auth_baton(&m_callbacks->auth_baton, 0, username.c_str(), password.c_str(), NULL, 0, 1, cfg, cancel_func, NULL, m_pool);
+		if((err = svn_config_get_config(&m_config, NULL, m_pool))) {
+			throw EXCEPTION(("SVN Error: %s", err->message));
+		}
+		{
+			svn_config_t* cfg = static_cast<svn_config_t*>(apr_hash_get(m_config, SVN_CONFIG_CATEGORY_CONFIG, APR_HASH_KEY_STRING));
+			svn_cmdline_create_auth_baton(&m_callbacks->auth_baton, 0, username.c_str(), password.c_str(), NULL, 0, 1, cfg, cancel_func, NULL, m_pool);
+		}
 	}
 
-	if((err = svn_ra_open4(&m_session, NULL, url.c_str(), NULL, m_callbacks, NULL, config, m_pool))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
+	m_session = OpenSession();
+	m_subtree = m_session->GetSubtree();
+}
+
+Session* SVNSimple::OpenSession()
+{
+	Session* session;
+	if(PlaybackSession::Handles(m_url)) {
+		session = new PlaybackSession(m_url, m_pool);
+	} else if(ReposSession::Handles(m_url)) {
+		// Local repositories are read directly rather than through ra_local.
+		session = new ReposSession(m_url, m_pool);
+	} else if(DumpSession::Handles(m_url)) {
+		session = new DumpSession(m_url, m_pool);
+	} else {
+		session = new RASession(m_url, m_callbacks, m_config, m_pool);
 	}
+	return m_recorder? new RecordingSession(session, m_recorder) : session;
+}
 
-	char const* sessionURL;
-	char const* rootURL;
-	if((err = svn_ra_get_session_url(m_session, &sessionURL, m_pool))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
+void SVNSimple::SetRecorder(Recorder* recorder)
+{
+	if(m_recorder) {
+		throw EXCEPTION(("Already recording"));
 	}
-	if((err = svn_ra_get_repos_root2(m_session, &rootURL, m_pool))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
+	m_recorder = recorder;
+	m_session = new RecordingSession(m_session, m_recorder);
+	if(m_listSession) {
+		m_listSession = new RecordingSession(m_listSession, m_recorder);
 	}
-
-	m_subtree.append(sessionURL + strlen(rootURL));
 }
 
 SVNSimple::~SVNSimple()
 {
+	delete m_tree;
+	delete m_listSession;
+	delete m_session;
 	svn_pool_destroy(m_pool);
 }
 
 svn_revnum_t SVNSimple::GetLatestRevision()
 {
-	svn_revnum_t rev;
-	svn_error_t* err;
-	if((err = svn_ra_get_latest_revnum(m_session, &rev, m_pool))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
-	}
-	return rev;
+	RequestSlot slot;
+	return m_session->GetLatestRevision();
 }
 
 void SVNSimple::CatFile(std::string const &relPath, svn_revnum_t revision)
@@ -103,40 +187,40 @@ void SVNSimple::CatFile(std::string const &relPath, svn_revnum_t revision)
 
 void SVNSimple::CatFile(char const* relPath, svn_revnum_t revision)
 {
-#if ACTUALLY_GET_FILE_DATA
-	apr_pool_t* pool = svn_pool_create(m_pool);
-	svn_error_t* err;
+	FileContents contents;
+	GetFile(relPath, revision, contents);
 
-	svn_dirent_t* ent;
-	if((err = svn_ra_stat(m_session, relPath, revision, &ent, pool))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
-	}
+	Output::Transaction out;
+	out.Printf("data %llu" LF, contents.Size());
+	contents.WriteTo(out);
+	out.Printf(LF);
+}
 
-	if(ent == NULL) {
-		throw EXCEPTION(("Could not get dirent for file %s at revision %lu", relPath, revision));
+void SVNSimple::GetFile(char const* relPath, svn_revnum_t revision, FileContents& contents)
+{
+	contents.Clear();
+#if ACTUALLY_GET_FILE_DATA
+	RequestSlot slot;
+	Stats::Timer timer(Stats::Phase_Fetch);
+	Trace::Span span("CatFile");
+	span.Arg("revision", revision);
+	span.Arg("path", relPath);
+	char const* data;
+	size_t length;
+	if(m_session->BorrowFile(relPath, revision, &data, &length)) {
+		contents.Borrow(data, length);
+		Stats::Count(Stats::Counter_FetchedBytes, length);
+		return;
 	}
 
-	if(ent->kind != svn_node_file) {
-		throw EXCEPTION(("Entry %s at revision %lu is not a file", relPath, revision));
-	}
+	apr_pool_t* pool = svn_pool_create(m_pool);
 
-	svn_stream_t* stream = svn_stream_create(NULL, pool);
-	if((err = svn_stream_for_stdout(&stream, pool))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
-	}
-
-	printf("data %lu" LF, ent->size);
-	fflush(stdout);
-	if((err = svn_ra_get_file(m_session, relPath, revision, stream, NULL, NULL /* TODO: props*/, pool))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
-	}
-	fflush(stdout);
-	printf(LF);
+	// The contents themselves give the size; getting a file fails on
+	// anything which is not a file.
+	m_session->GetFile(relPath, revision, contents.Stream(pool), pool);
+	Stats::Count(Stats::Counter_FetchedBytes, contents.Size());
 
 	svn_pool_destroy(pool);
-#else
-	printf("data 0" LF);
-	printf(LF);
 #endif
 }
 
@@ -152,9 +236,8 @@ struct RevThunkBaton
 svn_error_t* SVNSimple::RevisionThunk(void* batonv, svn_log_entry_t* entry, apr_pool_t* basePool)
 {
 	RevThunkBaton* baton = static_cast<RevThunkBaton*>(batonv);
-	SVNSimple::Revision rev;
-	baton->m_connection.ProcessRevision(rev, entry, basePool);
-	baton->m_revisions.push_back(rev);
+	baton->m_revisions.push_back(SVNSimple::Revision());
+	baton->m_connection.ProcessRevision(baton->m_revisions.back(), entry, basePool);
 
 	return NULL;
 }
@@ -170,6 +253,21 @@ static void ReadRevProps(SVNSimple::Revision& rev, apr_hash_t* props)
 		if(date) { rev.m_date = ParseDate(date->data, date->len); }
 }
 
+static bool MakeRelativePath(Path& result, char const* path, std::string const& subtree)
+{
+	if(strncmp(subtree.c_str(), path, subtree.size())) {
+		return false;
+	}
+
+	unsigned int nudge = 0;
+	if(path[subtree.size()] == '/') {
+		nudge = 1;
+	}
+	result = Path(path + subtree.size() + nudge);
+
+	return true;
+}
+
 void SVNSimple::ProcessRevision(Revision& rev, svn_log_entry_t* entry, apr_pool_t* basePool)
 {
 	apr_pool_t* pool = svn_pool_create(basePool);
@@ -193,7 +291,7 @@ void SVNSimple::ProcessRevision(Revision& rev, svn_log_entry_t* entry, apr_pool_
 			char const* path = static_cast<char const*>(key);
 			svn_log_changed_path2_t* info = static_cast<svn_log_changed_path2_t*>(val);
 
-			printf("# %lu > %c %s" LF, entry->revision, info->action, path);
+			Output::Printf("# %lu > %c %s" LF, entry->revision, info->action, path);
 
 			Revision::File file;
 			file.m_action = info->action;
@@ -217,10 +315,13 @@ void SVNSimple::ProcessRevision(Revision& rev, svn_log_entry_t* entry, apr_pool_
 			if(path[m_subtree.size()] == '/') {
 				nudge = 1;
 			}
-			file.m_relPath = std::string(path + m_subtree.size() + nudge);
+			file.m_relPath = Path(path + m_subtree.size() + nudge);
 
 			if(info->copyfrom_path) {
 				file.m_expand = true;
+				if(MakeRelativePath(file.m_copyFromPath, info->copyfrom_path, m_subtree)) {
+					file.m_copyFromRev = info->copyfrom_rev;
+				}
 			}
 
 			rev.m_files.push_back(file);
@@ -230,131 +331,268 @@ void SVNSimple::ProcessRevision(Revision& rev, svn_log_entry_t* entry, apr_pool_
 	svn_pool_destroy(pool);
 }
 
-template<typename IterType>
-static IterType FindMatching(
-	std::string const& needle,
-	IterType begin,
-	IterType end
-)
-{
-	for(IterType it = begin; it != end; ++it) {
-		if(it->m_relPath == needle) {
-			return it;
-		}
-	}
-
-	return end;
-}
-
-void SVNSimple::AddDirectoryFile(Revision const& rev, Revision::File& parent, std::vector<Revision::File>& extras, char const* name)
+void SVNSimple::AddDirectoryFile(Revision const& rev, Revision::File& parent, Revision::Files& extras, std::string const& name)
 {
 	Revision::File subFile(parent);
 	subFile.m_type = 'F';
 	subFile.m_action = 'A';
-	subFile.m_relPath.append("/");
-	subFile.m_relPath.append(name);
+	subFile.m_relPath = parent.m_relPath.Child(name);
 
 	{
-		std::vector<SVNSimple::Revision::File>::const_iterator pos = FindMatching(subFile.m_relPath, rev.m_files.begin(), rev.m_files.end());
+		Revision::Files::const_iterator pos = rev.m_files.find(subFile.m_relPath);
 		if(pos != rev.m_files.end()) {
-			printf("# %lu > NOEXPAND: %s: Node already in revision (%c, %c)" LF, rev.m_revision, subFile.m_relPath.c_str(), pos->m_type, pos->m_action);
+			Output::Printf("# %lu > NOEXPAND: %s: Node already in revision (%c, %c)" LF, rev.m_revision, subFile.m_relPath.str().c_str(), pos->m_type, pos->m_action);
 			return;
 		}
 	}
 	{
-		std::vector<SVNSimple::Revision::File>::iterator pos = FindMatching(subFile.m_relPath, extras.begin(), extras.end());
+		Revision::Files::iterator pos = extras.find(subFile.m_relPath);
 		if(pos != extras.end()) {
-			printf("# %lu > NOEXPAND: %s: Node already expanded (%c, %c)" LF, rev.m_revision, subFile.m_relPath.c_str(), pos->m_type, pos->m_action);
+			Output::Printf("# %lu > NOEXPAND: %s: Node already expanded (%c, %c)" LF, rev.m_revision, subFile.m_relPath.str().c_str(), pos->m_type, pos->m_action);
 			return;
 		}
 	}
 
 	extras.push_back(subFile);
-	printf("# %lu > EXPAND %s: %s" LF, rev.m_revision, parent.m_relPath.c_str(), subFile.m_relPath.c_str());
+	Output::Printf("# %lu > EXPAND %s: %s" LF, rev.m_revision, parent.m_relPath.str().c_str(), subFile.m_relPath.str().c_str());
 }
 
-void SVNSimple::ExpandDirectory(Revision const& rev, Revision::File& parent, std::vector<Revision::File>& extras)
+void SVNSimple::StartHistory(svn_revnum_t from)
 {
-	svn_error_t* err;
+	if(m_historyStart == SVN_INVALID_REVNUM) {
+		m_historyStart = from;
+		// The repository as of the revision before, which is git's tree
+		// too if GitHasHistory().
+		m_tree = new RepoTree(*this, from > 0? from - 1 : SVN_INVALID_REVNUM);
+	}
+}
+
+bool SVNSimple::GitHasHistory() const
+{
+	return m_historyStart == 0 || (m_historyStart != SVN_INVALID_REVNUM && m_parented);
+}
+
+void SVNSimple::List(std::string const& relPath, svn_revnum_t revision, std::vector<std::pair<std::string, bool> >& entries)
+{
+	if(m_listSession == NULL) {
+		m_listSession = OpenSession();
+	}
 	apr_pool_t* pool = svn_pool_create(m_pool);
-	apr_hash_t* dirents;
-
-	if((err = svn_ra_get_dir2(
-		m_session,
-		&dirents,
-		NULL,
-		NULL,
-		parent.m_relPath.c_str(),
-		rev.m_revision,
-		SVN_DIRENT_KIND, // Only want to know the type of dirents
-		pool
-	))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
+	RequestSlot slot;
+	Stats::Timer timer(Stats::Phase_List);
+	Trace::Span span("ListDirectory");
+	span.Arg("revision", revision);
+	span.Arg("path", relPath);
+
+	// The subtree itself may not exist yet when the history starts.
+	if(relPath.empty() && m_listSession->CheckPath("", revision, pool) != svn_node_dir) {
+		svn_pool_destroy(pool);
+		return;
 	}
 
-	for(apr_hash_index_t* index = apr_hash_first(pool, dirents); index; index = apr_hash_next(index))
-	{
-		void const* key;
-		apr_ssize_t keyLen;
-		void* val;
-		apr_hash_this(index, &key, &keyLen, &val);
+	m_listSession->GetDirectory(relPath.c_str(), revision, entries, pool);
 
-		char const* path = static_cast<char const*>(key);
-		svn_dirent_t* info = static_cast<svn_dirent_t*>(val);
+	svn_pool_destroy(pool);
+}
 
-		printf("# %s -> %s" LF, parent.m_relPath.c_str(), path);
+bool SVNSimple::Prune(std::string const& relPath)
+{
+	return m_ignoreRules && m_ignoreRules->IgnoresAllUnder(relPath);
+}
 
-		switch(info->kind)
-		{
-			case svn_node_file:
-				AddDirectoryFile(rev, parent, extras, path);
-				break;
-			case svn_node_dir:
-				{
-					Revision::File subDir(parent);
-					subDir.m_relPath.append("/");
-					subDir.m_relPath.append(path);
-
-					ExpandDirectory(rev, subDir, extras);
-				}
-				break;
-			default:
-				ERROR(("Unknown file kind: \"%s\" in directory \"%s\"", path, parent.m_relPath.c_str()));
+void SVNSimple::ExpandDirectory(Revision const& rev, Revision::File& parent, Revision::Files& extras)
+{
+	// Nothing would be written from it, so don't list it.
+	if(Prune(parent.m_relPath.str())) {
+		Output::Printf("# %lu > NOEXPAND: %s: Everything under it is ignored" LF, rev.m_revision, parent.m_relPath.str().c_str());
+		return;
+	}
+
+	Trace::Span span("ExpandDirectory");
+	span.Arg("revision", rev.m_revision);
+	span.Arg("path", parent.m_relPath);
+	std::vector<std::string> files;
+	m_tree->ListFiles(parent.m_relPath.str(), files);
+
+	for(std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it) {
+		AddDirectoryFile(rev, parent, extras, *it);
+	}
+}
+
+bool SVNSimple::CanCopyTree(Revision::File const& dir)
+{
+	if(!SVN_IS_VALID_REVNUM(dir.m_copyFromRev) || dir.m_copyFromPath.empty()) {
+		return false;
+	}
+
+	// The source must be the same in git's tree as it was in the copy
+	// source revision.
+	if(!GitHasHistory() || dir.m_copyFromRev < m_historyStart - 1) {
+		return false;
+	}
+	std::string copyFromPath(dir.m_copyFromPath.str());
+	if(m_tree->ChangedSince(copyFromPath, dir.m_copyFromRev)) {
+		return false;
+	}
+
+	// Ignored files would be missing from the source or need removing from
+	// the destination.
+	if(m_ignoreRules && (m_ignoreRules->MayAffect(copyFromPath) || m_ignoreRules->MayAffect(dir.m_relPath.str()))) {
+		return false;
+	}
+
+	// Each branch is committed on its own; git can only copy within one.
+	if(m_layout) {
+		std::string fromRoot, toRoot, path;
+		if(!m_layout->Split(copyFromPath, fromRoot, path) || !m_layout->Split(dir.m_relPath.str(), toRoot, path) || fromRoot != toRoot) {
+			return false;
 		}
 	}
 
-	svn_pool_destroy(pool);
+	// git has no empty directories, and copying a path it doesn't have is fatal.
+	return m_tree->HasFiles(copyFromPath);
 }
 
-void SVNSimple::ExpandDirectories(std::vector<Revision>& log)
+bool SVNSimple::CanCopyBranch(Revision::File const& dir)
 {
-	for(std::vector<Revision>::iterator rit = log.begin(); rit != log.end(); ++rit) {
-		Revision& rev = *rit;
-
-		std::vector<Revision::File> expanded;
-		for(std::vector<Revision::File>::iterator fit = rit->m_files.begin(); fit != rit->m_files.end(); ++fit) {
-			if(fit->m_action == 'R') {
-				// Replace: delete the destination before copying into it.
-				Revision::File del(*fit);
-				del.m_action = 'D';
-				expanded.push_back(del);
-			}
-			expanded.push_back(*fit);
+	if(m_layout == NULL || !SVN_IS_VALID_REVNUM(dir.m_copyFromRev) || dir.m_copyFromPath.empty()) {
+		return false;
+	}
+
+	std::string copyFromPath(dir.m_copyFromPath.str());
+	if(!m_layout->IsRoot(copyFromPath) || !m_layout->IsRoot(dir.m_relPath.str())) {
+		return false;
+	}
+
+	// The source branch must have been written, either earlier in this
+	// export or by the one the first commit carries on from.
+	if(!GitHasHistory()) {
+		return false;
+	}
 
-			// Don't expand deletes as they are always recursive (also SVN won't
-			// have a dirent for files in a deleted directory).
-			if(fit->m_expand && fit->m_type == 'D' && fit->m_action != 'D') {
-				ExpandDirectory(rev, *fit, expanded);
+	// The source branch's latest commit must be the one it had at the copy
+	// source revision.
+	if(m_tree->ChangedSince(copyFromPath, dir.m_copyFromRev)) {
+		return false;
+	}
+
+	if(m_ignoreRules && (m_ignoreRules->MayAffect(copyFromPath) || m_ignoreRules->MayAffect(dir.m_relPath.str()))) {
+		return false;
+	}
+
+	return m_tree->HasFiles(copyFromPath);
+}
+
+void SVNSimple::FindNewBranches(Revision& rev)
+{
+	for(Revision::Files::const_iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit) {
+		std::string root, path;
+		if(m_layout->Split(fit->m_relPath.str(), root, path)
+			&& std::find(rev.m_newBranches.begin(), rev.m_newBranches.end(), root) == rev.m_newBranches.end()
+			&& !m_tree->HasFiles(root)) {
+			rev.m_newBranches.push_back(root);
+		}
+	}
+}
+
+static bool Shallower(std::pair<unsigned int, SVNSimple::Revision::File const*> const& a, std::pair<unsigned int, SVNSimple::Revision::File const*> const& b)
+{
+	return a.first < b.first;
+}
+
+void SVNSimple::ApplyToTree(Revision const& rev)
+{
+	m_tree->StartRevision();
+
+	// Logs list changed paths in no particular order; parents must be
+	// changed before their children.
+	std::vector<std::pair<unsigned int, Revision::File const*> > files;
+	for(Revision::Files::const_iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit) {
+		files.push_back(std::make_pair(fit->m_relPath.Depth(), &*fit));
+	}
+	std::stable_sort(files.begin(), files.end(), Shallower);
+
+	for(std::vector<std::pair<unsigned int, Revision::File const*> >::const_iterator it = files.begin(); it != files.end(); ++it) {
+		Revision::File const* fit = it->second;
+		std::string relPath(fit->m_relPath.str());
+		if(fit->m_action == 'D' || fit->m_action == 'R') {
+			m_tree->Delete(relPath, rev.m_revision);
+		}
+		if(fit->m_action == 'D') {
+			continue;
+		}
+
+		if(fit->m_type == 'U') {
+			// Old servers don't say what kind of node changed.
+			if(fit->m_action != 'M') {
+				m_tree->Reload(fit->m_relPath.Parent().str(), rev.m_revision);
 			}
+		} else if(fit->m_action == 'M') {
+			if(fit->m_type == 'F') {
+				m_tree->Modify(relPath, rev.m_revision);
+			}
+		} else if(SVN_IS_VALID_REVNUM(fit->m_copyFromRev) || fit->m_expand) {
+			// Copied, possibly from outside the subtree.
+			m_tree->Copy(fit->m_copyFromPath.str(), fit->m_copyFromRev, relPath, fit->m_type == 'D', rev.m_revision);
+		} else if(fit->m_type == 'D') {
+			m_tree->AddDirectory(relPath, rev.m_revision);
+		} else {
+			m_tree->AddFile(relPath, rev.m_revision);
+		}
+	}
+}
+
+void SVNSimple::ExpandRevision(Revision& rev)
+{
+	StartHistory(rev.m_revision);
+
+	// Tree copies are decided against the tree before this revision.
+	if(m_layout) {
+		FindNewBranches(rev);
+	}
+	for(Revision::Files::iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit) {
+		if(fit->m_expand && fit->m_type == 'D' && fit->m_action != 'D' && CanCopyBranch(*fit)) {
+			Output::Printf("# %lu > BRANCH %s@%lu: %s" LF, rev.m_revision, fit->m_copyFromPath.str().c_str(), fit->m_copyFromRev, fit->m_relPath.str().c_str());
+			fit->m_expand = false;
+			fit->m_copyBranch = true;
+		} else if(fit->m_expand && fit->m_type == 'D' && fit->m_action != 'D' && CanCopyTree(*fit)) {
+			Output::Printf("# %lu > COPY %s@%lu: %s" LF, rev.m_revision, fit->m_copyFromPath.str().c_str(), fit->m_copyFromRev, fit->m_relPath.str().c_str());
+			fit->m_expand = false;
+			fit->m_copyTree = true;
 		}
+	}
+
+	ApplyToTree(rev);
+
+	Revision::Files expanded;
+	for(Revision::Files::iterator fit = rev.m_files.begin(); fit != rev.m_files.end(); ++fit) {
+		if(fit->m_action == 'R' && !fit->m_copyTree && !fit->m_copyBranch) {
+			// Replace: delete the destination before copying into it.
+			Revision::File del(*fit);
+			del.m_action = 'D';
+			expanded.push_back(del);
+		}
+		expanded.push_back(*fit);
+
+		// Don't expand deletes as they are always recursive (also SVN won't
+		// have a dirent for files in a deleted directory).
+		if(fit->m_expand && fit->m_type == 'D' && fit->m_action != 'D') {
+			ExpandDirectory(rev, *fit, expanded);
+		}
+	}
 
-		rev.m_files.swap(expanded);
+	rev.m_files.swap(expanded);
+}
+
+void SVNSimple::ExpandDirectories(std::vector<Revision>& log)
+{
+	for(std::vector<Revision>::iterator rit = log.begin(); rit != log.end(); ++rit) {
+		ExpandRevision(*rit);
 	}
 }
 
 void SVNSimple::GetLog(std::vector<Revision>& log, svn_revnum_t from, svn_revnum_t to, bool expandDirectories)
 {
-	svn_error_t* err;
 	apr_pool_t* pool = svn_pool_create(m_pool);
 	apr_array_header_t* paths = NULL;
 
@@ -367,24 +605,13 @@ void SVNSimple::GetLog(std::vector<Revision>& log, svn_revnum_t from, svn_revnum
 		*path = "";
 	}
 
+	StartHistory(from);
+	// Growing the vector would copy every revision read so far.
+	log.reserve(log.size() + (to - from + 1));
+
 	RevThunkBaton baton(*this, log);
 
-	if((err = svn_ra_get_log2(
-		m_session,
-		paths,
-		from,
-		to,
-		0, // No limit
-		1, // Generate a list of changed paths
-		0, // Don't follow copies
-		0, // No merge info
-		NULL, // TODO: Filter revprops
-		&RevisionThunk,
-		static_cast<void*>(&baton),
-		pool
-	))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
-	}
+	m_session->GetLog(paths, from, to, &RevisionThunk, static_cast<void*>(&baton), pool);
 
 	if(expandDirectories) {
 		ExpandDirectories(log);
@@ -395,32 +622,41 @@ void SVNSimple::GetLog(std::vector<Revision>& log, svn_revnum_t from, svn_revnum
 
 #define VERBOSE_REPLAY (0)
 
-static bool MakeRelativePath(std::string& result, char const* path, std::string const& subtree)
-{
-	if(strncmp(subtree.c_str(), path, subtree.size())) {
-		return false;
-	}
-
-	unsigned int nudge = 0;
-	if(path[subtree.size()] == '/') {
-		nudge = 1;
-	}
-	result = std::string(path + subtree.size() + nudge);
-
-	return true;
-}
-
 struct ReplayBaton {
-	std::vector<SVNSimple::Revision>* m_log;
+	SVNSimple* m_connection;
+	SVNSimple::RevisionSink* m_sink;
+	bool m_expandDirectories;
 	std::string* m_subtree;
+	BaseTextStore* m_baseTexts;
+	IgnoreRules const* m_ignoreRules;
 };
 
 struct EditBaton {
 	SVNSimple::Revision m_rev;
 	std::string* m_subtree;
+	BaseTextStore* m_baseTexts;
+	IgnoreRules const* m_ignoreRules;
+};
+
+struct FileBaton {
+	enum Base {
+		Base_Empty, // New file; deltas apply against nothing
+		Base_Path, // Deltas apply against the text of m_basePath
+		Base_None // The base is outside the subtree, so can't be stored
+	};
+
+	EditBaton* m_edit;
+	int m_index; // Position of the file in m_edit->m_rev.m_files, or -1
+	Base m_base;
+	std::string m_basePath;
+	bool m_applied;
+	std::string m_spoolFile;
+	unsigned char m_digest[APR_MD5_DIGESTSIZE];
 };
 
-static void AddEntry(char action, char type, char const* path, void* batonData)
+// Returns the position the entry was added at, or -1 if it is outside the
+// subtree or is an ignored file, whose text isn't wanted.
+static int AddEntry(char action, char type, char const* path, void* batonData, char const* copyfromPath = NULL, svn_revnum_t copyfromRevision = SVN_INVALID_REVNUM)
 {
 	EditBaton* baton = static_cast<EditBaton*>(batonData);
 
@@ -431,9 +667,21 @@ static void AddEntry(char action, char type, char const* path, void* batonData)
 	{
 		file.m_expand = true;
 	}
+	// Copy sources are absolute, unlike the paths being replayed.
+	if(copyfromPath && MakeRelativePath(file.m_copyFromPath, copyfromPath + (copyfromPath[0] == '/'? 1 : 0), *baton->m_subtree))
+	{
+		file.m_copyFromRev = copyfromRevision;
+	}
 	if(MakeRelativePath(file.m_relPath, path, *baton->m_subtree))
 	{
+		// Ignored files are still kept so that the tree follows them; they
+		// are marked ignored once the revision is expanded.
 		baton->m_rev.m_files.push_back(file);
+		if(type == 'F' && baton->m_ignoreRules && baton->m_ignoreRules->Match(file.m_relPath.str()))
+		{
+			return -1;
+		}
+		return baton->m_rev.m_files.size() - 1;
 	}
 #if VERBOSE_REPLAY
 	else
@@ -441,6 +689,18 @@ static void AddEntry(char action, char type, char const* path, void* batonData)
 		fprintf(stderr, "Rejected \"%s\" for subtree \"%s\"\n", path, baton->m_subtree->c_str());
 	}
 #endif
+	return -1;
+}
+
+static FileBaton* MakeFileBaton(void* batonData, int index, FileBaton::Base base, std::string const& basePath, apr_pool_t* pool)
+{
+	FileBaton* baton = new(apr_palloc(pool, sizeof(FileBaton))) FileBaton;
+	baton->m_edit = static_cast<EditBaton*>(batonData);
+	baton->m_index = index;
+	baton->m_base = base;
+	baton->m_basePath = basePath;
+	baton->m_applied = false;
+	return baton;
 }
 
 static svn_error_t* set_target_revision(void *edit_baton, svn_revnum_t target_revision, apr_pool_t *scratch_pool)
@@ -485,7 +745,7 @@ svn_error_t* add_directory(const char *path, void *parent_baton, const char *cop
 
 	if(copyfrom_path)
 	{
-		AddEntry('C', 'D', path, parent_baton);
+		AddEntry('C', 'D', path, parent_baton, copyfrom_path, copyfrom_revision);
 	}
 
 	return SVN_NO_ERROR;
@@ -530,37 +790,86 @@ static svn_error_t* absent_directory(const char *path, void *parent_baton, apr_p
 static svn_error_t* add_file(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_revision, apr_pool_t *result_pool, void **file_baton)
 {
 	//We are going to add a new file named path.
-	*file_baton = parent_baton;
+	int index = AddEntry('A', 'F', path, parent_baton, copyfrom_path, copyfrom_revision);
+
+	FileBaton::Base base = FileBaton::Base_Empty;
+	std::string basePath;
+	if(copyfrom_path && index >= 0) {
+		SVNSimple::Revision::File const& file = static_cast<EditBaton*>(parent_baton)->m_rev.m_files[index];
+		base = SVN_IS_VALID_REVNUM(file.m_copyFromRev)? FileBaton::Base_Path : FileBaton::Base_None;
+		basePath = file.m_copyFromPath.str();
+	}
+	*file_baton = MakeFileBaton(parent_baton, index, base, basePath, result_pool);
 #if VERBOSE_REPLAY
 	fprintf(stderr, "add_file(\"%s\", %p) => %p\n", path, parent_baton, *file_baton);
 #endif
 
-	AddEntry('A', 'F', path, parent_baton);
-
 	return SVN_NO_ERROR;
 }
 
 static svn_error_t* open_file(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *result_pool, void **file_baton)
 {
 	//We are going to make change to a file named path, which resides in the directory identified by parent_baton.
-	*file_baton = parent_baton;
+	int index = AddEntry('M', 'F', path, parent_baton);
+
+	std::string basePath;
+	if(index >= 0) {
+		basePath = static_cast<EditBaton*>(parent_baton)->m_rev.m_files[index].m_relPath.str();
+	}
+	*file_baton = MakeFileBaton(parent_baton, index, FileBaton::Base_Path, basePath, result_pool);
 #if VERBOSE_REPLAY
 	fprintf(stderr, "open_file(\"%s\", %p, %lu) => %p\n", path, parent_baton, base_revision, *file_baton);
 #endif
 
-	AddEntry('M', 'F', path, parent_baton);
-
 	return SVN_NO_ERROR;
 }
 
 static svn_error_t* apply_textdelta(void *file_baton, const char *base_checksum, apr_pool_t *result_pool, svn_txdelta_window_handler_t *handler, void **handler_baton)
 {
 	//Apply a text delta, yielding the new revision of a file.
+	FileBaton* baton = static_cast<FileBaton*>(file_baton);
+	BaseTextStore* store = baton->m_edit->m_baseTexts;
+
 	*handler_baton = file_baton;
 	*handler = svn_delta_noop_window_handler;
 #if VERBOSE_REPLAY
-	fprintf(stderr, "apply_textdelta(%p) => %p\n", file_baton, *handler_baton);
+	fprintf(stderr, "apply_textdelta(%p, %s)\n", file_baton, base_checksum? base_checksum : "none");
 #endif
+
+	if(store == NULL || baton->m_index < 0) {
+		return SVN_NO_ERROR;
+	}
+
+	// Without a matching base the delta is dropped and the exporter fetches
+	// the full text instead.
+	svn_stream_t* base = NULL;
+	switch(baton->m_base) {
+		case FileBaton::Base_Empty:
+			base = svn_stream_empty(result_pool);
+			break;
+		case FileBaton::Base_Path:
+			if(base_checksum) {
+				store->OpenBase(baton->m_basePath, base_checksum, &base, result_pool);
+			}
+			break;
+		case FileBaton::Base_None:
+			break;
+	}
+	if(base == NULL) {
+		Stats::Count(Stats::Counter_DroppedDeltas);
+		return SVN_NO_ERROR;
+	}
+
+	svn_stream_t* target;
+	try {
+		store->CreateSpool(baton->m_spoolFile, &target, result_pool);
+	} catch(std::exception const& e) {
+		return svn_error_create(APR_EGENERAL, NULL, e.what());
+	}
+
+	svn_txdelta_apply(base, target, baton->m_digest, NULL, result_pool, handler, handler_baton);
+	baton->m_applied = true;
+
 	return SVN_NO_ERROR;
 }
 static svn_error_t* change_file_prop(void *file_baton, const char *name, const svn_string_t *value, apr_pool_t *scratch_pool)
@@ -577,7 +886,47 @@ static svn_error_t* close_file(void *file_baton, const char *text_checksum, apr_
 #if VERBOSE_REPLAY
 	fprintf(stderr, "close_file(%p)\n", file_baton);
 #endif
-	return SVN_NO_ERROR;
+	FileBaton* baton = static_cast<FileBaton*>(file_baton);
+	BaseTextStore* store = baton->m_edit->m_baseTexts;
+	svn_error_t* err = SVN_NO_ERROR;
+
+	if(store && baton->m_index >= 0) {
+		SVNSimple::Revision::File& file = baton->m_edit->m_rev.m_files[baton->m_index];
+		std::string relPath(file.m_relPath.str());
+		svn_revnum_t revision = baton->m_edit->m_rev.m_revision;
+
+		try {
+			if(baton->m_applied) {
+				char md5[APR_MD5_DIGESTSIZE * 2 + 1];
+				for(unsigned int i = 0; i < APR_MD5_DIGESTSIZE; i += 1) {
+					sprintf(md5 + i * 2, "%02x", baton->m_digest[i]);
+				}
+
+				if(text_checksum == NULL || strcmp(text_checksum, md5) == 0) {
+					store->Save(relPath, revision, baton->m_spoolFile, md5);
+					file.m_contentFile = baton->m_spoolFile;
+				} else {
+					unlink(baton->m_spoolFile.c_str());
+				}
+			} else if(text_checksum && baton->m_base == FileBaton::Base_Path) {
+				// The text is unchanged from the base (a property change or a
+				// plain copy) so the base can be used as it is.
+				std::string spoolFile;
+				if(store->LinkBase(baton->m_basePath, text_checksum, spoolFile)) {
+					if(baton->m_basePath != relPath) {
+						store->Save(relPath, revision, spoolFile, text_checksum);
+					}
+					file.m_contentFile = spoolFile;
+				}
+			}
+		} catch(std::exception const& e) {
+			err = svn_error_create(APR_EGENERAL, NULL, e.what());
+		}
+	}
+
+	baton->~FileBaton();
+
+	return err;
 }
 static svn_error_t* absent_file(const char *path, void *parent_baton, apr_pool_t *scratch_pool)
 {
@@ -617,6 +966,8 @@ static svn_error_t* RevStart(svn_revnum_t revnum, void* batonData, const svn_del
 
 	editBaton->m_rev.m_revision = revnum;
 	editBaton->m_subtree = baton->m_subtree;
+	editBaton->m_baseTexts = baton->m_baseTexts;
+	editBaton->m_ignoreRules = baton->m_ignoreRules;
 
 	// Put author, date etc. into the revision structure.
 	ReadRevProps(editBaton->m_rev, revprops);
@@ -652,57 +1003,78 @@ static svn_error_t* RevEnd(svn_revnum_t revnum, void* batonData, const svn_delta
 #endif
 	EditBaton* editBaton = static_cast<EditBaton*>(editBatonData);
 	ReplayBaton* baton = static_cast<ReplayBaton*>(batonData);
-	std::vector<SVNSimple::Revision>* log = baton->m_log;
+	svn_error_t* err = SVN_NO_ERROR;
 
 	if(editBaton->m_rev.m_files.size())
 	{
-		log->push_back(editBaton->m_rev);
+		SVNSimple::Revision rev;
+		rev.swap(editBaton->m_rev);
+#if VERBOSE_REPLAY
+		fprintf(stderr, "----------- Revision %lu: %s\n%s\n", rev.m_revision, rev.m_user.c_str(), rev.m_log.c_str());
+		for(SVNSimple::Revision::Files::const_iterator it = rev.m_files.begin(); it != rev.m_files.end(); ++it)
+		{
+			fprintf(stderr, "\t%c%c%c %s\n", it->m_action, it->m_type, it->m_expand? '+' : ' ', it->m_relPath.str().c_str());
+		}
+#endif
+
+		try {
+			if(baton->m_expandDirectories) {
+				baton->m_connection->ExpandRevision(rev);
+			}
+			baton->m_sink->Consume(rev);
+		} catch(std::exception const& e) {
+			err = svn_error_create(APR_EGENERAL, NULL, e.what());
+		}
 	}
 
 	editBaton->~EditBaton();
 
-	return SVN_NO_ERROR;
+	return err;
 }
 
+struct CollectRevisions : public SVNSimple::RevisionSink
+{
+	CollectRevisions(std::vector<SVNSimple::Revision>& log) : m_log(log) { }
+
+	void Consume(SVNSimple::Revision& rev)
+	{
+		m_log.push_back(SVNSimple::Revision());
+		m_log.back().swap(rev);
+	}
+
+	std::vector<SVNSimple::Revision>& m_log;
+};
+
 void SVNSimple::Replay(std::vector<Revision>& log, svn_revnum_t from, svn_revnum_t to, bool expandDirectories)
 {
-	svn_error_t* err;
+	// Growing the vector would copy every revision read so far.
+	log.reserve(log.size() + (to - from + 1));
+
+	CollectRevisions sink(log);
+	Replay(sink, from, to, expandDirectories);
+}
+
+void SVNSimple::Replay(RevisionSink& sink, svn_revnum_t from, svn_revnum_t to, bool expandDirectories)
+{
 	apr_pool_t* pool = svn_pool_create(m_pool);
 
+	StartHistory(from);
+
 	ReplayBaton baton;
-	baton.m_log = &log;
+	baton.m_connection = this;
+	baton.m_sink = &sink;
+	baton.m_expandDirectories = expandDirectories;
 	// Replay does not prepend '/' to paths
 	std::string subtree = m_subtree.substr(m_subtree[0] == '/'? 1 : 0);
 	baton.m_subtree = &subtree;
-
-	if((err = svn_ra_replay_range(
-		m_session,
-		from,
-		to,
-		0,
-		FALSE,
-		&RevStart,
-		&RevEnd,
-		&baton,
-		pool
-	))) {
-		throw EXCEPTION(("SVN Error: %s", err->message));
-	}
-
-#if VERBOSE_REPLAY
-	for(std::vector<Revision>::const_iterator it = log.begin(); it != log.end(); ++it)
-	{
-		fprintf(stderr, "----------- Revision %lu: %s\n%s\n", it->m_revision, it->m_user.c_str(), it->m_log.c_str());
-		for(std::vector<Revision::File>::const_iterator jt = it->m_files.begin(); jt != it->m_files.end(); ++jt)
-		{
-			fprintf(stderr, "\t%c%c%c %s\n", jt->m_action, jt->m_type, jt->m_expand? '+' : ' ', jt->m_relPath.c_str());
-		}
-	}
-#endif
-
-	if(expandDirectories) {
-		ExpandDirectories(log);
-	}
+	// Only need the deltas if they can be applied.  With no bases at all,
+	// every changed file would come twice, as a delta and then in full;
+	// fetched texts are stored as bases either way.
+	bool sendDeltas = m_baseTexts != NULL && !m_baseTexts->Empty();
+	baton.m_baseTexts = sendDeltas? m_baseTexts : NULL;
+	baton.m_ignoreRules = m_ignoreRules;
+
+	m_session->Replay(from, to, sendDeltas, &RevStart, &RevEnd, &baton, pool);
 
 	apr_pool_destroy(pool);
 }
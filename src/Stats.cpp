@@ -0,0 +1,295 @@
+#include "Stats.h"
+#include "Output.h"
+#include "Path.h"
+#include "Exception.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+extern "C" {
+#include <apr_thread_proc.h>
+#include <svn_pools.h>
+}
+
+#define LF "\x0A"
+
+static char const* const c_phaseNames[Stats::Phase_NUM] = { "replay", "list", "fetch", "write" };
+static char const* const c_counterNames[Stats::Counter_NUM] = { "revisions", "changes", "blobs", "blobBytes", "fetchedBytes", "droppedDeltas" };
+
+apr_pool_t* Stats::s_pool = NULL;
+apr_threadkey_t* Stats::s_current = NULL;
+
+// The most this process has had resident, in KB.
+static long PeakRSS()
+{
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage)) {
+		return 0;
+	}
+	return usage.ru_maxrss;
+}
+
+static double Seconds(apr_time_t time)
+{
+	return static_cast<double>(time) / APR_USEC_PER_SEC;
+}
+
+// Short enough for a progress line: "850us", "12ms" or "3.4s".
+static std::string Duration(apr_time_t time)
+{
+	char buffer[32];
+	if(time < 1000) {
+		snprintf(buffer, sizeof(buffer), "%ldus", static_cast<long>(time));
+	} else if(time < APR_USEC_PER_SEC) {
+		snprintf(buffer, sizeof(buffer), "%ldms", static_cast<long>(time / 1000));
+	} else {
+		snprintf(buffer, sizeof(buffer), "%.1fs", Seconds(time));
+	}
+	return buffer;
+}
+
+static void WriteString(FILE* f, std::string const& value)
+{
+	fputc('"', f);
+	for(std::string::const_iterator it = value.begin(); it != value.end(); ++it) {
+		unsigned char c = *it;
+		if(c == '"' || c == '\\') {
+			fprintf(f, "\\%c", c);
+		} else if(c < 0x20) {
+			fprintf(f, "\\u%04x", c);
+		} else {
+			fputc(c, f);
+		}
+	}
+	fputc('"', f);
+}
+
+void Stats::Init()
+{
+	s_pool = svn_pool_create(NULL);
+	if(apr_threadkey_private_create(&s_current, NULL, s_pool) != APR_SUCCESS) {
+		throw EXCEPTION(("Could not create thread key"));
+	}
+}
+
+Stats* Stats::Current()
+{
+	void* stats = NULL;
+	if(s_current) {
+		apr_threadkey_private_get(&stats, s_current);
+	}
+	return static_cast<Stats*>(stats);
+}
+
+Stats::Scope::Scope(Stats* stats) :
+	m_previous(Current())
+{
+	apr_threadkey_private_set(stats, s_current);
+}
+
+Stats::Scope::~Scope()
+{
+	apr_threadkey_private_set(m_previous, s_current);
+}
+
+Stats::Timer::Timer(Phase phase) :
+	m_stats(Current()),
+	m_phase(phase),
+	m_start(m_stats? apr_time_now() : 0)
+{
+}
+
+Stats::Timer::~Timer()
+{
+	if(m_stats) {
+		m_stats->Record(m_phase, apr_time_now() - m_start);
+	}
+}
+
+void Stats::Count(Counter counter, unsigned long long amount)
+{
+	Stats* stats = Current();
+	if(stats) {
+		stats->Add(counter, amount);
+	}
+}
+
+Stats::Stats() :
+	m_start(apr_time_now())
+{
+	memset(m_phases, 0, sizeof(m_phases));
+	memset(m_counters, 0, sizeof(m_counters));
+}
+
+void Stats::Record(Phase phase, apr_time_t elapsed)
+{
+	unsigned int bucket = 0;
+	while(bucket < STATS_BUCKETS - 1 && elapsed >= (static_cast<apr_time_t>(1) << bucket)) {
+		bucket += 1;
+	}
+
+	ScopedLock lock(m_mutex);
+	Histogram& histogram = m_phases[phase];
+	histogram.m_count += 1;
+	histogram.m_total += elapsed;
+	if(elapsed > histogram.m_max) {
+		histogram.m_max = elapsed;
+	}
+	histogram.m_buckets[bucket] += 1;
+}
+
+void Stats::Add(Counter counter, unsigned long long amount)
+{
+	ScopedLock lock(m_mutex);
+	m_counters[counter] += amount;
+}
+
+apr_time_t Stats::GetTotal(Phase phase)
+{
+	ScopedLock lock(m_mutex);
+	return m_phases[phase].m_total;
+}
+
+void Stats::EndWindow(svn_revnum_t first, svn_revnum_t last, unsigned long changes, apr_time_t elapsed)
+{
+	Window window;
+	window.m_first = first;
+	window.m_last = last;
+	window.m_changes = changes;
+	window.m_elapsed = elapsed;
+	window.m_peakRSS = PeakRSS();
+
+	ScopedLock lock(m_mutex);
+	m_windows.push_back(window);
+}
+
+apr_time_t Stats::Percentile(Histogram const& histogram, double fraction) const
+{
+	// The top of the bucket the percentile falls in.
+	unsigned long wanted = static_cast<unsigned long>(histogram.m_count * fraction + 0.5);
+	unsigned long seen = 0;
+	for(unsigned int bucket = 0; bucket < STATS_BUCKETS - 1; ++bucket) {
+		seen += histogram.m_buckets[bucket];
+		if(seen >= wanted && seen) {
+			apr_time_t top = static_cast<apr_time_t>(1) << bucket;
+			return top < histogram.m_max? top : histogram.m_max;
+		}
+	}
+	return histogram.m_max;
+}
+
+void Stats::PrintProgress()
+{
+	std::string phases;
+	unsigned long long counters[Counter_NUM];
+	double elapsed;
+	{
+		ScopedLock lock(m_mutex);
+		for(unsigned int i = 0; i < Phase_NUM; ++i) {
+			Histogram const& histogram = m_phases[i];
+			char buffer[128];
+			snprintf(buffer, sizeof(buffer), "%s%s %s (%lu, p50 %s, p99 %s)", i? ", " : "", c_phaseNames[i], Duration(histogram.m_total).c_str(), histogram.m_count, Duration(Percentile(histogram, 0.5)).c_str(), Duration(Percentile(histogram, 0.99)).c_str());
+			phases.append(buffer);
+		}
+		memcpy(counters, m_counters, sizeof(counters));
+		elapsed = Seconds(apr_time_now() - m_start);
+	}
+	if(elapsed <= 0) {
+		elapsed = 1e-6;
+	}
+
+	size_t paths, pathBytes;
+	Path::TableSize(paths, pathBytes);
+
+	double blobMB = counters[Counter_BlobBytes] / 1048576.0;
+	Output::Printf("progress Stats: %llu revisions (%.1f/s), %llu blobs, %.1f MB (%.1f MB/s), %.1f MB fetched; %s; peak RSS %ld MB, %lu paths interned (%.1f MB)" LF,
+		counters[Counter_Revisions], counters[Counter_Revisions] / elapsed,
+		counters[Counter_Blobs], blobMB, blobMB / elapsed,
+		counters[Counter_FetchedBytes] / 1048576.0,
+		phases.c_str(), PeakRSS() / 1024,
+		static_cast<unsigned long>(paths), pathBytes / 1048576.0);
+}
+
+void Stats::Save(std::string const& fileName, std::string const& name, std::string const& url, std::string const& error)
+{
+	std::string temp(fileName + ".tmp");
+	FILE* f = fopen(temp.c_str(), "w");
+	if(f == NULL) {
+		throw EXCEPTION(("Could not write stats %s: %s", temp.c_str(), strerror(errno)));
+	}
+
+	size_t paths, pathBytes;
+	Path::TableSize(paths, pathBytes);
+
+	{
+		ScopedLock lock(m_mutex);
+		double elapsed = Seconds(apr_time_now() - m_start);
+
+		fprintf(f, "{\n\t\"repository\": ");
+		WriteString(f, name);
+		fprintf(f, ",\n\t\"url\": ");
+		WriteString(f, url);
+		fprintf(f, ",\n\t\"succeeded\": %s", error.empty()? "true" : "false");
+		if(error.size()) {
+			fprintf(f, ",\n\t\"error\": ");
+			WriteString(f, error);
+		}
+		fprintf(f, ",\n\t\"seconds\": %.3f", elapsed);
+		for(unsigned int i = 0; i < Counter_NUM; ++i) {
+			fprintf(f, ",\n\t\"%s\": %llu", c_counterNames[i], m_counters[i]);
+		}
+		if(elapsed > 0) {
+			fprintf(f, ",\n\t\"revisionsPerSecond\": %.3f", m_counters[Counter_Revisions] / elapsed);
+			fprintf(f, ",\n\t\"blobMBPerSecond\": %.3f", m_counters[Counter_BlobBytes] / 1048576.0 / elapsed);
+		}
+		fprintf(f, ",\n\t\"peakRSSKB\": %ld", PeakRSS());
+		// Like peakRSSKB, the path table is the whole process's, shared by
+		// every repository it has exported.
+		fprintf(f, ",\n\t\"internedPaths\": %lu", static_cast<unsigned long>(paths));
+		fprintf(f, ",\n\t\"pathTableKB\": %lu", static_cast<unsigned long>(pathBytes / 1024));
+
+		// Times are in seconds; histogram buckets hold the calls which took
+		// less than their upper bound in microseconds (and at least the one
+		// before's), with null for the last.
+		fprintf(f, ",\n\t\"phases\": {");
+		for(unsigned int i = 0; i < Phase_NUM; ++i) {
+			Histogram const& histogram = m_phases[i];
+			fprintf(f, "%s\n\t\t\"%s\": {\"count\": %lu, \"seconds\": %.6f, \"maxSeconds\": %.6f, \"p50Seconds\": %.6f, \"p90Seconds\": %.6f, \"p99Seconds\": %.6f, \"histogram\": [",
+				i? "," : "", c_phaseNames[i], histogram.m_count, Seconds(histogram.m_total), Seconds(histogram.m_max),
+				Seconds(Percentile(histogram, 0.5)), Seconds(Percentile(histogram, 0.9)), Seconds(Percentile(histogram, 0.99)));
+			bool first = true;
+			for(unsigned int bucket = 0; bucket < STATS_BUCKETS; ++bucket) {
+				if(histogram.m_buckets[bucket] == 0) {
+					continue;
+				}
+				if(bucket < STATS_BUCKETS - 1) {
+					fprintf(f, "%s{\"lessThanUs\": %llu, \"count\": %lu}", first? "" : ", ", 1ULL << bucket, histogram.m_buckets[bucket]);
+				} else {
+					fprintf(f, "%s{\"lessThanUs\": null, \"count\": %lu}", first? "" : ", ", histogram.m_buckets[bucket]);
+				}
+				first = false;
+			}
+			fprintf(f, "]}");
+		}
+		fprintf(f, "\n\t}");
+
+		// peakRSSKB is the whole process's, as of the end of the window.
+		fprintf(f, ",\n\t\"windows\": [");
+		for(std::vector<Window>::const_iterator it = m_windows.begin(); it != m_windows.end(); ++it) {
+			fprintf(f, "%s\n\t\t{\"first\": %ld, \"last\": %ld, \"changes\": %lu, \"seconds\": %.3f, \"peakRSSKB\": %ld}",
+				it == m_windows.begin()? "" : ",", it->m_first, it->m_last, it->m_changes, Seconds(it->m_elapsed), it->m_peakRSS);
+		}
+		fprintf(f, "%s]\n}\n", m_windows.empty()? "" : "\n\t");
+	}
+
+	bool failed = fflush(f) != 0;
+	failed = fclose(f) || failed;
+	if(failed || rename(temp.c_str(), fileName.c_str())) {
+		int error = errno;
+		unlink(temp.c_str());
+		throw EXCEPTION(("Could not write stats %s: %s", fileName.c_str(), strerror(error)));
+	}
+}
@@ -0,0 +1,128 @@
+#include "Thread.h"
+#include "Exception.h"
+
+extern "C" {
+#include <apr_general.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+
+#include <svn_pools.h>
+}
+
+Mutex::Mutex()
+{
+	m_pool = svn_pool_create(NULL);
+	if(apr_thread_mutex_create(&m_mutex, APR_THREAD_MUTEX_DEFAULT, m_pool) != APR_SUCCESS) {
+		throw EXCEPTION(("Could not create mutex"));
+	}
+}
+
+Mutex::~Mutex()
+{
+	apr_thread_mutex_destroy(m_mutex);
+	svn_pool_destroy(m_pool);
+}
+
+void Mutex::Lock()
+{
+	apr_thread_mutex_lock(m_mutex);
+}
+
+void Mutex::Unlock()
+{
+	apr_thread_mutex_unlock(m_mutex);
+}
+
+Condition::Condition(Mutex& mutex) :
+	m_mutex(mutex)
+{
+	m_pool = svn_pool_create(NULL);
+	if(apr_thread_cond_create(&m_cond, m_pool) != APR_SUCCESS) {
+		throw EXCEPTION(("Could not create condition variable"));
+	}
+}
+
+Condition::~Condition()
+{
+	apr_thread_cond_destroy(m_cond);
+	svn_pool_destroy(m_pool);
+}
+
+void Condition::Wait()
+{
+	apr_thread_cond_wait(m_cond, m_mutex.m_mutex);
+}
+
+void Condition::Signal()
+{
+	apr_thread_cond_signal(m_cond);
+}
+
+void Condition::Broadcast()
+{
+	apr_thread_cond_broadcast(m_cond);
+}
+
+Semaphore::Semaphore(unsigned int count) :
+	m_available(m_mutex),
+	m_count(count)
+{
+}
+
+Semaphore::~Semaphore()
+{
+}
+
+void Semaphore::Acquire()
+{
+	ScopedLock lock(m_mutex);
+	while(m_count == 0) {
+		m_available.Wait();
+	}
+	m_count -= 1;
+}
+
+void Semaphore::Release()
+{
+	ScopedLock lock(m_mutex);
+	m_count += 1;
+	m_available.Signal();
+}
+
+Thread::Thread() :
+	m_pool(NULL),
+	m_thread(NULL)
+{
+}
+
+Thread::~Thread()
+{
+	if(m_pool) {
+		svn_pool_destroy(m_pool);
+	}
+}
+
+void* Thread::Thunk(apr_thread_t* thread, void* data)
+{
+	static_cast<Thread*>(data)->Run();
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+void Thread::Start()
+{
+	m_pool = svn_pool_create(NULL);
+	if(apr_thread_create(&m_thread, NULL, &Thunk, this, m_pool) != APR_SUCCESS) {
+		throw EXCEPTION(("Could not create thread"));
+	}
+}
+
+void Thread::Join()
+{
+	if(m_thread) {
+		apr_status_t status;
+		apr_thread_join(&status, m_thread);
+		m_thread = NULL;
+	}
+}
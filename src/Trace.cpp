@@ -0,0 +1,146 @@
+#include "Trace.h"
+#include "Thread.h"
+#include "Exception.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+extern "C" {
+#include <apr_thread_proc.h>
+#include <svn_pools.h>
+}
+
+FILE* Trace::s_file = NULL;
+Mutex* Trace::s_lock = NULL;
+apr_pool_t* Trace::s_pool = NULL;
+apr_threadkey_t* Trace::s_threadId = NULL;
+unsigned long Trace::s_nextThreadId = 1;
+apr_time_t Trace::s_start = 0;
+bool Trace::s_first = true;
+
+static void AppendString(std::string& out, char const* value)
+{
+	out.push_back('"');
+	for(; *value; ++value) {
+		unsigned char c = *value;
+		if(c == '"' || c == '\\') {
+			out.push_back('\\');
+			out.push_back(c);
+		} else if(c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out.append(escaped);
+		} else {
+			out.push_back(c);
+		}
+	}
+	out.push_back('"');
+}
+
+void Trace::Init()
+{
+	s_lock = new Mutex();
+	s_pool = svn_pool_create(NULL);
+	if(apr_threadkey_private_create(&s_threadId, NULL, s_pool) != APR_SUCCESS) {
+		throw EXCEPTION(("Could not create thread key"));
+	}
+}
+
+void Trace::Open(std::string const& fileName)
+{
+	FILE* f = fopen(fileName.c_str(), "w");
+	if(f == NULL) {
+		throw EXCEPTION(("Could not write trace %s: %s", fileName.c_str(), strerror(errno)));
+	}
+	fprintf(f, "[");
+	s_start = apr_time_now();
+	s_first = true;
+	s_file = f;
+}
+
+void Trace::Close()
+{
+	if(s_file == NULL) {
+		return;
+	}
+
+	ScopedLock lock(*s_lock);
+	fprintf(s_file, "\n]\n");
+	fclose(s_file);
+	s_file = NULL;
+}
+
+unsigned long Trace::ThreadId()
+{
+	void* id = NULL;
+	apr_threadkey_private_get(&id, s_threadId);
+	if(id == NULL) {
+		id = reinterpret_cast<void*>(static_cast<uintptr_t>(s_nextThreadId++));
+		apr_threadkey_private_set(id, s_threadId);
+	}
+	return static_cast<unsigned long>(reinterpret_cast<uintptr_t>(id));
+}
+
+void Trace::WriteEvent(std::string const& event)
+{
+	fprintf(s_file, "%s\n%s", s_first? "" : ",", event.c_str());
+	s_first = false;
+}
+
+void Trace::NameThread(std::string const& name)
+{
+	if(s_file == NULL) {
+		return;
+	}
+
+	std::string event;
+	ScopedLock lock(*s_lock);
+	char header[128];
+	snprintf(header, sizeof(header), "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %lu, \"args\": {\"name\": ", ThreadId());
+	event.append(header);
+	AppendString(event, name.c_str());
+	event.append("}}");
+	WriteEvent(event);
+}
+
+void Trace::Span::AddArg(char const* key, long value)
+{
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "%ld", value);
+	m_args.append(m_args.empty()? "" : ", ");
+	AppendString(m_args, key);
+	m_args.append(": ");
+	m_args.append(buffer);
+}
+
+void Trace::Span::AddArg(char const* key, char const* value)
+{
+	m_args.append(m_args.empty()? "" : ", ");
+	AppendString(m_args, key);
+	m_args.append(": ");
+	AppendString(m_args, value);
+}
+
+void Trace::Span::End()
+{
+	apr_time_t end = apr_time_now();
+
+	std::string event("{\"name\": ");
+	AppendString(event, m_name);
+
+	ScopedLock lock(*s_lock);
+	if(s_file == NULL) {
+		return;
+	}
+	char times[128];
+	snprintf(times, sizeof(times), ", \"ph\": \"X\", \"pid\": 1, \"tid\": %lu, \"ts\": %ld, \"dur\": %ld", ThreadId(), static_cast<long>(m_start - s_start), static_cast<long>(end - m_start));
+	event.append(times);
+	if(m_args.size()) {
+		event.append(", \"args\": {");
+		event.append(m_args);
+		event.append("}");
+	}
+	event.append("}");
+	WriteEvent(event);
+}
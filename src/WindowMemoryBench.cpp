@@ -0,0 +1,178 @@
+// Peak memory of a window of revisions holding large directory copies, as
+// built by Replay and ExpandDirectories.
+//
+//   window-memory-bench [strings] [revisions] [copy files] [copy every]
+//
+// By default 256 revisions, every 16th of which copies a 100000 file
+// branch.  With "strings" files hold their paths in std::strings and
+// revisions are copied into the window, as they were before paths were
+// interned.  Run each mode in its own process; the figure is the peak RSS.
+
+#include "SVNSimple.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+extern "C" {
+#include <apr_general.h>
+}
+
+typedef SVNSimple::Revision Revision;
+
+// Revision::File and Revision as they were before.
+struct StringFile
+{
+	StringFile() : m_action('X'), m_type('U'), m_expand(false), m_copyTree(false), m_copyFromRev(SVN_INVALID_REVNUM) { }
+	char m_action;
+	char m_type;
+	bool m_expand;
+	bool m_copyTree;
+	std::string m_relPath;
+	std::string m_copyFromPath;
+	svn_revnum_t m_copyFromRev;
+	std::string m_contentFile;
+};
+
+struct StringRevision
+{
+	svn_revnum_t m_revision;
+	std::string m_user;
+	std::string m_log;
+	time_t m_date;
+	std::vector<StringFile> m_files;
+};
+
+static char const* MakeFileName(unsigned long i)
+{
+	static char name[64];
+	snprintf(name, sizeof(name), "module%lu/sub%lu/file%lu.c", i % 211, i % 13, i);
+	return name;
+}
+
+static void MakeBranchName(unsigned long r, char* name, size_t size)
+{
+	snprintf(name, size, "branches/release-%lu", r);
+}
+
+static void BuildInterned(unsigned long revisions, unsigned long copyFiles, unsigned long copyEvery)
+{
+	std::vector<Revision> window;
+	for(unsigned long r = 1; r <= revisions; ++r) {
+		Revision rev;
+		rev.m_revision = r;
+		rev.m_user = "someone";
+		rev.m_log = "A commit message of a typical length, with some detail.";
+
+		Revision::File change;
+		change.m_action = 'M';
+		change.m_type = 'F';
+		change.m_relPath = Path("trunk").Child(MakeFileName(r));
+		rev.m_files.push_back(change);
+
+		if(r % copyEvery == 0) {
+			char branch[64];
+			MakeBranchName(r, branch, sizeof(branch));
+
+			Revision::File dir;
+			dir.m_action = 'A';
+			dir.m_type = 'D';
+			dir.m_expand = true;
+			dir.m_relPath = Path(branch);
+			dir.m_copyFromPath = Path("trunk");
+			dir.m_copyFromRev = r - 1;
+			rev.m_files.push_back(dir);
+
+			for(unsigned long i = 0; i < copyFiles; ++i) {
+				Revision::File file(dir);
+				file.m_type = 'F';
+				file.m_relPath = dir.m_relPath.Child(MakeFileName(i));
+				rev.m_files.push_back(file);
+			}
+		}
+
+		window.push_back(Revision());
+		window.back().swap(rev);
+	}
+
+	size_t paths, bytes;
+	Path::TableSize(paths, bytes);
+	printf("interned: %lu revisions, %lu distinct paths, %lu KB path table\n", window.size(), paths, bytes / 1024);
+}
+
+static void BuildStrings(unsigned long revisions, unsigned long copyFiles, unsigned long copyEvery)
+{
+	std::vector<StringRevision> window;
+	for(unsigned long r = 1; r <= revisions; ++r) {
+		StringRevision rev;
+		rev.m_revision = r;
+		rev.m_user = "someone";
+		rev.m_log = "A commit message of a typical length, with some detail.";
+
+		StringFile change;
+		change.m_action = 'M';
+		change.m_type = 'F';
+		change.m_relPath = std::string("trunk/") + MakeFileName(r);
+		rev.m_files.push_back(change);
+
+		if(r % copyEvery == 0) {
+			char branch[64];
+			MakeBranchName(r, branch, sizeof(branch));
+
+			StringFile dir;
+			dir.m_action = 'A';
+			dir.m_type = 'D';
+			dir.m_expand = true;
+			dir.m_relPath = branch;
+			dir.m_copyFromPath = "trunk";
+			dir.m_copyFromRev = r - 1;
+			rev.m_files.push_back(dir);
+
+			for(unsigned long i = 0; i < copyFiles; ++i) {
+				StringFile file(dir);
+				file.m_type = 'F';
+				file.m_relPath.append("/");
+				file.m_relPath.append(MakeFileName(i));
+				rev.m_files.push_back(file);
+			}
+		}
+
+		window.push_back(rev);
+	}
+
+	printf("strings: %lu revisions\n", window.size());
+}
+
+int main(int argc, char** argv)
+{
+	if(apr_initialize() != APR_SUCCESS) {
+		fprintf(stderr, "APR Initialisation failed\n");
+		return 1;
+	}
+
+	bool strings = false;
+	int arg = 1;
+	if(argc > arg && strcmp(argv[arg], "strings") == 0) {
+		strings = true;
+		arg += 1;
+	}
+	unsigned long revisions = argc > arg? strtoul(argv[arg++], NULL, 10) : 256;
+	unsigned long copyFiles = argc > arg? strtoul(argv[arg++], NULL, 10) : 100000;
+	unsigned long copyEvery = argc > arg? strtoul(argv[arg++], NULL, 10) : 16;
+	if(copyEvery == 0) {
+		copyEvery = 1;
+	}
+
+	if(strings) {
+		BuildStrings(revisions, copyFiles, copyEvery);
+	} else {
+		BuildInterned(revisions, copyFiles, copyEvery);
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("peak RSS: %ld MB\n", usage.ru_maxrss / 1024);
+
+	return 0;
+}
@@ -1,19 +1,46 @@
 #include "SVNSimple.h"
 #include "FastExport.h"
+#include "FetchPool.h"
+#include "BoundedQueue.h"
+#include "BaseTextStore.h"
+#include "BlobCache.h"
+#include "Checkpoint.h"
+#include "RevisionIndex.h"
+#include "FileContents.h"
+#include "Filters.h"
+#include "IgnoreRules.h"
+#include "Layout.h"
+#include "Output.h"
+#include "PlaybackSession.h"
+#include "Recording.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Exception.h"
 
+#include <errno.h>
 #include <string.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <fnmatch.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern "C" {
+#include <apr_time.h>
+}
 
 #include <string>
 #include <vector>
 #include <map>
-#include <sstream>
 
 #define LF "\x0A"
 
+// Output is written in buffers of this size, up to this many of which can
+// be waiting for git.
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define OUTPUT_BUFFERS (16)
+
 enum Configs
 {
 	Config_RepoURL,
@@ -26,11 +53,32 @@ enum Configs
 	Config_Username,
 	Config_Password,
 	Config_UserPrefix,
+	Config_FetchWorkers,
+	Config_PipelineDepth,
+	Config_DeltaStore,
+	Config_DeltaStoreLimit,
+	Config_WindowSeconds,
+	Config_WindowChanges,
+	Config_BlobCache,
+	Config_CheckpointFile,
+	Config_CheckpointSeconds,
+	Config_MarksFile,
+	Config_TrunkPath,
+	Config_BranchesPath,
+	Config_TagsPath,
+	Config_OutputCommand,
+	Config_OutputFile,
+	Config_StatsFile,
+	Config_StatsSeconds,
+	Config_RecordFile,
+	Config_Jobs,
+	Config_MaxRequests,
+	Config_TraceFile,
+	Config_PlaybackLatency,
 
 	Config_NUM
 };
 
-typedef std::map<std::string, std::string> UserMap;
 struct Config
 {
 	struct Item
@@ -41,24 +89,52 @@ struct Config
 	};
 	static Item const keys[Config_NUM];
 
-	std::vector<std::string> ignoredPaths;
+	Config() : onlyRepository(true) { }
+
+	IgnoreRules ignoreRules;
 	std::string config[Config_NUM];
 
 	UserMap users;
+
+	// Process wide settings are only changed for the only repository being
+	// exported.
+	bool onlyRepository;
 };
 
 #define DefItem(str, help) { str, (sizeof(str) / sizeof(str[0])) - 1, help }
 Config::Item const Config::keys[Config_NUM] = {
-	DefItem("repo-url ", "The URL of the svn repository to fetch from"),
+	DefItem("repo-url ", "The URL of the svn repository to fetch from.  file:// repositories are read directly rather than through the RA layer, and dump:///path/to/file.dump/sub/tree reads an svnadmin dump file (or several concatenated, for incremental dumps) in place of a repository.  recording:///path/to/file answers every request from a record-file instead."),
 	DefItem("repo-name ", "The friendly name for this repository"),
 	DefItem("git-ref ", "The (fully specified) git ref to update.  Defaults to refs/remotes/svn/repo-name"),
 	DefItem("parent-sha ", "The SHA of the object which should be the parent of the first commit fetched.  If not specified then the first revision will not have a parent."),
-	DefItem("start-rev ", "The first revision to import"),
+	DefItem("start-rev ", "The first revision to import.  Defaults to the revision after the last one committed according to the marks-file."),
 	DefItem("end-rev ", "The last revision to import. Default to the youngest revision in the repo."),
 	DefItem("ignore-path ", "Ignores any paths which fnmatch against the provided pattern.  Note that all paths are relative to the repo-url. Can be specified multiple times."),
 	DefItem("username ", "The username to use when authenticating with the repository"),
 	DefItem("password ", "The password to use when authenticating with the repository"),
 	DefItem("remove-user-prefix ", "A prefix which will be removed from usernames with that prefix"),
+	DefItem("fetch-workers ", "The number of extra sessions used to fetch file contents in parallel.  0 fetches every file over the main session.  Defaults to 4."),
+	DefItem("pipeline-depth ", "The number of replayed revisions which may be queued up waiting to be written out.  Defaults to 8."),
+	DefItem("delta-store ", "A directory in which to keep the latest text of each file.  When set, revisions are replayed with text deltas which are applied to these texts, rather than fetching the full text of every modified file."),
+	DefItem("delta-store-limit ", "The maximum size of the delta-store in MB.  The least recently used texts are dropped beyond this.  Defaults to 1024."),
+	DefItem("window-seconds ", "How long each request to replay a range of revisions should take.  The number of revisions asked for is adjusted towards this.  Defaults to 10."),
+	DefItem("window-changes ", "The most changes (after expanding directory copies) each request to replay a range of revisions should produce.  Defaults to 100000."),
+	DefItem("blob-cache ", "A directory in which to keep the contents of every file fetched, so that exporting the same revisions again does not fetch them from the server.  Only use a cache with the repo-url it was created for."),
+	DefItem("checkpoint-file ", "A file in which to record how far the export has got each time git fast-import is told to checkpoint.  If the git ref is still where the last checkpoint left it, the next run carries on after the last revision checkpointed rather than from start-rev."),
+	DefItem("checkpoint-seconds ", "How often to checkpoint when there is a checkpoint-file.  Defaults to 60."),
+	DefItem("marks-file ", "The file git fast-import is given with --import-marks-if-exists and --export-marks.  Blobs it already has are not sent again, and the commits made from each revision are recorded in marks-file.revs so that the next run can carry on from the last one without being given start-rev or parent-sha."),
+	DefItem("trunk-path ", "Where trunk is, relative to the repo-url.  Setting this, branches-path or tags-path exports the whole project in one pass: trunk is committed to git-ref/trunk, each branch to git-ref/name and each tag to refs/tags/name.  Branches and tags copied whole from another start from its commit rather than being fetched again."),
+	DefItem("branches-path ", "The directory, relative to the repo-url, each directory in which is a branch."),
+	DefItem("tags-path ", "The directory, relative to the repo-url, each directory in which is a tag."),
+	DefItem("output-command ", "A command, run with sh, to write the fast-import stream to rather than stdout; e.g. git fast-import.  It must succeed for the export to."),
+	DefItem("output-file ", "A file, or FIFO, to write the fast-import stream to rather than stdout."),
+	DefItem("stats-file ", "A file to write a JSON report to once the export finishes, or fails: revisions, blobs and bytes, and the count, total time and a latency histogram of replaying, listing directories, fetching files and waiting for git.  Give each repository its own."),
+	DefItem("stats-seconds ", "How often to write a progress line with the rates and time spent in each of those so far.  0 for only at the end.  Defaults to 60."),
+	DefItem("record-file ", "A file to record every answer the repository gives to, so that the export can be run again, for the same revisions and options, with repo-url recording:///path/to/file and no repository.  Recording a later run to the same file adds to it."),
+	DefItem("jobs ", "How many repositories to export at once, when there is more than one.  Only read before the first repository.  Defaults to 4."),
+	DefItem("max-requests ", "The most file and directory requests made at once, over every repository.  Replays are not counted.  Only read before the first repository.  Defaults to no limit."),
+	DefItem("trace-file ", "A file to write a timeline of the export to, in Chrome's trace event format, for chrome://tracing or Perfetto.  It has a span for each replay window, directory expansion and listing, file fetch, commit and write to git.  Only read before the first repository."),
+	DefItem("playback-latency ", "How many milliseconds each request to a recording:// repo-url takes before it is answered, to see how an export would go against a server that far away.  Only read before the first repository.  Defaults to 0."),
 };
 #undef DefItem
 
@@ -67,75 +143,6 @@ static T Min(T const& a, T const& b) {
 	return a < b? a : b;
 }
 
-static std::vector<std::string>::const_iterator Matches(std::string const& str, std::vector<std::string> const& patterns)
-{
-	for(std::vector<std::string>::const_iterator pit = patterns.begin(); pit != patterns.end(); ++pit) {
-		if(fnmatch(pit->c_str(), str.c_str(), 0) == 0)
-		{
-			return pit;
-		}
-	}
-
-	return patterns.end();
-}
-
-void FilterIgnoredFiles(std::vector<SVNSimple::Revision>& revisions, std::vector<std::string> const& ignorePatterns)
-{
-	std::vector<std::string>::const_iterator pattern;
-	for(std::vector<SVNSimple::Revision>::iterator rit = revisions.begin(); rit != revisions.end(); ++rit) {
-		for(std::vector<SVNSimple::Revision::File>::iterator fit = rit->m_files.begin(); fit != rit->m_files.end(); ++fit) {
-			SVNSimple::Revision::File& file = *fit;
-			pattern = Matches(file.m_relPath, ignorePatterns);
-			if(pattern != ignorePatterns.end()) {
-				file.m_action = 'I';
-				printf("# %lu > %c %s - Ignored by ignore pattern %s" LF, rit->m_revision, file.m_action, file.m_relPath.c_str(), pattern->c_str());
-			}
-		}
-	}
-}
-
-void AddSVNSourceTag(std::vector<SVNSimple::Revision>& revisions, std::string const& repoName)
-{
-	std::string tag("\n\nsvn-source: ");
-	tag.append(repoName);
-	tag.append("@");
-
-	for(std::vector<SVNSimple::Revision>::iterator rit = revisions.begin(); rit != revisions.end(); ++rit) {
-		std::ostringstream ss;
-		ss << rit->m_log;
-		ss << tag;
-		ss << rit->m_revision;
-
-		rit->m_log = ss.str();
-	}
-}
-
-void RewriteCommitters(std::vector<SVNSimple::Revision>& revisions, UserMap users, std::string const& prefix)
-{
-	for(std::vector<SVNSimple::Revision>::iterator rit = revisions.begin(); rit != revisions.end(); ++rit) {
-		SVNSimple::Revision& rev = *rit;
-
-		if(rev.m_user.size()) {
-			if(prefix.size() && rev.m_user.size() >= prefix.size()) {
-				if(rev.m_user.compare(0, prefix.size(), prefix) == 0)
-				{
-					rev.m_user = rev.m_user.substr(prefix.size());
-				}
-			}
-			UserMap::const_iterator it = users.find(rev.m_user);
-			if(it == users.end()) {
-				std::ostringstream ss;
-				ss << rev.m_user << " <" << rev.m_user << "@localhost>";
-				rev.m_user = ss.str();
-			} else {
-				rev.m_user = it->second;
-			}
-		} else {
-			rev.m_user = "Unknown <Unknown@localhost>";
-		}
-	}
-}
-
 void ReadConfigLine(Config& config, char const* line)
 {
 	for(unsigned int i = 0; i < Config_NUM; i += 1)
@@ -144,7 +151,7 @@ void ReadConfigLine(Config& config, char const* line)
 		{
 			if(i == Config_IgnorePath)
 			{
-				config.ignoredPaths.push_back(line + Config::keys[i].len);
+				config.ignoreRules.Add(line + Config::keys[i].len);
 			}
 			else
 			{
@@ -179,7 +186,9 @@ void ReadUserLine(Config& config, char const* line)
 	config.users[std::string(line, endKey - line + 1)] = startValue;
 }
 
-void ReadConfig(Config& config)
+// Settings before the first repository line apply to every repository,
+// or are the only repository's if there are none.
+void ReadConfig(Config& defaults, std::vector<Config>& repositories)
 {
 	static size_t const c_bufSz = 2048;
 	static size_t const c_lineSz = 512;
@@ -199,6 +208,7 @@ void ReadConfig(Config& config)
 
 				line[linePos] = '\0';
 
+				Config& config = repositories.empty()? defaults : repositories.back();
 				if(line[0] == '=')
 				{
 					ReadConfigLine(config, line + 1);
@@ -207,6 +217,11 @@ void ReadConfig(Config& config)
 				{
 					ReadUserLine(config, line + 1);
 				}
+				else if(line[0] == '*')
+				{
+					repositories.push_back(defaults);
+					repositories.back().config[Config_RepoName] = line + 1;
+				}
 				else
 				{
 					fprintf(stderr, "[ERROR] Unknown config line type: %s\n", line);
@@ -239,6 +254,20 @@ static void help()
 		"=start-rev 0\n"
 		"+Harry = Harry Smith <hsmith@aplace.com>\n"
 		"\n"
+		"To export several repositories at once, start each one's options with a *\n"
+		"and its name.  Anything before the first applies to all of them:\n\n"
+
+		"=jobs 2\n"
+		"+Harry = Harry Smith <hsmith@aplace.com>\n"
+		"*Bar\n"
+		"=repo-url svn://localhost/bar\n"
+		"=start-rev 0\n"
+		"=output-command git --git-dir=bar.git fast-import\n"
+		"*Baz\n"
+		"=repo-url svn://localhost/baz\n"
+		"=start-rev 0\n"
+		"=output-command git --git-dir=baz.git fast-import\n"
+		"\n"
 		"All config options:\n"
 	);
 	for(unsigned int i = 0; i < Config_NUM; i += 1)
@@ -247,11 +276,332 @@ static void help()
 	}
 }
 
-void Export(Config& config)
+typedef std::vector<SVNSimple::Revision> RevisionWindow;
+
+#define MIN_WINDOW (1)
+#define MAX_WINDOW (16384)
+#define FIRST_WINDOW (64)
+
+/**
+ * Picks how many revisions to replay per request.  Long runs of small
+ * commits get large windows so the per-request overhead is spread out;
+ * large copies shrink them so a single request doesn't run on for too
+ * long or produce too many changes.
+ */
+class WindowSizer
 {
-	SVNSimple connection(config.config[Config_RepoURL], config.config[Config_Username], config.config[Config_Password]);
+public:
+	WindowSizer(double targetSeconds, unsigned long targetChanges) :
+		m_targetSeconds(targetSeconds),
+		m_targetChanges(targetChanges),
+		m_size(FIRST_WINDOW)
+	{
+	}
+
+	svn_revnum_t Size() const { return m_size; }
+
+	void Observe(svn_revnum_t revisions, unsigned long changes, double seconds)
+	{
+		// Grow by at most double each time; shrink as far as needed.
+		double scale = 2.0;
+		if(seconds > 0 && m_targetSeconds / seconds < scale) {
+			scale = m_targetSeconds / seconds;
+		}
+		if(changes > 0 && static_cast<double>(m_targetChanges) / changes < scale) {
+			scale = static_cast<double>(m_targetChanges) / changes;
+		}
+
+		double size = revisions * scale;
+		m_size = size < MIN_WINDOW? MIN_WINDOW : size > MAX_WINDOW? MAX_WINDOW : static_cast<svn_revnum_t>(size);
+	}
+
+private:
+	double m_targetSeconds;
+	unsigned long m_targetChanges;
+	svn_revnum_t m_size;
+};
+
+/**
+ * Replays revisions and runs the filter passes over them on its own thread
+ * and session.  Each revision is handed over as soon as it has been
+ * replayed, so memory is bounded by the queue depth times the largest
+ * revision rather than by the replay window.
+ */
+class ReplayStage : public Thread, private SVNSimple::RevisionSink
+{
+public:
+	ReplayStage(Config const& config, svn_revnum_t startRev, svn_revnum_t endRev, unsigned int depth, WindowSizer const& sizer, BaseTextStore* baseTexts, Layout const* layout, Recorder* recorder) :
+		m_config(config),
+		m_connection(config.config[Config_RepoURL], config.config[Config_Username], config.config[Config_Password]),
+		m_startRev(startRev),
+		m_endRev(endRev),
+		m_sizer(sizer),
+		m_output(Output::Current()),
+		m_stats(Stats::Current()),
+		m_windowChanges(0),
+		m_windowWaiting(0),
+		m_revisions(depth)
+	{
+		m_connection.SetBaseTextStore(baseTexts);
+		m_connection.SetIgnoreRules(&config.ignoreRules);
+		m_connection.SetLayout(layout);
+		m_connection.SetParented(config.config[Config_ParentSHA].size() > 0);
+		if(recorder)
+		{
+			m_connection.SetRecorder(recorder);
+		}
+	}
+
+	~ReplayStage()
+	{
+		m_revisions.Close();
+		Join();
+	}
+
+	// Waits for the next revision, then takes any others already queued up
+	// behind it.  Returns false once every revision has been handed out.
+	// Rethrows any error hit while replaying.
+	bool NextRevisions(RevisionWindow& revisions)
+	{
+		revisions.clear();
+		revisions.push_back(SVNSimple::Revision());
+		if(!m_revisions.Pop(revisions.back())) {
+			if(m_error.size()) {
+				throw EXCEPTION(("Replay failed: %s", m_error.c_str()));
+			}
+			return false;
+		}
+
+		SVNSimple::Revision rev;
+		while(m_revisions.TryPop(rev)) {
+			revisions.push_back(SVNSimple::Revision());
+			revisions.back().swap(rev);
+		}
+		return true;
+	}
+
+protected:
+	void Run()
+	{
+		Output::Scope scope(m_output);
+		Stats::Scope statsScope(m_stats);
+		Trace::NameThread("Replay " + m_config.config[Config_RepoName]);
+		try {
+			ReplayWindows();
+		} catch(std::exception const& e) {
+			m_error = e.what();
+		}
+		m_revisions.Close();
+	}
+
+	void ReplayWindows()
+	{
+		svn_revnum_t curStart = m_startRev;
+		while(curStart <= m_endRev)
+		{
+			svn_revnum_t curEnd = Min(m_endRev, curStart + m_sizer.Size() - 1);
+			Output::Printf("progress Getting log for revisions %lu:%lu (window of %lu)" LF, curStart, curEnd, curEnd - curStart + 1);
+
+			m_windowChanges = 0;
+			m_windowWaiting = 0;
+			apr_time_t listed = m_stats? m_stats->GetTotal(Stats::Phase_List) : 0;
+			apr_time_t start = apr_time_now();
+			{
+				Trace::Span span("Replay");
+				span.Arg("first", curStart);
+				span.Arg("last", curEnd);
+				m_connection.Replay(*this, curStart, curEnd);
+			}
+			// Time spent waiting for the exporter says nothing about the window.
+			apr_time_t elapsed = apr_time_now() - start - m_windowWaiting;
+			m_sizer.Observe(curEnd - curStart + 1, m_windowChanges, static_cast<double>(elapsed) / APR_USEC_PER_SEC);
+			if(m_stats) {
+				// This thread does all of the listing, and is the only one.
+				m_stats->Record(Stats::Phase_Replay, elapsed - (m_stats->GetTotal(Stats::Phase_List) - listed));
+				m_stats->EndWindow(curStart, curEnd, m_windowChanges, elapsed);
+			}
+
+			curStart = curEnd + 1;
+		}
+	}
+
+	void Consume(SVNSimple::Revision& rev)
+	{
+		m_windowChanges += rev.m_files.size();
+
+		FilterIgnoredFiles(rev, m_config.ignoreRules);
+		AddSVNSourceTag(rev, m_config.config[Config_RepoName]);
+		RewriteCommitters(rev, m_config.users, m_config.config[Config_UserPrefix]);
+
+		Trace::Span span("QueueRevision");
+		span.Arg("revision", rev.m_revision);
+		apr_time_t start = apr_time_now();
+		if(!m_revisions.Push(rev)) {
+			throw EXCEPTION(("Export stopped"));
+		}
+		m_windowWaiting += apr_time_now() - start;
+	}
+
+	Config const& m_config;
+	SVNSimple m_connection;
+	svn_revnum_t m_startRev;
+	svn_revnum_t m_endRev;
+	WindowSizer m_sizer;
+	Output* m_output;
+	Stats* m_stats;
+	unsigned long m_windowChanges;
+	apr_time_t m_windowWaiting;
+	BoundedQueue<SVNSimple::Revision> m_revisions;
+	std::string m_error;
+};
+
+// Has fast-import update the ref, and only then records that it has.
+void SaveCheckpoint(FastExport& exporter, Checkpoint& checkpoint, std::string const& fileName)
+{
+	exporter.Checkpoint(checkpoint.m_revision);
+	Output::Flush();
+
+	if(SVN_IS_VALID_REVNUM(exporter.GetLastRevisionCommitted()))
+	{
+		checkpoint.m_committed = exporter.GetLastRevisionCommitted();
+	}
+	checkpoint.m_nextMark = exporter.GetNextMark();
+	checkpoint.Save(fileName);
+}
+
+void ExportRevisions(Config const& config, SVNSimple& connection, FastExport& exporter, BaseTextStore* baseTexts, BlobCache* blobCache, Checkpoint& checkpoint, svn_revnum_t startRev, svn_revnum_t endRev)
+{
+	unsigned int fetchWorkers = 4;
+	if(config.config[Config_FetchWorkers].size())
+	{
+		fetchWorkers = strtoul(config.config[Config_FetchWorkers].c_str(), NULL, 0);
+	}
+	FetchPool fetcher(connection, config.config[Config_RepoURL], config.config[Config_Username], config.config[Config_Password], fetchWorkers);
+	fetcher.SetBaseTextStore(baseTexts);
+	fetcher.SetBlobCache(blobCache);
+	if(connection.GetRecorder())
+	{
+		fetcher.SetRecorder(connection.GetRecorder());
+	}
+
+	if(checkpoint.m_nextMark > exporter.GetNextMark())
+	{
+		exporter.SetNextMark(checkpoint.m_nextMark);
+	}
+
+	std::string const& checkpointFile = config.config[Config_CheckpointFile];
+	double checkpointSeconds = 60;
+	if(config.config[Config_CheckpointSeconds].size())
+	{
+		checkpointSeconds = strtod(config.config[Config_CheckpointSeconds].c_str(), NULL);
+	}
+	apr_time_t lastCheckpoint = apr_time_now();
+
+	unsigned int pipelineDepth = 8;
+	if(config.config[Config_PipelineDepth].size())
+	{
+		pipelineDepth = strtoul(config.config[Config_PipelineDepth].c_str(), NULL, 0);
+	}
+	double windowSeconds = 10;
+	if(config.config[Config_WindowSeconds].size())
+	{
+		windowSeconds = strtod(config.config[Config_WindowSeconds].c_str(), NULL);
+	}
+	unsigned long windowChanges = 100000;
+	if(config.config[Config_WindowChanges].size())
+	{
+		windowChanges = strtoul(config.config[Config_WindowChanges].c_str(), NULL, 0);
+	}
+	WindowSizer sizer(windowSeconds, windowChanges);
+
+	Stats* stats = Stats::Current();
+	double statsSeconds = 60;
+	if(config.config[Config_StatsSeconds].size())
+	{
+		statsSeconds = strtod(config.config[Config_StatsSeconds].c_str(), NULL);
+	}
+	apr_time_t lastStats = apr_time_now();
+
+	ReplayStage replayer(config, startRev, endRev, pipelineDepth, sizer, baseTexts, exporter.GetLayout(), connection.GetRecorder());
+	replayer.Start();
+
+	RevisionWindow revisions;
+	while(replayer.NextRevisions(revisions))
+	{
+		exporter.DumpRevisions(fetcher, revisions);
+		checkpoint.m_revision = revisions.back().m_revision;
+		for(RevisionWindow::const_iterator it = revisions.begin(); it != revisions.end(); ++it)
+		{
+			Stats::Count(Stats::Counter_Changes, it->m_files.size());
+		}
+		Stats::Count(Stats::Counter_Revisions, revisions.size());
+
+		if(stats && statsSeconds > 0 && apr_time_now() - lastStats >= statsSeconds * APR_USEC_PER_SEC)
+		{
+			stats->PrintProgress();
+			lastStats = apr_time_now();
+		}
+
+		if(checkpointFile.size() && apr_time_now() - lastCheckpoint >= checkpointSeconds * APR_USEC_PER_SEC)
+		{
+			SaveCheckpoint(exporter, checkpoint, checkpointFile);
+			lastCheckpoint = apr_time_now();
+		}
+		else
+		{
+			// Nothing else is ready, so don't hold back what has been written.
+			Output::Push();
+		}
+	}
+
+	if(checkpointFile.size())
+	{
+		// Revisions after the last one with changes still count as done.
+		checkpoint.m_revision = endRev;
+		SaveCheckpoint(exporter, checkpoint, checkpointFile);
+	}
+
+	if(stats)
+	{
+		stats->PrintProgress();
+	}
+}
+
+void ExportHistory(Config& config, SVNSimple& connection, FastExport& exporter, RevisionIndex const* revisionIndex)
+{
+	svn_revnum_t startRev;
+	if(config.config[Config_StartRev].size())
+	{
+		startRev = strtoul(config.config[Config_StartRev].c_str(), NULL, 0);
+	}
+	else if(revisionIndex && revisionIndex->Size())
+	{
+		startRev = (*revisionIndex)[revisionIndex->Size() - 1].m_revision + 1;
+	}
+	else
+	{
+		throw EXCEPTION(("No start revision specified, and no commits in the marks-file to carry on from"));
+	}
+
+	// The ref was made up to the revision before start-rev.
+	svn_revnum_t committed = SVN_INVALID_REVNUM;
+	if(startRev > 0 && config.config[Config_ParentSHA].size())
+	{
+		committed = startRev - 1;
+	}
+	else if(startRev > 0 && revisionIndex)
+	{
+		// Carry on from the last commit made before start-rev.
+		RevisionIndex::Entry const* parent = revisionIndex->Find(startRev - 1);
+		std::string id;
+		if(parent && exporter.GetMarkId(parent->m_mark, id))
+		{
+			config.config[Config_ParentSHA] = id;
+			exporter.SetParent(id);
+			committed = parent->m_revision;
+		}
+	}
 
-	svn_revnum_t startRev = strtoul(config.config[Config_StartRev].c_str(), NULL, 0);
 	svn_revnum_t latestRev = connection.GetLatestRevision();
 	svn_revnum_t endRev = latestRev;
 	if(config.config[Config_EndRev].size())
@@ -260,8 +610,32 @@ void Export(Config& config)
 		endRev = Min(endRev, latestRev);
 	}
 
+	// If the ref is where the checkpoint left it, carry on from there.
+	Checkpoint checkpoint;
+	checkpoint.m_url = config.config[Config_RepoURL];
+	checkpoint.m_ref = config.config[Config_GitRef];
+	checkpoint.m_committed = committed;
+	std::string const& checkpointFile = config.config[Config_CheckpointFile];
+	if(checkpointFile.size())
+	{
+		Checkpoint saved;
+		if(saved.Load(checkpointFile) && saved.Matches(checkpoint.m_url, checkpoint.m_ref, committed + 1))
+		{
+			Output::Printf("progress Resuming after revision %lu from checkpoint %s" LF, saved.m_revision, checkpointFile.c_str());
+			checkpoint = saved;
+			startRev = saved.m_revision + 1;
+			if(config.config[Config_ParentSHA].empty())
+			{
+				// Carry on from wherever the ref is.
+				config.config[Config_ParentSHA] = config.config[Config_GitRef] + "^0";
+				exporter.SetParent(config.config[Config_ParentSHA]);
+			}
+		}
+	}
+	checkpoint.m_revision = startRev - 1;
+
 	if(endRev < startRev) {
-		printf(
+		Output::Printf(
 			"progress No more revisions available from %s (%s)" LF,
 			config.config[Config_RepoURL].c_str(),
 			config.config[Config_RepoName].c_str()
@@ -271,7 +645,7 @@ void Export(Config& config)
 
 	{
 		std::string const& parentSHA = config.config[Config_ParentSHA];
-		printf(
+		Output::Printf(
 			"progress Starting import from %s (%s) %lu:%lu to %s (%s)" LF,
 			config.config[Config_RepoURL].c_str(),
 			config.config[Config_RepoName].c_str(),
@@ -282,76 +656,408 @@ void Export(Config& config)
 		);
 	}
 
+	BaseTextStore* baseTexts = NULL;
+	if(config.config[Config_DeltaStore].size())
+	{
+		unsigned long long limit = 1024;
+		if(config.config[Config_DeltaStoreLimit].size())
+		{
+			limit = strtoull(config.config[Config_DeltaStoreLimit].c_str(), NULL, 0);
+		}
+		baseTexts = new BaseTextStore(config.config[Config_DeltaStore], limit * 1024 * 1024);
+		if(config.onlyRepository)
+		{
+			// Large fetched texts can then become bases without being copied.
+			FileContents::SetSpoolDirectory(baseTexts->SpoolDirectory());
+		}
+	}
+
+	BlobCache* blobCache = NULL;
+	try {
+		if(config.config[Config_BlobCache].size())
+		{
+			blobCache = new BlobCache(config.config[Config_BlobCache], config.config[Config_RepoURL]);
+		}
+
+		ExportRevisions(config, connection, exporter, baseTexts, blobCache, checkpoint, startRev, endRev);
+	} catch(...) {
+		delete blobCache;
+		delete baseTexts;
+		throw;
+	}
+
+	if(blobCache)
+	{
+		Output::Printf("progress Blob cache: %lu hits, %lu misses" LF, blobCache->GetHits(), blobCache->GetMisses());
+	}
+	delete blobCache;
+	delete baseTexts;
+}
+
+void Export(Config& config, Recorder* recorder)
+{
+	SVNSimple connection(config.config[Config_RepoURL], config.config[Config_Username], config.config[Config_Password]);
+	if(recorder)
+	{
+		connection.SetRecorder(recorder);
+	}
 	FastExport exporter(config.config[Config_GitRef], config.config[Config_ParentSHA]);
 
-	std::vector<SVNSimple::Revision> revisions;
-	svn_revnum_t curStart = startRev;
-	svn_revnum_t curEnd = Min(endRev, curStart + 256);
-	do
+	std::string const& trunk = config.config[Config_TrunkPath];
+	std::string const& branches = config.config[Config_BranchesPath];
+	std::string const& tags = config.config[Config_TagsPath];
+	Layout layout(trunk, branches, tags, config.config[Config_GitRef]);
+	if(trunk.size() || branches.size() || tags.size())
 	{
-		revisions.clear();
-		printf("progress Getting log for revisions %lu:%lu" LF, curStart, curEnd);
-		connection.Replay(revisions, curStart, curEnd);
+		exporter.SetLayout(&layout);
+	}
 
-		FilterIgnoredFiles(revisions, config.ignoredPaths);
-		AddSVNSourceTag(revisions, config.config[Config_RepoName]);
-		RewriteCommitters(revisions, config.users, config.config[Config_UserPrefix]);
+	std::string const& marksFile = config.config[Config_MarksFile];
+	if(marksFile.empty())
+	{
+		ExportHistory(config, connection, exporter, NULL);
+		return;
+	}
+
+	RevisionIndex revisionIndex(marksFile + ".revs");
+	exporter.ImportMarks(marksFile, &revisionIndex);
+	// Marks are handed out in order, so a commit whose mark fast-import
+	// didn't export never made it into git.  A revision only counts as
+	// committed once all of its commits are.
+	size_t committed = revisionIndex.Size();
+	while(committed && revisionIndex[committed - 1].m_mark >= exporter.GetNextMark())
+	{
+		committed -= 1;
+	}
+	while(committed && committed < revisionIndex.Size() && revisionIndex[committed - 1].m_revision == revisionIndex[committed].m_revision)
+	{
+		committed -= 1;
+	}
+	revisionIndex.Truncate(committed);
+	exporter.SetRevisionIndex(&revisionIndex);
 
-		exporter.DumpRevisions(connection, revisions);
+	ExportHistory(config, connection, exporter, &revisionIndex);
+}
 
-		curStart = curEnd + 1;
-		curEnd = Min(endRev, curStart + 256);
+void Export(Config& config)
+{
+	std::string const& recordFile = config.config[Config_RecordFile];
+	if(recordFile.empty())
+	{
+		Export(config, NULL);
+		return;
 	}
-	while(curStart <= endRev && curEnd <= endRev);
+
+	// Outlives every session recording to it.
+	Recorder recorder(recordFile);
+	Export(config, &recorder);
 }
 
-int main(int argc, char** argv)
+void PrintConfig(Config const& config)
 {
-	if(argc > 1)
+	for(unsigned int i = 0; i < Config_NUM; i += 1)
 	{
-		help();
-		return -1;
+		if(config.config[i].size())
+		{
+			Output::Printf("# Config: \"%s\" = \"%s\"" LF, Config::keys[i].name, config.config[i].c_str());
+		}
+	}
+}
+
+// Exports one repository to stdout or wherever its config says.
+void ExportRepository(Config& config)
+{
+	std::string const& command = config.config[Config_OutputCommand];
+	std::string const& file = config.config[Config_OutputFile];
+	FILE* pipe = NULL;
+	int fd = STDOUT_FILENO;
+	if(command.size())
+	{
+		// Close on exec, so that other repositories' commands don't hold
+		// this one's stream open.
+		pipe = popen(command.c_str(), "we");
+		if(pipe == NULL)
+		{
+			throw EXCEPTION(("Could not run %s: %s", command.c_str(), strerror(errno)));
+		}
+		fd = fileno(pipe);
+	}
+	else if(file.size())
+	{
+		fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if(fd < 0)
+		{
+			throw EXCEPTION(("Could not open %s: %s", file.c_str(), strerror(errno)));
+		}
 	}
 
-	Config config;
+	std::string error;
+	Output* output = NULL;
+	Stats stats;
+	Stats::Scope statsScope(&stats);
+	Trace::NameThread("Export " + config.config[Config_RepoName]);
+	try {
+		output = Output::Open(fd, OUTPUT_BUFFER_SIZE, OUTPUT_BUFFERS);
+		Output::Scope scope(output);
+		PrintConfig(config);
+		Export(config);
+	} catch(std::exception const& e) {
+		error = e.what();
+	}
 
-	SVNSimple::Init();
+	try {
+		if(output && error.size())
+		{
+			// Whatever is buffered may end part way through a command, so it
+			// is not written out; fast-import keeps what it last checkpointed.
+			Output::Abandon(output);
+		}
+		else if(output)
+		{
+			Output::Close(output);
+		}
+	} catch(std::exception const& e) {
+		error = e.what();
+	}
+
+	if(pipe)
+	{
+		int status = pclose(pipe);
+		if(error.empty() && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+		{
+			throw EXCEPTION(("%s failed with status %d", command.c_str(), status));
+		}
+	}
+	else if(fd != STDOUT_FILENO)
+	{
+		close(fd);
+	}
+
+	std::string const& statsFile = config.config[Config_StatsFile];
+	if(statsFile.size())
+	{
+		try {
+			stats.Save(statsFile, config.config[Config_RepoName], config.config[Config_RepoURL], error);
+		} catch(std::exception const& e) {
+			if(error.empty())
+			{
+				error = e.what();
+			}
+		}
+	}
+
+	if(error.size())
+	{
+		throw Exception(error);
+	}
+}
+
+/**
+ * Exports a number of repositories at once, each on a worker thread with
+ * its own sessions and fast-import stream.  A repository failing doesn't
+ * stop the others.
+ */
+class ExportPool
+{
+public:
+	ExportPool(std::vector<Config>& repositories, unsigned int numWorkers) :
+		m_repositories(repositories),
+		m_numWorkers(numWorkers? numWorkers : 1),
+		m_next(0),
+		m_failures(0)
+	{
+	}
 
-	ReadConfig(config);
+	// Returns how many of the repositories failed.
+	unsigned int Run()
+	{
+		std::vector<Worker*> workers;
+		for(size_t i = 0; i < m_numWorkers && i < m_repositories.size(); i += 1)
+		{
+			Worker* worker = new Worker(*this);
+			try {
+				worker->Start();
+			} catch(std::exception const& e) {
+				// Those already started carry on with every repository.
+				fprintf(stderr, "[ERROR] %s\n", e.what());
+				delete worker;
+				break;
+			}
+			workers.push_back(worker);
+		}
+		if(workers.empty())
+		{
+			return m_repositories.size();
+		}
+
+		for(std::vector<Worker*>::iterator it = workers.begin(); it != workers.end(); ++it)
+		{
+			(*it)->Join();
+			delete *it;
+		}
+		return m_failures;
+	}
+
+private:
+	class Worker : public Thread
+	{
+	public:
+		Worker(ExportPool& pool) : m_pool(pool) { }
+
+	protected:
+		void Run()
+		{
+			Config* config;
+			while((config = m_pool.NextRepository()))
+			{
+				try {
+					ExportRepository(*config);
+				} catch(std::exception const& e) {
+					fprintf(stderr, "[ERROR] %s: %s\n", config->config[Config_RepoName].c_str(), e.what());
+					m_pool.Failed();
+				}
+			}
+		}
+
+		ExportPool& m_pool;
+	};
+
+	Config* NextRepository()
+	{
+		ScopedLock lock(m_mutex);
+		return m_next < m_repositories.size()? &m_repositories[m_next++] : NULL;
+	}
+
+	void Failed()
+	{
+		ScopedLock lock(m_mutex);
+		m_failures += 1;
+	}
+
+	std::vector<Config>& m_repositories;
+	size_t m_numWorkers;
+
+	Mutex m_mutex;
+	size_t m_next;
+	unsigned int m_failures;
+};
+
+bool CheckConfig(Config& config, bool needsOutput)
+{
 	if(config.config[Config_RepoURL].size() == 0)
 	{
 		fprintf(stderr, "[ERROR] No repo url specified\n");
-		help();
-		return -1;
+		return false;
 	}
 	if(config.config[Config_RepoName].size() == 0)
 	{
 		fprintf(stderr, "[ERROR] No repo name specified\n");
-		help();
-		return -1;
+		return false;
 	}
-	if(config.config[Config_StartRev].size() == 0)
+	if(config.config[Config_StartRev].size() == 0 && config.config[Config_MarksFile].size() == 0)
 	{
-		fprintf(stderr, "[ERROR] No start revision specified\n");
-		help();
-		return -1;
+		fprintf(stderr, "[ERROR] No start revision specified for %s\n", config.config[Config_RepoName].c_str());
+		return false;
+	}
+	if(needsOutput && config.config[Config_OutputCommand].size() == 0 && config.config[Config_OutputFile].size() == 0)
+	{
+		fprintf(stderr, "[ERROR] No output-command or output-file for %s\n", config.config[Config_RepoName].c_str());
+		return false;
 	}
 	if(config.config[Config_GitRef].size() == 0)
 	{
 		config.config[Config_GitRef] = "refs/remotes/svn/";
 		config.config[Config_GitRef].append(config.config[Config_RepoName]);
 	}
+	return true;
+}
 
-	for(unsigned int i = 0; i < Config_NUM; i += 1)
+int main(int argc, char** argv)
+{
+	if(argc > 1)
 	{
-		if(config.config[i].size())
+		help();
+		return -1;
+	}
+
+	Config defaults;
+	std::vector<Config> repositories;
+
+	SVNSimple::Init();
+	Output::Init();
+	Stats::Init();
+	Trace::Init();
+	// A fast-import which has gone away is then a write error, rather than
+	// killing every export.
+	signal(SIGPIPE, SIG_IGN);
+
+	ReadConfig(defaults, repositories);
+	if(repositories.empty())
+	{
+		if(!CheckConfig(defaults, false))
+		{
+			help();
+			return -1;
+		}
+	}
+	for(std::vector<Config>::iterator it = repositories.begin(); it != repositories.end(); ++it)
+	{
+		it->onlyRepository = repositories.size() == 1;
+		// They can't all write to stdout.
+		if(!CheckConfig(*it, repositories.size() > 1))
 		{
-			printf("# Config: \"%s\" = \"%s\"" LF, Config::keys[i].name, config.config[i].c_str());
+			help();
+			return -1;
+		}
+	}
+
+	if(defaults.config[Config_MaxRequests].size())
+	{
+		SVNSimple::SetRequestLimit(strtoul(defaults.config[Config_MaxRequests].c_str(), NULL, 0));
+	}
+	if(defaults.config[Config_PlaybackLatency].size())
+	{
+		PlaybackSession::SetLatency(strtoul(defaults.config[Config_PlaybackLatency].c_str(), NULL, 0) * 1000);
+	}
+	if(defaults.config[Config_TraceFile].size())
+	{
+		try {
+			Trace::Open(defaults.config[Config_TraceFile]);
+		} catch(std::exception const& e) {
+			fprintf(stderr, "[ERROR] %s\n", e.what());
+			return 1;
 		}
 	}
 
-	Export(config);
+	if(repositories.empty())
+	{
+		try {
+			ExportRepository(defaults);
+		} catch(std::exception const& e) {
+			fprintf(stderr, "[ERROR] %s\n", e.what());
+			Trace::Close();
+			return 1;
+		}
+	}
+	else
+	{
+		unsigned int jobs = 4;
+		if(defaults.config[Config_Jobs].size())
+		{
+			jobs = strtoul(defaults.config[Config_Jobs].c_str(), NULL, 0);
+		}
+
+		ExportPool pool(repositories, jobs);
+		unsigned int failures = pool.Run();
+		if(failures)
+		{
+			fprintf(stderr, "[ERROR] %u of %lu repositories failed\n", failures, static_cast<unsigned long>(repositories.size()));
+			Trace::Close();
+			return 1;
+		}
+	}
 
+	Trace::Close();
 	SVNSimple::Shutdown();
 
 	return 0;
@@ -38,9 +38,16 @@ if [ -z "$ref" ];then
 	fi
 fi
 
+marks="$(git rev-parse --git-dir)/svn-escape-$repo.marks"
+
 # Get the svn revision and git sha of the last revision synced, or prompt
-# the user for the starting revision if this is the first run.
-if git log -1 "$ref" > /dev/null 2>&1; then
+# the user for the starting revision if this is the first run.  Once there
+# are marks, svnescape carries on from the last commit it made by itself.
+if [ -f "$marks.revs" ] && [ $(wc -c < "$marks.revs") -gt 8 ]; then
+	# The revision in the last record; the first 8 bytes are a header
+	last=$(tail -c 8 "$marks.revs" | od -An -tu4 | awk '{print $1}')
+	[ ! -z "$revplus" ] && erev=$((last + 1 + revplus))
+elif git log -1 "$ref" > /dev/null 2>&1; then
 	sha=$(git log -1 "$ref" | sed -nre 's/^commit ([^ ]+)$/\1/p')
 	src=$(git log -1 "$ref" | sed -nre 's/^[ \t]*svn-source: ([^@]+@[0-9]+)$/\1/p')
 
@@ -61,9 +68,10 @@ else
 	[ -z "$rev" ] && rev=0
 fi
 
-[ ! -z "$revplus" ] && erev=$((rev + revplus))
+[ ! -z "$rev" ] && [ ! -z "$revplus" ] && erev=$((rev + revplus))
 
 url=$(git config "svn-escape.$repo.url")
+checkpoint="$(git rev-parse --git-dir)/svn-escape-$repo.checkpoint"
 username=$(git config "svn-escape.$repo.username")
 passwd=$(git config "svn-escape.$repo.password")
 
@@ -73,13 +81,16 @@ passwd=$(git config "svn-escape.$repo.password")
 	echo "=repo-name $repo"
 	[ ! -z "$username" ] && echo "=username $username"
 	[ ! -z "$passwd" ] && echo "=password $passwd"
-	echo "=start-rev $rev"
+	[ ! -z "$rev" ] && echo "=start-rev $rev"
 	[ ! -z "$erev" ] && echo "=end-rev $erev"
 	echo "=git-ref $ref"
 	[ ! -z "$sha" ] && echo "=parent-sha $sha"
+	# Skips revisions already done if the ref is where the last run left it
+	echo "=checkpoint-file $checkpoint"
+	echo "=marks-file $marks"
 
 	git config --get-all "svn-escape.$repo.ignore" | while read line;do
 		echo "=ignore-path $line"
 	done
-) | svnescape | git fast-import
+) | svnescape | git fast-import --import-marks-if-exists="$marks" --export-marks="$marks"
 